@@ -11,13 +11,19 @@
 #include <nudb/context.hpp>
 #include <nudb/file.hpp>
 #include <nudb/type_traits.hpp>
+#include <nudb/detail/bloom_filter.hpp>
+#include <nudb/detail/bucket_cache.hpp>
 #include <nudb/detail/cache.hpp>
 #include <nudb/detail/gentex.hpp>
+#include <nudb/detail/mapped_file.hpp>
 #include <nudb/detail/mutex.hpp>
 #include <nudb/detail/pool.hpp>
 #include <nudb/detail/store_base.hpp>
 #include <boost/optional.hpp>
 #include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
 
 namespace nudb {
 
@@ -52,6 +58,14 @@ public:
     using hash_type = Hasher;
     using file_type = File;
 
+    /// A key/value pair to insert with @ref insert_batch
+    struct item_type
+    {
+        void const* key;    // A buffer holding the key
+        void const* data;   // A buffer holding the value
+        nsize_t size;       // The size of the value in bytes
+    };
+
 private:
     using clock_type =
         std::chrono::steady_clock;
@@ -75,10 +89,18 @@ private:
         detail::pool p0;
         detail::pool p1;
         detail::cache c1;
+        detail::bucket_cache bc;
+        detail::bloom_filter bf;
+        detail::mapped_file km;
         detail::key_file_header kh;
 
         std::size_t rate = 0;
         std::size_t burst = 4 * 1024 * 1024;
+        std::size_t threads = 1;
+        durability dur = durability::full;
+        std::size_t flush_bytes = 0;
+        std::size_t flush_items = 0;
+        bool requested = false;     // early flush requested
         time_point when = clock_type::now();
 
         state(state const&) = delete;
@@ -94,6 +116,7 @@ private:
     };
 
     bool open_ = false;
+    bool read_only_ = false;
 
     // Use optional because some
     // members cannot be default-constructed.
@@ -105,15 +128,25 @@ private:
     nbuck_t buckets_;               // number of buckets
     nbuck_t modulus_;               // hash modulus
 
-    std::mutex u_;                  // serializes insert()
+    // Inserts of keys with equal hashes are serialized
+    // by one of these, chosen by the hash.
+    static std::size_t constexpr insert_stripes = 64;
+    std::mutex u_[insert_stripes];
     detail::gentex g_;
-    boost::shared_mutex m_;
+    mutable boost::shared_mutex m_;
+    std::mutex cm_;                 // held for the length of a commit
+    std::mutex rk_;                 // serializes calls to rekey
 
     error_code ec_;
     std::atomic<bool> ecb_;         // `true` when ec_ set
 
-    std::size_t dataWriteSize_;
-    std::size_t logWriteSize_;
+    std::size_t dataWriteSize_ = 0;
+    std::size_t logWriteSize_ = 0;
+    std::size_t keyWriteSize_ = 0;
+    std::size_t dataReadSize_ = 0;  // largest merged read in fetch_batch
+
+    double filterRate_ = 0;
+    std::size_t filterBytes_ = 0;
 
     struct deleter
     {
@@ -130,6 +163,36 @@ private:
 
     std::unique_ptr<context, deleter> ctx_;
 
+    struct fetch_op;
+
+    // A key of a batch, and an entry in the
+    // key file whose hash matches that key.
+    struct batch_probe
+    {
+        detail::nhash_t h;
+        nbuck_t n;
+        std::size_t i;
+    };
+
+    struct batch_candidate
+    {
+        noff_t offset;
+        nsize_t size;
+        std::size_t i;
+    };
+
+    // Completed asynchronous fetches awaiting poll
+    std::mutex rm_;
+    std::vector<std::function<void()>> ready_;
+    std::atomic<std::size_t> outstanding_{0};
+
+    // Changed under the lock before buckets in the key file
+    // are rewritten, so that a key file read made without a
+    // generation lock can tell that it might be stale.
+    std::atomic<std::size_t> kgen_{0};
+    std::atomic<std::size_t> kreads_{0};    // key file reads in flight
+    bool kswap_ = false;                    // rekey is replacing the key file
+
 public:
     /** Default constructor.
 
@@ -344,6 +407,62 @@ public:
         error_code& ec,
         Args&&... args);
 
+    /** Open a database for reading only.
+
+        The database identified by the specified data, key, and
+        log file paths is opened without write access to any file.
+        The log file is never created, and recovery is not run: if
+        a log file is present, `ec` is set to
+        @ref error::log_file_exists and the database is not opened.
+
+        A database opened this way is not registered with the
+        @ref context, and @ref insert sets `ec` to
+        @ref error::read_only. Any number of processes may
+        open the same files for reading at once, as long as
+        none of them opens the files for writing.
+
+        @par Requirements
+
+        The database must be not be open.
+
+        @par Thread safety
+
+        Not thread safe. The caller is responsible for
+        ensuring that no other member functions are
+        called concurrently.
+
+        @param dat_path The path to the data file.
+
+        @param key_path The path to the key file.
+
+        @param log_path The path to the log file, which
+        is only checked for existence.
+
+        @param ec Set to the error, if any occurred.
+
+        @param args Optional arguments passed to @b File constructors.
+    */
+    template<class... Args>
+    void
+    open_read_only(
+        path_type const& dat_path,
+        path_type const& key_path,
+        path_type const& log_path,
+        error_code& ec,
+        Args&&... args);
+
+    /** Returns `true` if the database was opened read only.
+
+        @par Requirements
+
+        The database must be open.
+    */
+    bool
+    is_read_only() const
+    {
+        return read_only_;
+    }
+
     /** Fetch a value.
 
         The function checks the database for the specified
@@ -389,12 +508,178 @@ public:
     void
     fetch(void const* key, Callback && callback, error_code& ec);
 
+    /** Fetch a value into a caller provided buffer.
+
+        The value associated with the key is read directly into
+        `buffer`, without allocating memory. If the value does
+        not fit, the buffer is left unchanged and the size of
+        the value is returned, so that the caller may retry with
+        a larger buffer.
+
+        If the key is not found, `ec` is set to
+        @ref error::key_not_found. If any other errors occur,
+        `ec` is set to the corresponding error.
+
+        @par Requirements
+
+        The database must be open.
+
+        @par Thread safety
+
+        Safe to call concurrently with any function except
+        @ref close.
+
+        @param key A pointer to a memory buffer of at least
+        @ref key_size() bytes, containing the key to be searched
+        for.
+
+        @param buffer The location to store the value.
+
+        @param size The size of `buffer` in bytes.
+
+        @param ec Set to the error, if any occurred.
+
+        @return The size of the value in bytes, or zero
+        if an error occurred.
+    */
+    std::size_t
+    fetch(void const* key, void* buffer,
+        std::size_t size, error_code& ec);
+
+    /** Fetch several values.
+
+        The function checks the database for each of the specified
+        keys, and invokes the callback once for every key which is
+        found. Keys which are not found produce no callback, and are
+        not treated as an error.
+
+        This is more efficient than calling @ref fetch in a loop.
+        The keys are hashed together, each distinct bucket in the
+        key file is read once no matter how many keys map to it,
+        and the value reads are issued in data file order with
+        adjacent records read together.
+
+        @par Requirements
+
+        The database must be open.
+
+        @par Thread safety
+
+        Safe to call concurrently with any function except
+        @ref close.
+
+        @note If the implementation encounters an error while
+        committing data to the database, this function will
+        immediately return with `ec` set to the error which
+        occurred. If an error occurs part way through, some of the
+        callbacks may already have been invoked.
+
+        @param keys A pointer to an array of `count` pointers, each
+        pointing to a memory buffer of at least @ref key_size() bytes
+        containing a key to be searched for.
+
+        @param count The number of keys.
+
+        @param callback A function which will be called with the
+        value data of each key which is found, in no particular
+        order. The equivalent signature must be:
+        @code
+        void callback(
+            std::size_t index,  // The index of the key in `keys`
+            void const* buffer, // A buffer holding the value
+            std::size_t size    // The size of the value in bytes
+        );
+        @endcode
+        The buffer provided to the callback remains valid
+        until the callback returns, ownership is not transferred.
+
+        @param ec Set to the error, if any occurred.
+    */
+    template<class Callback>
+    void
+    fetch_batch(void const* const* keys, std::size_t count,
+        Callback&& callback, error_code& ec);
+
+    /** Start fetching a value asynchronously.
+
+        The reads from the key file and the data file needed to
+        find the key are queued and this function returns without
+        waiting for them. When the file type provides asynchronous
+        reads, such as @ref io_uring_file, many fetches may be in
+        flight at once on a single thread. Otherwise the reads are
+        performed before the function returns.
+
+        The handler is never invoked from within this function.
+        It is invoked from within a later call to @ref poll or
+        @ref run_one, on the thread making that call.
+
+        @par Requirements
+
+        The database must be open, and must remain open until the
+        handler has been invoked.
+
+        @par Thread safety
+
+        Safe to call concurrently with any function except
+        @ref close.
+
+        @note The reads of a fetch hold no lock, so outstanding
+        fetches never hold back a commit. A bucket read from the
+        key file while a commit may have rewritten it is read
+        again. @ref close completes the reads of outstanding
+        fetches, but their handlers are not invoked.
+
+        @param key A pointer to a memory buffer of at least
+        @ref key_size() bytes, containing the key to be searched
+        for. The key is copied before the function returns.
+
+        @param handler The function to invoke upon completion. If
+        the key is not found, `ec` is set to @ref error::key_not_found.
+        The equivalent signature must be:
+        @code
+        void handler(
+            error_code const& ec,   // The result of the fetch
+            void const* buffer,     // A buffer holding the value
+            std::size_t size        // The size of the value in bytes
+        );
+        @endcode
+        The buffer provided to the handler remains valid
+        until the handler returns, ownership is not transferred.
+    */
+    template<class Handler>
+    void
+    async_fetch(void const* key, Handler&& handler);
+
+    /** Invoke the handlers of completed asynchronous fetches.
+
+        Reads queued by @ref async_fetch are submitted, and the
+        handlers of the fetches which have completed are invoked.
+        This function does not block.
+
+        @return The number of handlers invoked.
+    */
+    std::size_t
+    poll();
+
+    /** Block until at least one asynchronous fetch completes.
+
+        The handlers of the fetches which have completed are
+        invoked. If no fetches are outstanding, returns
+        immediately.
+
+        @return The number of handlers invoked.
+    */
+    std::size_t
+    run_one();
+
     /** Insert a value.
 
         This function attempts to insert the specified key/value
         pair into the database. If the key already exists,
-        `ec` is set to @ref error::key_exists. If an error
-        occurs, `ec` is set to the corresponding error.
+        `ec` is set to @ref error::key_exists. If the database
+        was opened with @ref open_read_only, `ec` is set to
+        @ref error::read_only. If an error occurs, `ec` is set
+        to the corresponding error.
 
         @par Requirements
 
@@ -403,7 +688,8 @@ public:
         @par Thread safety
 
         Safe to call concurrently with any function except
-        @ref close.
+        @ref close. Concurrent inserts of different keys check
+        for duplicates in parallel.
 
         @note If the implementation encounters an error while
         committing data to the database, this function will
@@ -427,6 +713,96 @@ public:
     insert(void const* key, void const* data,
         nsize_t bytes, error_code& ec);
 
+    /** Insert a value whose key is known to be new.
+
+        This function inserts the specified key/value pair
+        without looking for the key in the key file, so no
+        buckets or spill records are read. Only the values held
+        in memory, which have not yet been written to the key
+        file, are checked: if the key is among them `ec` is set
+        to @ref error::key_exists. This is intended for loading
+        data whose keys are already known to be unique, such as
+        keys which are a cryptographic digest of the value.
+
+        @par Requirements
+
+        The database must be open. The caller must guarantee that
+        the key is not already in the database. If it is, the
+        database will hold two values for the key, and @ref fetch
+        may return either one of them. Such a database still
+        passes @ref verify.
+
+        @par Thread safety
+
+        Safe to call concurrently with any function except
+        @ref close.
+
+        @note If the implementation encounters an error while
+        committing data to the database, this function will
+        immediately return with `ec` set to the error which
+        occurred. All subsequent calls to @ref insert will
+        return the same error until the database is closed.
+
+        @param key A buffer holding the key to be inserted. The
+        size of the buffer should be at least the `key_size`
+        associated with the open database.
+
+        @param data A buffer holding the value to be inserted.
+
+        @param bytes The size of the buffer holding the value
+        data. This value must be greater than 0 and no more
+        than 0xffffffff.
+
+        @param ec Set to the error, if any occurred.
+    */
+    void
+    insert_unchecked(void const* key, void const* data,
+        nsize_t bytes, error_code& ec);
+
+    /** Insert a batch of values.
+
+        This function attempts to insert each of the specified
+        key/value pairs into the database. The result of each
+        insert is stored in the corresponding element of
+        `results`: if the key already exists in the database, or
+        appears earlier in the same batch, it is set to
+        @ref error::key_exists and the value is not inserted.
+        Otherwise it is cleared.
+
+        This is more efficient than calling @ref insert in a loop.
+        The keys are hashed together, each distinct bucket in the
+        key file is read once no matter how many keys map to it,
+        and the locks are acquired once for the whole batch.
+
+        @par Requirements
+
+        The database must be open.
+
+        @par Thread safety
+
+        Safe to call concurrently with any function except
+        @ref close.
+
+        @note If the implementation encounters an error while
+        committing data to the database, this function will
+        immediately return with `ec` set to the error which
+        occurred, and no values of the batch are inserted.
+
+        @param items A pointer to an array of `count` items to
+        insert. Each value size must be greater than 0 and no
+        more than 0xffffffff.
+
+        @param count The number of items.
+
+        @param results A pointer to an array of `count` error
+        codes, set to the result of inserting each item.
+
+        @param ec Set to the error, if any occurred.
+    */
+    void
+    insert_batch(item_type const* items, std::size_t count,
+        error_code* results, error_code& ec);
+
     /** Set the burst size
 
         This function sets the amount of data that can be
@@ -443,25 +819,338 @@ public:
     void
     set_burst(std::size_t burst_size);
 
+    /** Set the number of threads used to commit
+
+        A commit appends the inserted values to the data file,
+        then inserts them into their buckets, splitting buckets
+        as the database grows, and finally writes the modified
+        buckets to the key file. When more than one thread is
+        set, the bucket updates and the key file writes are
+        divided among that many threads. The data file appends
+        are always performed in order by a single thread.
+
+        The default is one thread.
+
+        @par Thread safety
+
+        Safe to call concurrently with any function except
+        @ref close.
+
+        @param threads The number of threads, or zero to use
+        one thread per hardware thread.
+    */
+    void
+    set_commit_threads(std::size_t threads);
+
+    /** Set the durability policy
+
+        This function sets how commits synchronize the files
+        to disk. The policy takes effect with the next commit.
+        Weaker policies make commits faster, at the cost of
+        the guarantees described in @ref durability.
+
+        The default is @ref durability::full.
+
+        @par Thread safety
+
+        Safe to call concurrently with any function except
+        @ref close.
+
+        @param policy The durability policy.
+    */
+    void
+    set_durability(durability policy);
+
+    /** Set the thresholds for an early flush
+
+        Inserted data is normally committed when the context
+        services the database, about once per second. When
+        either threshold is set, reaching it requests that the
+        context flush the database as soon as a thread is
+        available, without waiting for the next period.
+
+        @par Thread safety
+
+        Safe to call concurrently with any function except
+        @ref close.
+
+        @param bytes The number of bytes of inserted data,
+        or zero for no threshold.
+
+        @param items The number of inserted values, or
+        zero for no threshold.
+    */
+    void
+    set_flush_threshold(std::size_t bytes, std::size_t items);
+
+    /** Set the size of the bucket cache
+
+        The bucket cache keeps copies of recently used key file
+        buckets in memory, so that @ref fetch and @ref insert can
+        find them without reading the key file. Buckets modified
+        by a commit are refreshed in the cache rather than
+        discarded. When the cache is full, buckets which have not
+        been used recently are replaced.
+
+        The cache is disabled by default. Changing the size
+        discards the current contents.
+
+        @par Requirements
+
+        The database must be open.
+
+        @par Thread safety
+
+        Safe to call concurrently with any function except
+        @ref close.
+
+        @param bytes The amount of memory to use for cached
+        buckets. Zero disables the cache.
+    */
+    void
+    set_cache_size(std::size_t bytes);
+
+    /** Set whether the key file is memory mapped
+
+        When the key file is mapped, @ref fetch and @ref insert
+        examine buckets directly in the mapping instead of
+        reading them into a buffer. Commits continue to write
+        the key file normally, and the changes are visible
+        through the mapping because it shares the page cache.
+        This is most effective when the key file fits in memory.
+        While the key file is mapped the bucket cache is not
+        used for lookups.
+
+        The key file is not mapped by default.
+
+        @par Requirements
+
+        The database must be open.
+
+        @par Thread safety
+
+        Safe to call concurrently with any function except
+        @ref close.
+
+        @param mapped `true` to map the key file, `false` to
+        stop using the mapping.
+
+        @param ec Set to the error, if any occurred. If the
+        platform does not support mapping files, this is set
+        to `errc::function_not_supported`.
+    */
+    void
+    set_key_file_mapped(bool mapped, error_code& ec);
+
+    /** Set the parameters of the key filter
+
+        The key filter is a Bloom filter of the keys in the
+        database, kept in memory. @ref fetch and @ref insert
+        consult it before reading the key file, so that most
+        lookups of absent keys need no I/O. The filter is
+        built when the database is opened, and every commit
+        adds the inserted keys to it.
+
+        When the database is closed, the filter is saved to
+        a file whose path is the key file path with ".bf"
+        appended. The next @ref open reads this file instead
+        of scanning the key file, if it matches the database
+        and these parameters. The file is removed on open,
+        so a database which was not closed cleanly rebuilds
+        its filter.
+
+        The filter is sized when the database is opened, with
+        room for twice the keys the key file holds then. A
+        filter which fills up because the database grew is
+        only less selective, and is resized the next time
+        the database is opened.
+
+        There is no filter by default.
+
+        @par Requirements
+
+        The database must not be open.
+
+        @param rate The target false positive rate, which must
+        be less than one. Zero disables the filter.
+
+        @param bytes The maximum size of the filter in bytes,
+        or zero for no limit. If the limit is reached the false
+        positive rate is higher than the target.
+    */
+    void
+    set_filter(double rate, std::size_t bytes);
+
+    /** Rebuild the key file while the database remains open.
+
+        A new key file with the given block size and load factor
+        is built from the data file next to the current one, and
+        then replaces it. This also removes the long chains of
+        spill records which a key file accumulates as it grows.
+        Inserts, fetches and commits continue while the new key
+        file is built. Records committed meanwhile are added to
+        it afterwards, and then once more with commits held back
+        until the new key file is in place. Inserts and fetches
+        only wait for the few moments it takes to switch files.
+
+        The bucket count is estimated from the size of the
+        current key file. The salt is unchanged, so the key
+        filter remains valid.
+
+        The new key file is created with the path of the key
+        file with ".rekey" appended, and renamed over the key
+        file when it is complete. If the process terminates
+        first, the database is unaffected and the partial file
+        may be removed. Spill records written to the data file
+        by an abandoned rebuild are unused, and are reported as
+        wasted space by @ref verify.
+
+        The records of the data file are sorted by bucket into
+        temporary files next to the key file, named by appending
+        ".rekey.rk" and a number to its path. They need up to
+        20 bytes of free space for each record, and are removed
+        before the function returns. If a file with one of these
+        names already exists, the function fails and leaves that
+        file in place.
+
+        @par Requirements
+
+        The database must be open, and not opened with
+        @ref open_read_only.
+
+        @par Thread safety
+
+        Safe to call concurrently with any function except
+        @ref close. Concurrent calls to rekey are performed
+        one after the other. Before the files are switched,
+        this function completes the key file reads queued by
+        @ref async_fetch, whose handlers are invoked by a later
+        call to @ref poll or @ref run_one as usual.
+
+        @param blockSize The size of a block in the new key file.
+
+        @param loadFactor A number between zero and one
+        representing the average bucket occupancy in the new
+        key file.
+
+        @param bufferSize The number of bytes to allocate for
+        building buckets in memory.
+
+        @param threads The number of threads used to build
+        buckets, or zero to use one thread per hardware thread.
+
+        @param ec Set to the error, if any occurred.
+
+        @param progress A function which will be called periodically
+        while the key file is built from the data file. The
+        equivalent signature of the progress function must be:
+        @code
+        void progress(
+            std::uint64_t amount,   // Amount of work done so far
+            std::uint64_t total     // Total amount of work to do
+        );
+        @endcode
+
+        @param args Optional arguments passed to @b File constructors.
+    */
+    template<class Progress, class... Args>
+    void
+    rekey(std::size_t blockSize, float loadFactor,
+        std::size_t bufferSize, std::size_t threads,
+            error_code& ec, Progress&& progress, Args&&... args);
+
 private:
     template<class Callback>
     void
-    fetch(detail::nhash_t h, void const* key,
-        detail::bucket b, Callback && callback, error_code& ec);
+    fetch(detail::nhash_t h, void const* key, detail::bucket b,
+        Callback && callback, detail::scratch& sc, error_code& ec);
+
+    void
+    async_lookup(std::shared_ptr<fetch_op> const& op);
+
+    void
+    finish_reads();
+
+    void
+    async_bucket(std::shared_ptr<fetch_op> const& op);
+
+    void
+    async_scan(std::shared_ptr<fetch_op> const& op);
+
+    void
+    async_spill(std::shared_ptr<fetch_op> const& op);
+
+    void
+    async_complete(std::shared_ptr<fetch_op> const& op,
+        error_code const& ec);
+
+    void
+    find_batch(std::vector<batch_probe>& probes,
+        std::vector<batch_candidate>& candidates,
+            detail::shared_lock_type& m, error_code& ec);
+
+    void
+    throttle(detail::unique_lock_type& m);
 
     bool
     exists(detail::nhash_t h, void const* key,
-        detail::shared_lock_type* lock, detail::bucket b, error_code& ec);
+        detail::shared_lock_type* lock, detail::bucket b,
+            detail::bucket::value_type* match, detail::scratch& sc,
+                error_code& ec);
 
     void
     split(detail::bucket& b1, detail::bucket& b2,
         detail::bucket& tmp, nbuck_t n1, nbuck_t n2,
             nbuck_t buckets, nbuck_t modulus,
-                detail::bulk_writer<File>& w, error_code& ec);
+                detail::bulk_writer<File>& w, std::mutex* wm,
+                    error_code& ec);
+
+    template<class Spill>
+    void
+    rekey_catch_up(File& kf, detail::key_file_header const& kh,
+        noff_t first, noff_t last, std::size_t readSize,
+            Spill&& spill, error_code& ec);
+
+    void
+    rekey_spill(detail::bucket& b, error_code& ec);
+
+    void
+    rekey_swap(File& kf, detail::key_file_header const& kh,
+        path_type const& path, error_code& ec);
+
+    void
+    open_state(File&& df, File&& kf, File&& lf,
+        path_type const& dat_path, path_type const& key_path,
+            path_type const& log_path, error_code& ec);
+
+    void
+    open_filter(state& s, error_code& ec);
+
+    void
+    close_filter(error_code& ec);
 
     detail::bucket
-    load(nbuck_t n, detail::cache& c1,
-        detail::cache& c0, void* buf, error_code& ec);
+    read_bucket(nbuck_t n, detail::mapped_view const& mv,
+        void* buf, bool fill, error_code& ec);
+
+    detail::bucket
+    load(nbuck_t n, detail::cache& c1, detail::cache& c0,
+        detail::mapped_view const& mv, void* buf, error_code& ec);
+
+    template<class Split, class Insert>
+    void
+    replay(std::size_t& frac, nbuck_t& buckets,
+        nbuck_t& modulus, Split&& split, Insert&& insert);
+
+    void
+    update_parallel(std::size_t threads,
+        detail::cache& c1, detail::cache& c0,
+            detail::mapped_view const& mv,
+                detail::bulk_writer<File>& w, nbuck_t& buckets,
+                    nbuck_t& modulus, error_code& ec);
+
+    void
+    write_buckets(std::size_t threads, error_code& ec);
 
     void
     commit(detail::unique_lock_type& m,
@@ -0,0 +1,133 @@
+//
+// Copyright (c) 2015-2016 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef NUDB_BULK_LOAD_HPP
+#define NUDB_BULK_LOAD_HPP
+
+#include <nudb/error.hpp>
+#include <nudb/file.hpp>
+#include <nudb/type_traits.hpp>
+#include <cstddef>
+#include <cstdint>
+
+namespace nudb {
+
+/** Create a new database from a stream of records.
+
+    This algorithm builds a complete database without going
+    through @ref basic_store::insert. The records produced by
+    the source are appended to a new data file in the order
+    they arrive, using large sequential writes. The key file
+    is then built from the data file by @ref rekey, using the
+    given buffer size and thread count. With more than one
+    thread and a buffer smaller than the key file, this creates
+    temporary files next to the key file as described there.
+    The number of buckets is chosen from the number of records,
+    so the key file needs no splits.
+
+    The database files must not already exist. If an error
+    occurs, the files created by this function are removed.
+
+    @par Requirements
+
+    The keys produced by the source must be distinct. They
+    are not checked: if a key appears more than once, the
+    database will hold each of its values, and @ref
+    basic_store::fetch may return any one of them.
+
+    @par Template Parameters
+
+    @tparam Hasher The hash function to use. This type must
+    meet the requirements of @b Hasher.
+
+    @tparam File The type of file to use. This type must meet
+    the requirements of @b File.
+
+    @param dat_path The path to the data file.
+
+    @param key_path The path to the key file.
+
+    @param log_path The path to the log file.
+
+    @param appnum A caller-defined value stored in the file
+    headers. When opening the database, the same value is
+    preserved and returned to the caller.
+
+    @param key_size The number of key bytes in each record.
+
+    @param blockSize The size of a key file block, as for
+    @ref create.
+
+    @param loadFactor A number between zero and one
+    representing the average bucket occupancy, as for
+    @ref create.
+
+    @param bufferSize The number of bytes to allocate for
+    building the key file, as for @ref rekey.
+
+    @param threads The number of threads used to build the
+    key file. If this is zero, the number of hardware threads
+    is used.
+
+    @param source A function which will be called repeatedly
+    to obtain the records. The equivalent signature must be:
+    @code
+    bool source(
+        void const*& key,       // Set to a buffer holding the key
+        void const*& data,      // Set to a buffer holding the value
+        nsize_t& size,          // Set to the size of the value
+        error_code& ec          // Indicates an error (out parameter)
+    );
+    @endcode
+    The function returns `false` when there are no more
+    records. The buffers must remain valid until the next
+    call. Each value size must be greater than 0 and no
+    more than 0xffffffff. If the source sets ec to an error,
+    the load is terminated.
+
+    @param ec Set to the error if any occurred.
+
+    @param progress A function which will be called periodically
+    as the key file is built. The equivalent signature of the
+    progress function must be:
+    @code
+    void progress(
+        std::uint64_t amount,   // Amount of work done so far
+        std::uint64_t total     // Total amount of work to do
+    );
+    @endcode
+
+    @param args Optional arguments passed to @b File constructors.
+*/
+template<
+    class Hasher,
+    class File,
+    class Source,
+    class Progress,
+    class... Args
+>
+void
+bulk_load(
+    path_type const& dat_path,
+    path_type const& key_path,
+    path_type const& log_path,
+    std::uint64_t appnum,
+    nsize_t key_size,
+    nsize_t blockSize,
+    float loadFactor,
+    std::size_t bufferSize,
+    std::size_t threads,
+    Source&& source,
+    error_code& ec,
+    Progress&& progress,
+    Args&&... args);
+
+} // nudb
+
+#include <nudb/impl/bulk_load.ipp>
+
+#endif
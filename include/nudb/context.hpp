@@ -8,10 +8,13 @@
 #ifndef NUDB_CONTEXT_HPP
 #define NUDB_CONTEXT_HPP
 
+#include <chrono>
 #include <condition_variable>
+#include <cstddef>
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <vector>
 
 #define NUDB_DECL inline
 
@@ -59,6 +62,22 @@ public:
     void
     start();
 
+    /** Start thread execution with several threads.
+
+        Starts the given number of threads to service the
+        databases. Once per second the waiting databases are
+        queued for flushing, and each idle thread takes the
+        queued database with the most pending data. A long
+        commit occupies only one thread, so the other
+        databases are still flushed on time.
+
+        @param threads The number of threads, which must
+        be at least one.
+    */
+    NUDB_DECL
+    void
+    start(std::size_t threads);
+
     /** Stop thread execution.
 
         Halts execution of all threads. Blocks until all threads
@@ -106,6 +125,10 @@ private:
     void
     erase(store_base& store);
 
+    NUDB_DECL
+    void
+    request_flush(store_base& store);
+
     NUDB_DECL
     bool
     flush_one();
@@ -145,6 +168,8 @@ private:
 
     std::uint32_t num_threads_ = 0;
     std::thread t_;
+    std::vector<std::thread> tv_;
+    clock_type::time_point when_;
 
     bool stop_ = false;
 };
@@ -0,0 +1,77 @@
+//
+// Copyright (c) 2015-2016 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef NUDB_DETAIL_ASYNC_HPP
+#define NUDB_DETAIL_ASYNC_HPP
+
+#include <nudb/error.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+namespace nudb {
+namespace detail {
+
+// The async_read, poll and run_one members are optional,
+// files without them read synchronously and invoke the
+// handler before returning.
+
+template<class File, class Handler>
+auto
+async_read(File& f, std::uint64_t offset, void* buffer,
+        std::size_t bytes, Handler&& handler, int) ->
+    decltype(f.async_read(offset, buffer, bytes,
+        std::forward<Handler>(handler)))
+{
+    return f.async_read(offset, buffer, bytes,
+        std::forward<Handler>(handler));
+}
+
+template<class File, class Handler>
+void
+async_read(File& f, std::uint64_t offset, void* buffer,
+    std::size_t bytes, Handler&& handler, long)
+{
+    error_code ec;
+    f.read(offset, buffer, bytes, ec);
+    handler(ec);
+}
+
+template<class File>
+auto
+poll_file(File& f, int) ->
+    decltype(f.poll())
+{
+    return f.poll();
+}
+
+template<class File>
+std::size_t
+poll_file(File&, long)
+{
+    return 0;
+}
+
+template<class File>
+auto
+run_one_file(File& f, int) ->
+    decltype(f.run_one())
+{
+    return f.run_one();
+}
+
+template<class File>
+std::size_t
+run_one_file(File&, long)
+{
+    return 0;
+}
+
+} // detail
+} // nudb
+
+#endif
@@ -0,0 +1,225 @@
+//
+// Copyright (c) 2015-2016 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef NUDB_DETAIL_BLOOM_FILTER_HPP
+#define NUDB_DETAIL_BLOOM_FILTER_HPP
+
+#include <nudb/detail/field.hpp>
+#include <nudb/detail/stream.hpp>
+#include <nudb/type_traits.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace nudb {
+namespace detail {
+
+//  Blocked Bloom filter over key hashes.
+//
+//  All the bits for one hash are set in the same 512 bit
+//  block, so a lookup touches a single cache line. Bits
+//  are set and tested atomically, so insert may be called
+//  concurrently with may_contain. An empty filter contains
+//  every hash.
+//
+template<class = void>
+class bloom_filter_t
+{
+    static std::size_t constexpr block_words = 8;
+    static std::size_t constexpr block_bits = 64 * block_words;
+
+    std::unique_ptr<std::atomic<std::uint64_t>[]> v_;
+    std::size_t blocks_ = 0;
+    std::size_t k_ = 0;
+
+public:
+    bloom_filter_t() = default;
+    bloom_filter_t(bloom_filter_t&&) = default;
+    bloom_filter_t& operator=(bloom_filter_t&&) = default;
+
+    bool
+    empty() const
+    {
+        return blocks_ == 0;
+    }
+
+    // Returns the size in bits
+    std::size_t
+    bits() const
+    {
+        return blocks_ * block_bits;
+    }
+
+    // Returns the number of bits set per hash
+    std::size_t
+    hashes() const
+    {
+        return k_;
+    }
+
+    // Returns the size in bytes when serialized
+    std::size_t
+    size() const
+    {
+        return blocks_ * block_words * 8;
+    }
+
+    // Allocate a cleared filter. The number of bits
+    // is rounded up to a whole number of blocks.
+    void
+    reset(std::size_t bits, std::size_t hashes);
+
+    // Discard the filter
+    void
+    clear()
+    {
+        v_.reset();
+        blocks_ = 0;
+        k_ = 0;
+    }
+
+    void
+    insert(nhash_t h);
+
+    // Returns `false` if h was never inserted
+    bool
+    may_contain(nhash_t h) const;
+
+    void
+    read(istream& is);
+
+    void
+    write(ostream& os) const;
+
+    // Returns the number of bits and hashes which give a false
+    // positive rate near `rate` for n keys, using at most
+    // `bytes` of memory if `bytes` is not zero.
+    static
+    std::pair<std::size_t, std::size_t>
+    dimension(std::size_t n, double rate, std::size_t bytes);
+
+private:
+    static
+    std::uint64_t
+    mix(nhash_t h)
+    {
+        // Finalizer from MurmurHash3
+        std::uint64_t x = h;
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ULL;
+        x ^= x >> 33;
+        return x;
+    }
+};
+
+template<class _>
+void
+bloom_filter_t<_>::
+reset(std::size_t bits, std::size_t hashes)
+{
+    blocks_ = (bits + block_bits - 1) / block_bits;
+    k_ = hashes;
+    v_.reset(new std::atomic<std::uint64_t>[blocks_ * block_words]);
+    for(std::size_t i = 0; i < blocks_ * block_words; ++i)
+        v_[i].store(0, std::memory_order_relaxed);
+}
+
+template<class _>
+void
+bloom_filter_t<_>::
+insert(nhash_t h)
+{
+    if(empty())
+        return;
+    auto const x = mix(h);
+    auto const p = &v_[(x >> 32) % blocks_ * block_words];
+    // Double hashing within the block
+    auto const a = static_cast<std::size_t>(x);
+    auto const b = static_cast<std::size_t>(x >> 16) | 1;
+    for(std::size_t i = 0; i < k_; ++i)
+    {
+        auto const bit = (a + i * b) % block_bits;
+        p[bit / 64].fetch_or(std::uint64_t{1} << (bit % 64),
+            std::memory_order_relaxed);
+    }
+}
+
+template<class _>
+bool
+bloom_filter_t<_>::
+may_contain(nhash_t h) const
+{
+    if(empty())
+        return true;
+    auto const x = mix(h);
+    auto const p = &v_[(x >> 32) % blocks_ * block_words];
+    auto const a = static_cast<std::size_t>(x);
+    auto const b = static_cast<std::size_t>(x >> 16) | 1;
+    for(std::size_t i = 0; i < k_; ++i)
+    {
+        auto const bit = (a + i * b) % block_bits;
+        if(! (p[bit / 64].load(std::memory_order_relaxed) &
+                (std::uint64_t{1} << (bit % 64))))
+            return false;
+    }
+    return true;
+}
+
+template<class _>
+void
+bloom_filter_t<_>::
+read(istream& is)
+{
+    for(std::size_t i = 0; i < blocks_ * block_words; ++i)
+    {
+        std::uint64_t w;
+        detail::read<std::uint64_t>(is, w);
+        v_[i].store(w, std::memory_order_relaxed);
+    }
+}
+
+template<class _>
+void
+bloom_filter_t<_>::
+write(ostream& os) const
+{
+    for(std::size_t i = 0; i < blocks_ * block_words; ++i)
+        detail::write<std::uint64_t>(os,
+            v_[i].load(std::memory_order_relaxed));
+}
+
+template<class _>
+std::pair<std::size_t, std::size_t>
+bloom_filter_t<_>::
+dimension(std::size_t n, double rate, std::size_t bytes)
+{
+    n = std::max<std::size_t>(n, 1);
+    auto const ln2 = std::log(2.0);
+    auto bits = static_cast<std::size_t>(std::ceil(
+        n * -std::log(rate) / (ln2 * ln2)));
+    if(bytes > 0)
+        bits = std::min(bits, 8 * bytes);
+    if(bits < block_bits)
+        bits = block_bits;
+    auto const k = static_cast<std::size_t>(
+        std::lround(ln2 * bits / n));
+    return {bits, std::max<std::size_t>(1,
+        std::min<std::size_t>(k, 16))};
+}
+
+using bloom_filter = bloom_filter_t<>;
+
+} // detail
+} // nudb
+
+#endif
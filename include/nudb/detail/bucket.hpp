@@ -10,6 +10,7 @@
 
 #include <nudb/error.hpp>
 #include <nudb/type_traits.hpp>
+#include <nudb/detail/bucket_search.hpp>
 #include <nudb/detail/bulkio.hpp>
 #include <nudb/detail/field.hpp>
 #include <nudb/detail/format.hpp>
@@ -25,13 +26,14 @@ namespace detail {
 //
 inline
 nbuck_t
-bucket_index(nhash_t h, nbuck_t buckets, std::uint64_t modulus)
+bucket_index(nhash_t h, nbuck_t buckets, nbuck_t modulus)
 {
-    BOOST_ASSERT(modulus <= 0x100000000ULL);
+    // The hash has 48 significant bits
+    BOOST_ASSERT(modulus <= 0x1000000000000ULL);
     auto n = h % modulus;
     if(n >= buckets)
         n -= modulus / 2;
-    return static_cast<nbuck_t>(n);
+    return n;
 }
 
 //------------------------------------------------------------------------------
@@ -49,6 +51,8 @@ template<class = void>
 class bucket_t
 {
     nsize_t block_size_;    // Size of a key file block
+    std::size_t version_;   // Bucket layout
+    nkey_t capacity_;       // Maximum key count
     nkey_t size_;           // Current key count
     noff_t spill_;          // Offset of next spill record or 0
     std::uint8_t* p_;       // Pointer to the bucket blob
@@ -65,9 +69,10 @@ public:
     bucket_t(bucket_t const&) = default;
     bucket_t& operator=(bucket_t const&) = default;
 
-    bucket_t(nsize_t block_size, void* p);
+    bucket_t(nsize_t block_size, void* p, std::size_t version);
 
-    bucket_t(nsize_t block_size, void* p, empty_t);
+    bucket_t(nsize_t block_size,
+        void* p, std::size_t version, empty_t);
 
     nsize_t
     block_size() const
@@ -75,12 +80,19 @@ public:
         return block_size_;
     }
 
+    // Returns the version of the bucket layout
+    std::size_t
+    version() const
+    {
+        return version_;
+    }
+
     // Serialized bucket size.
     // Excludes empty 
     nsize_t
     actual_size() const
     {
-        return bucket_size(size_);
+        return bucket_size(size_, version_);
     }
 
     bool
@@ -92,8 +104,7 @@ public:
     bool
     full() const
     {
-        return size_ >=
-            detail::bucket_capacity(block_size_);
+        return size_ >= capacity_;
     }
 
     nkey_t
@@ -149,10 +160,23 @@ public:
     // Read a full bucket from the
     // file at the specified offset.
     //
+    // Spill records are read this way too. The compact
+    // layout of a version 3 spill record is the same as
+    // the full layout only because spilled buckets are
+    // always full, see maybe_spill.
+    //
     template<class File>
     void
     read(File& f, noff_t, error_code& ec);
 
+    // Read a bucket from its block in the key file.
+    // Files which need aligned transfers read the
+    // whole block, including the padding.
+    //
+    template<class File>
+    void
+    read_block(File& f, noff_t offset, error_code& ec);
+
     // Read a compact bucket
     //
     template<class File>
@@ -172,18 +196,41 @@ public:
     void
     write(File& f,noff_t offset, error_code& ec) const;
 
+    // Copy the bucket to the block at dest, which
+    // then holds the same bucket. Empty entries
+    // and the padding are zeroed.
+    //
+    void
+    copy(void* dest) const;
+
 private:
     // Update size and spill in the blob
     void
     update();
+
+    // Version 3 hash array
+    std::uint8_t*
+    hashes() const
+    {
+        return p_ + bucket_header_size_v3;
+    }
+
+    // Version 3 offset and size array
+    std::uint8_t*
+    values() const
+    {
+        return hashes() + capacity_ * bucket_hash_size_v3;
+    }
 };
 
 //------------------------------------------------------------------------------
 
 template<class _>
 bucket_t<_>::
-bucket_t(nsize_t block_size, void* p)
+bucket_t(nsize_t block_size, void* p, std::size_t version)
     : block_size_(block_size)
+    , version_(version)
+    , capacity_(bucket_capacity(block_size, version))
     , p_(reinterpret_cast<std::uint8_t*>(p))
 {
     // Bucket Record
@@ -194,8 +241,11 @@ bucket_t(nsize_t block_size, void* p)
 
 template<class _>
 bucket_t<_>::
-bucket_t(nsize_t block_size, void* p, empty_t)
+bucket_t(nsize_t block_size,
+        void* p, std::size_t version, empty_t)
     : block_size_(block_size)
+    , version_(version)
+    , capacity_(bucket_capacity(block_size, version))
     , size_(0)
     , spill_(0)
     , p_(reinterpret_cast<std::uint8_t*>(p))
@@ -228,6 +278,15 @@ at(nkey_t i) const ->
     value_type const
 {
     value_type result;
+    if(version_ >= 3)
+    {
+        auto const v = values() + i * bucket_value_size_v3;
+        result.offset = load_le<std::uint64_t>(v);
+        result.size = load_le<std::uint32_t>(v + 8);
+        result.hash = load_le<std::uint64_t>(
+            hashes() + i * bucket_hash_size_v3);
+        return result;
+    }
     // Bucket Entry
     auto const w =
         field<uint48_t>::size +         // Offset
@@ -253,27 +312,53 @@ nkey_t
 bucket_t<_>::
 lower_bound(nhash_t h) const
 {
+    if(version_ >= 3)
+    {
+        auto const p = hashes();
+        nkey_t first = 0;
+        nkey_t count = size_;
+        while(count > 32)
+        {
+            auto const step = count / 2;
+            auto const i = first + step;
+            if(load_le<std::uint64_t>(
+                    p + i * bucket_hash_size_v3) < h)
+            {
+                first = i + 1;
+                count -= step + 1;
+            }
+            else
+            {
+                count = step;
+            }
+        }
+        return first + static_cast<nkey_t>(hash_search(
+            p + first * bucket_hash_size_v3, count, h));
+    }
     // Bucket Entry
     auto const w =
         field<uint48_t>::size +         // Offset
         field<uint48_t>::size +         // Size
         field<f_hash>::size;            // Hash
+    static_assert(w == bucket_entry_size, "");
     // Bucket Record
     auto const p = p_ +
         field<std::uint16_t>::size +    // Count
-        field<uint48_t>::size +         // Spill
-        // Bucket Entry
-        field<uint48_t>::size +         // Offset
-        field<uint48_t>::size;          // Size
+        field<uint48_t>::size;          // Spill
+    // Narrow the range by binary search, then
+    // finish with the vectorized search kernel.
     nkey_t step;
     nkey_t first = 0;
     nkey_t count = size_;
-    while(count > 0)
+    while(count > 32)
     {
         step = count / 2;
         nkey_t i = first + step;
         nhash_t h1;
-        readp<f_hash>(p + i * w, h1);
+        readp<f_hash>(p + i * w +
+            field<uint48_t>::size +     // Offset
+            field<uint48_t>::size,      // Size
+            h1);
         if(h1 < h)
         {
             first = i + 1;
@@ -284,7 +369,8 @@ lower_bound(nhash_t h) const
             count = step;
         }
     }
-    return first;
+    return first + static_cast<nkey_t>(
+        bucket_search(p + first * w, count, h));
 }
 
 template<class _>
@@ -294,6 +380,25 @@ insert(
     noff_t offset, nsize_t size, nhash_t h)
 {
     auto const i = lower_bound(h);
+    if(version_ >= 3)
+    {
+        auto const hw = bucket_hash_size_v3;
+        auto const vw = bucket_value_size_v3;
+        std::memmove(
+            hashes() + (i + 1) * hw,
+            hashes() + i       * hw,
+            (size_ - i)        * hw);
+        std::memmove(
+            values() + (i + 1) * vw,
+            values() + i       * vw,
+            (size_ - i)        * vw);
+        ++size_;
+        update();
+        store_le<std::uint64_t>(hashes() + i * hw, h);
+        store_le<std::uint64_t>(values() + i * vw, offset);
+        store_le<std::uint32_t>(values() + i * vw + 8, size);
+        return;
+    }
     // Bucket Record
     auto const p = p_ +
         field<
@@ -325,6 +430,27 @@ void
 bucket_t<_>::
 erase(nkey_t i)
 {
+    if(version_ >= 3)
+    {
+        auto const hw = bucket_hash_size_v3;
+        auto const vw = bucket_value_size_v3;
+        --size_;
+        if(i < size_)
+        {
+            std::memmove(
+                hashes() + i       * hw,
+                hashes() + (i + 1) * hw,
+                (size_ - i)        * hw);
+            std::memmove(
+                values() + i       * vw,
+                values() + (i + 1) * vw,
+                (size_ - i)        * vw);
+        }
+        std::memset(hashes() + size_ * hw, 0, hw);
+        std::memset(values() + size_ * vw, 0, vw);
+        update();
+        return;
+    }
     // Bucket Record
     auto const p = p_ +
         field<std::uint16_t>::size +    // Count
@@ -349,15 +475,35 @@ void
 bucket_t<_>::
 read(File& f, noff_t offset, error_code& ec)
 {
-    auto const cap = bucket_capacity(block_size_);
     // Excludes padding to block size
-    f.read(offset, p_, bucket_size(cap), ec);
+    f.read(offset, p_, bucket_size(capacity_, version_), ec);
     if(ec)
         return;
     istream is{p_, block_size_};
     detail::read<std::uint16_t>(is, size_); // Count
     detail::read<uint48_t>(is, spill_);     // Spill
-    if(size_ > cap)
+    if(size_ > capacity_)
+    {
+        ec = error::invalid_bucket_size;
+        return;
+    }
+}
+
+template<class _>
+template<class File>
+void
+bucket_t<_>::
+read_block(File& f, noff_t offset, error_code& ec)
+{
+    if(file_alignment(f) == 1)
+        return read(f, offset, ec);
+    f.read(offset, p_, block_size_, ec);
+    if(ec)
+        return;
+    istream is{p_, block_size_};
+    detail::read<std::uint16_t>(is, size_); // Count
+    detail::read<uint48_t>(is, spill_);     // Spill
+    if(size_ > capacity_)
     {
         ec = error::invalid_bucket_size;
         return;
@@ -371,13 +517,35 @@ bucket_t<_>::
 read(bulk_reader<File>& r, error_code& ec)
 {
     // Bucket Record(compact)
-    auto is = r.prepare(
+    auto is = r.prepare(version_ >= 3 ?
+        bucket_header_size_v3 :
         detail::field<std::uint16_t>::size +
         detail::field<uint48_t>::size, ec);
     if(ec)
         return;
     detail::read<std::uint16_t>(is, size_); // Count
     detail::read<uint48_t>(is, spill_);     // Spill
+    if(version_ >= 3)
+    {
+        if(size_ > capacity_)
+        {
+            ec = error::invalid_bucket_size;
+            return;
+        }
+        std::memset(p_, 0, bucket_header_size_v3);
+        update();
+        auto const hw = size_ * bucket_hash_size_v3;
+        is = r.prepare(hw, ec);
+        if(ec)
+            return;
+        std::memcpy(hashes(), is.data(hw), hw); // Hashes
+        auto const vw = size_ * bucket_value_size_v3;
+        is = r.prepare(vw, ec);
+        if(ec)
+            return;
+        std::memcpy(values(), is.data(vw), vw); // Values
+        return;
+    }
     update();
     // Excludes empty bucket entries
     auto const w = size_ * (
@@ -401,6 +569,17 @@ write(ostream& os) const
     // Does not pad up to the block size. This
     // is called to write to the data file.
     auto const size = actual_size();
+    if(version_ >= 3)
+    {
+        // Bucket Record(compact)
+        auto const hw = size_ * bucket_hash_size_v3;
+        auto const vw = size_ * bucket_value_size_v3;
+        auto const p = os.data(size);
+        std::memcpy(p, p_, bucket_header_size_v3);
+        std::memcpy(p + bucket_header_size_v3, hashes(), hw);
+        std::memcpy(p + bucket_header_size_v3 + hw, values(), vw);
+        return;
+    }
     // Bucket Record
     std::memcpy(os.data(size), p_, size);
 }
@@ -414,14 +593,43 @@ write(File& f, noff_t offset, error_code& ec) const
     // Includes zero pad up to the block
     // size, to make the key file size always
     // a multiple of the block size.
-    auto const size = actual_size();
-    std::memset(p_ + size, 0, block_size_ - size);
+    copy(p_);
     // Bucket Record
     f.write(offset, p_, block_size_, ec);
     if(ec)
         return;
 }
 
+template<class _>
+void
+bucket_t<_>::
+copy(void* dest) const
+{
+    auto const d = reinterpret_cast<std::uint8_t*>(dest);
+    if(version_ >= 3)
+    {
+        auto const hw = bucket_hash_size_v3;
+        auto const vw = bucket_value_size_v3;
+        auto const h = d + bucket_header_size_v3;
+        auto const v = h + capacity_ * hw;
+        if(d != p_)
+        {
+            std::memcpy(d, p_, bucket_header_size_v3);
+            std::memcpy(h, hashes(), size_ * hw);
+            std::memcpy(v, values(), size_ * vw);
+        }
+        std::memset(h + size_ * hw, 0, (capacity_ - size_) * hw);
+        std::memset(v + size_ * vw, 0, (capacity_ - size_) * vw);
+        auto const end = bucket_size(capacity_, version_);
+        std::memset(d + end, 0, block_size_ - end);
+        return;
+    }
+    auto const size = actual_size();
+    if(d != p_)
+        std::memcpy(d, p_, size);
+    std::memset(d + size, 0, block_size_ - size);
+}
+
 template<class _>
 void
 bucket_t<_>::
@@ -440,6 +648,11 @@ using bucket = bucket_t<>;
 //  Spill bucket if full.
 //  The bucket is cleared after it spills.
 //
+//  Spill records are read back with bucket::read(File&),
+//  which expects the full bucket layout. Only a full bucket
+//  has the same compact layout, so partial buckets must
+//  never be spilled.
+//
 template<class File>
 void
 maybe_spill(
@@ -447,6 +660,8 @@ maybe_spill(
 {
     if(b.full())
     {
+        BOOST_ASSERT(b.size() ==
+            bucket_capacity(b.block_size(), b.version()));
         // Spill Record
         auto const offset = w.offset();
         auto os = w.prepare(
@@ -0,0 +1,212 @@
+//
+// Copyright (c) 2015-2016 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef NUDB_DETAIL_BUCKET_CACHE_HPP
+#define NUDB_DETAIL_BUCKET_CACHE_HPP
+
+#include <nudb/type_traits.hpp>
+#include <nudb/detail/bucket.hpp>
+#include <nudb/detail/field.hpp>
+#include <nudb/detail/format.hpp>
+#include <nudb/detail/stream.hpp>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace nudb {
+namespace detail {
+
+//  Bounded cache of key file buckets, keyed by bucket index.
+//
+//  Unlike cache_t, which holds the buckets modified by a commit,
+//  this holds copies of clean buckets which have been read from
+//  the key file. Entries are replaced using the CLOCK algorithm.
+//  The cache is split into shards to reduce lock contention, and
+//  all member functions are safe to call concurrently.
+//
+template<class = void>
+class bucket_cache_t
+{
+    static std::size_t constexpr nshard = 16;
+
+    struct shard
+    {
+        std::mutex m;
+        std::size_t slots = 0;          // capacity
+        std::size_t used = 0;           // slots in use
+        std::size_t hand = 0;           // clock hand
+        std::unordered_map<nbuck_t, std::size_t> map;
+        std::vector<nbuck_t> index;     // bucket in each slot
+        std::vector<std::uint8_t> ref;  // reference bits
+        std::unique_ptr<std::uint8_t[]> p;
+    };
+
+    nsize_t block_size_ = 0;
+    std::size_t version_ = 0;
+    std::unique_ptr<shard[]> v_;
+
+public:
+    bucket_cache_t() = default;
+    bucket_cache_t(bucket_cache_t&&) = default;
+    bucket_cache_t& operator=(bucket_cache_t&&) = default;
+
+    bucket_cache_t(nsize_t block_size, std::size_t version)
+        : block_size_(block_size)
+        , version_(version)
+        , v_(new shard[nshard])
+    {
+    }
+
+    // Set the capacity in bytes, discarding the contents.
+    // A capacity of zero disables the cache.
+    void
+    reset(std::size_t bytes);
+
+    // Returns the capacity in bytes
+    std::size_t
+    capacity();
+
+    // Copy bucket n into the block at dest if present
+    bool
+    find(nbuck_t n, void* dest);
+
+    // Insert or replace the cached copy of bucket n
+    void
+    insert(nbuck_t n, bucket const& b)
+    {
+        put(n, b, true);
+    }
+
+    // Replace the cached copy of bucket n if present,
+    // or insert it if that does not require an eviction.
+    void
+    update(nbuck_t n, bucket const& b)
+    {
+        put(n, b, false);
+    }
+
+    void
+    clear()
+    {
+        reset(0);
+    }
+
+private:
+    void
+    put(nbuck_t n, bucket const& b, bool evict);
+
+    std::uint8_t*
+    data(shard& s, std::size_t i) const
+    {
+        return s.p.get() + i * block_size_;
+    }
+};
+
+template<class _>
+void
+bucket_cache_t<_>::
+reset(std::size_t bytes)
+{
+    auto const slots = bytes / block_size_ / nshard;
+    for(std::size_t i = 0; i < nshard; ++i)
+    {
+        auto& s = v_[i];
+        std::lock_guard<std::mutex> lock{s.m};
+        s.map.clear();
+        s.used = 0;
+        s.hand = 0;
+        if(s.slots == slots)
+            continue;
+        s.slots = slots;
+        s.index.assign(slots, 0);
+        s.ref.assign(slots, 0);
+        s.p.reset(slots > 0 ?
+            new std::uint8_t[slots * block_size_] : nullptr);
+    }
+}
+
+template<class _>
+std::size_t
+bucket_cache_t<_>::
+capacity()
+{
+    auto& s = v_[0];
+    std::lock_guard<std::mutex> lock{s.m};
+    return s.slots * nshard * block_size_;
+}
+
+template<class _>
+bool
+bucket_cache_t<_>::
+find(nbuck_t n, void* dest)
+{
+    auto& s = v_[n % nshard];
+    std::lock_guard<std::mutex> lock{s.m};
+    auto const iter = s.map.find(n);
+    if(iter == s.map.end())
+        return false;
+    bucket{block_size_, data(s, iter->second),
+        version_}.copy(dest);
+    s.ref[iter->second] = 1;
+    return true;
+}
+
+template<class _>
+void
+bucket_cache_t<_>::
+put(nbuck_t n, bucket const& b, bool evict)
+{
+    auto& s = v_[n % nshard];
+    std::lock_guard<std::mutex> lock{s.m};
+    if(s.slots == 0)
+        return;
+    std::size_t i;
+    auto const iter = s.map.find(n);
+    if(iter != s.map.end())
+    {
+        i = iter->second;
+    }
+    else if(s.used < s.slots)
+    {
+        i = s.used++;
+        s.index[i] = n;
+        s.ref[i] = 0;
+        s.map.emplace(n, i);
+    }
+    else if(! evict)
+    {
+        return;
+    }
+    else
+    {
+        // Sweep the clock hand until it finds
+        // a slot which was not recently used.
+        while(s.ref[s.hand])
+        {
+            s.ref[s.hand] = 0;
+            if(++s.hand == s.slots)
+                s.hand = 0;
+        }
+        i = s.hand;
+        if(++s.hand == s.slots)
+            s.hand = 0;
+        s.map.erase(s.index[i]);
+        s.index[i] = n;
+        s.map.emplace(n, i);
+    }
+    b.copy(data(s, i));
+}
+
+using bucket_cache = bucket_cache_t<>;
+
+} // detail
+} // nudb
+
+#endif
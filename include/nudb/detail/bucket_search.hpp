@@ -0,0 +1,261 @@
+//
+// Copyright (c) 2015-2016 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef NUDB_DETAIL_BUCKET_SEARCH_HPP
+#define NUDB_DETAIL_BUCKET_SEARCH_HPP
+
+#include <nudb/type_traits.hpp>
+#include <nudb/detail/field.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#ifndef NUDB_BUCKET_SIMD
+# if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#  define NUDB_BUCKET_SIMD 1
+# else
+#  define NUDB_BUCKET_SIMD 0
+# endif
+#endif
+
+#if NUDB_BUCKET_SIMD
+# include <immintrin.h>
+#endif
+
+namespace nudb {
+namespace detail {
+
+//  Kernels which search a run of sorted bucket entries.
+//
+//  Each returns the number of the n entries starting at p
+//  whose hash is less than h. Entries are 18 bytes, and the
+//  big-endian 48-bit hash occupies the last 6. The vector
+//  kernels load the last 8 bytes of each entry, reverse the
+//  bytes and mask off the 16 bits which are not the hash.
+//
+
+static std::size_t constexpr bucket_entry_size =
+    field<uint48_t>::size +     // Offset
+    field<uint48_t>::size +     // Size
+    field<uint48_t>::size;      // Hash
+
+using bucket_search_fn = std::size_t(*)(
+    std::uint8_t const* p, std::size_t n, nhash_t h);
+
+inline
+std::size_t
+bucket_search_scalar(
+    std::uint8_t const* p, std::size_t n, nhash_t h)
+{
+    auto const w = bucket_entry_size;
+    for(std::size_t i = 0; i < n; ++i)
+    {
+        nhash_t h1;
+        readp<uint48_t>(p + i * w + w - field<uint48_t>::size, h1);
+        if(h1 >= h)
+            return i;
+    }
+    return n;
+}
+
+#if NUDB_BUCKET_SIMD
+
+__attribute__((target("sse4.2")))
+inline
+std::size_t
+bucket_search_sse42(
+    std::uint8_t const* p, std::size_t n, nhash_t h)
+{
+    auto const w = bucket_entry_size;
+    auto const swap = _mm_set_epi8(
+        8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+    auto const mask = _mm_set1_epi64x(0xffffffffffffLL);
+    auto const hv = _mm_set1_epi64x(static_cast<long long>(h));
+    std::size_t i = 0;
+    for(; i + 2 <= n; i += 2)
+    {
+        long long a;
+        long long b;
+        std::memcpy(&a, p + i * w + w - 8, 8);
+        std::memcpy(&b, p + (i + 1) * w + w - 8, 8);
+        auto x = _mm_set_epi64x(b, a);
+        x = _mm_and_si128(_mm_shuffle_epi8(x, swap), mask);
+        auto const bits = _mm_movemask_pd(
+            _mm_castsi128_pd(_mm_cmpgt_epi64(hv, x)));
+        // Entries are sorted, so the first
+        // group not all less ends the run.
+        if(bits != 3)
+            return i + (bits & 1);
+    }
+    return i + bucket_search_scalar(p + i * w, n - i, h);
+}
+
+__attribute__((target("avx2")))
+inline
+std::size_t
+bucket_search_avx2(
+    std::uint8_t const* p, std::size_t n, nhash_t h)
+{
+    auto const w = static_cast<long long>(bucket_entry_size);
+    auto const swap = _mm256_set_epi8(
+        8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7,
+        8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+    auto const mask = _mm256_set1_epi64x(0xffffffffffffLL);
+    auto const hv = _mm256_set1_epi64x(static_cast<long long>(h));
+    auto const index = _mm256_set_epi64x(3 * w, 2 * w, w, 0);
+    auto const base = reinterpret_cast<long long const*>(p + w - 8);
+    std::size_t i = 0;
+    for(; i + 4 <= n; i += 4)
+    {
+        auto x = _mm256_i64gather_epi64(
+            base, _mm256_add_epi64(index,
+                _mm256_set1_epi64x(static_cast<long long>(i) * w)), 1);
+        x = _mm256_and_si256(_mm256_shuffle_epi8(x, swap), mask);
+        auto const bits = _mm256_movemask_pd(
+            _mm256_castsi256_pd(_mm256_cmpgt_epi64(hv, x)));
+        if(bits != 15)
+            return i + __builtin_popcount(bits);
+    }
+    return i + bucket_search_sse42(p + i * w, n - i, h);
+}
+
+#endif
+
+//  Kernels which search the hash array of a version 3 bucket.
+//
+//  Each returns the number of the n little-endian 64-bit hashes
+//  starting at p which are less than h. Hashes are at most 48
+//  bits, so the signed vector comparisons are exact.
+//
+
+template<class T>
+T
+load_le(std::uint8_t const* p)
+{
+    T v = 0;
+    for(std::size_t i = sizeof(T); i-- > 0;)
+        v = static_cast<T>((v << 8) | p[i]);
+    return v;
+}
+
+template<class T>
+void
+store_le(std::uint8_t* p, T v)
+{
+    for(std::size_t i = 0; i < sizeof(T); ++i)
+    {
+        p[i] = static_cast<std::uint8_t>(v);
+        v = static_cast<T>(v >> 8);
+    }
+}
+
+inline
+std::size_t
+hash_search_scalar(
+    std::uint8_t const* p, std::size_t n, nhash_t h)
+{
+    for(std::size_t i = 0; i < n; ++i)
+        if(load_le<std::uint64_t>(p + i * 8) >= h)
+            return i;
+    return n;
+}
+
+#if NUDB_BUCKET_SIMD
+
+__attribute__((target("sse4.2")))
+inline
+std::size_t
+hash_search_sse42(
+    std::uint8_t const* p, std::size_t n, nhash_t h)
+{
+    auto const hv = _mm_set1_epi64x(static_cast<long long>(h));
+    std::size_t i = 0;
+    for(; i + 2 <= n; i += 2)
+    {
+        auto const x = _mm_loadu_si128(
+            reinterpret_cast<__m128i const*>(p + i * 8));
+        auto const bits = _mm_movemask_pd(
+            _mm_castsi128_pd(_mm_cmpgt_epi64(hv, x)));
+        if(bits != 3)
+            return i + (bits & 1);
+    }
+    return i + hash_search_scalar(p + i * 8, n - i, h);
+}
+
+__attribute__((target("avx2")))
+inline
+std::size_t
+hash_search_avx2(
+    std::uint8_t const* p, std::size_t n, nhash_t h)
+{
+    auto const hv = _mm256_set1_epi64x(static_cast<long long>(h));
+    std::size_t i = 0;
+    for(; i + 4 <= n; i += 4)
+    {
+        auto const x = _mm256_loadu_si256(
+            reinterpret_cast<__m256i const*>(p + i * 8));
+        auto const bits = _mm256_movemask_pd(
+            _mm256_castsi256_pd(_mm256_cmpgt_epi64(hv, x)));
+        if(bits != 15)
+            return i + __builtin_popcount(bits);
+    }
+    return i + hash_search_sse42(p + i * 8, n - i, h);
+}
+
+#endif
+
+// Returns the best kernel the processor supports
+inline
+bucket_search_fn
+select_bucket_search()
+{
+#if NUDB_BUCKET_SIMD
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        return &bucket_search_avx2;
+    if(__builtin_cpu_supports("sse4.2"))
+        return &bucket_search_sse42;
+#endif
+    return &bucket_search_scalar;
+}
+
+inline
+std::size_t
+bucket_search(std::uint8_t const* p, std::size_t n, nhash_t h)
+{
+    static bucket_search_fn const f = select_bucket_search();
+    return f(p, n, h);
+}
+
+// Returns the best kernel the processor supports
+inline
+bucket_search_fn
+select_hash_search()
+{
+#if NUDB_BUCKET_SIMD
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        return &hash_search_avx2;
+    if(__builtin_cpu_supports("sse4.2"))
+        return &hash_search_sse42;
+#endif
+    return &hash_search_scalar;
+}
+
+inline
+std::size_t
+hash_search(std::uint8_t const* p, std::size_t n, nhash_t h)
+{
+    static bucket_search_fn const f = select_hash_search();
+    return f(p, n, h);
+}
+
+} // detail
+} // nudb
+
+#endif
@@ -9,6 +9,7 @@
 #define NUDB_DETAIL_BUFFER_HPP
 
 #include <atomic>
+#include <cstddef>
 #include <cstdint>
 #include <memory>
 
@@ -16,11 +17,17 @@ namespace nudb {
 namespace detail {
 
 // Simple growable memory buffer
+//
+// A buffer constructed with an alignment places its memory
+// on that boundary, so that it may be used for unbuffered
+// (direct) file I/O.
 class buffer
 {
-private:
     std::size_t size_ = 0;
-    std::unique_ptr<std::uint8_t[]> buf_;
+    std::size_t capacity_ = 0;
+    std::size_t align_ = 1;
+    std::unique_ptr<std::uint8_t[]> raw_;
+    std::uint8_t* buf_ = nullptr;
 
 public:
     ~buffer() = default;
@@ -30,24 +37,40 @@ public:
 
     explicit
     buffer(std::size_t n)
-        : size_(n)
-        , buf_(new std::uint8_t[n])
     {
+        reserve(n);
+    }
+
+    // alignment must be a power of two
+    buffer(std::size_t n, std::size_t alignment)
+        : align_(alignment)
+    {
+        reserve(n);
     }
 
     buffer(buffer&& other)
         : size_(other.size_)
-        , buf_(std::move(other.buf_))
+        , capacity_(other.capacity_)
+        , align_(other.align_)
+        , raw_(std::move(other.raw_))
+        , buf_(other.buf_)
     {
         other.size_ = 0;
+        other.capacity_ = 0;
+        other.buf_ = nullptr;
     }
 
     buffer&
     operator=(buffer&& other)
     {
         size_ = other.size_;
-        buf_ = std::move(other.buf_);
+        capacity_ = other.capacity_;
+        align_ = other.align_;
+        raw_ = std::move(other.raw_);
+        buf_ = other.buf_;
         other.size_ = 0;
+        other.capacity_ = 0;
+        other.buf_ = nullptr;
         return *this;
     }
 
@@ -57,29 +80,129 @@ public:
         return size_;
     }
 
+    // Returns the size which may be reserved
+    // without allocating.
+    std::size_t
+    capacity() const
+    {
+        return capacity_;
+    }
+
+    std::size_t
+    alignment() const
+    {
+        return align_;
+    }
+
     std::uint8_t*
     get() const
     {
-        return buf_.get();
+        return buf_;
     }
 
+    // The contents are not preserved
     void
     reserve(std::size_t n)
     {
-        if(size_ < n)
-            buf_.reset(new std::uint8_t[n]);
+        if(capacity_ < n)
+        {
+            raw_.reset(new std::uint8_t[n + align_ - 1]);
+            auto const p = reinterpret_cast<std::uintptr_t>(raw_.get());
+            buf_ = raw_.get() + ((align_ - p % align_) % align_);
+            capacity_ = n;
+        }
         size_ = n;
     }
 
+    // The contents are not preserved. The memory is
+    // aligned to at least the given boundary from now on.
+    void
+    reserve(std::size_t n, std::size_t alignment)
+    {
+        if(align_ < alignment)
+        {
+            align_ = alignment;
+            capacity_ = 0;
+        }
+        reserve(n);
+    }
+
     // BufferFactory
     void*
     operator()(std::size_t n)
     {
         reserve(n);
-        return buf_.get();
+        return buf_;
     }
 };
 
+//  Buffers reused by the calls made on one thread.
+//
+//  The first scratch constructed on a thread claims the thread's
+//  buffers until it is destroyed. A scratch constructed while they
+//  are claimed, for example by a callback which calls back into the
+//  database, gets buffers of its own instead.
+//
+template<class = void>
+class scratch_t
+{
+public:
+    static std::size_t constexpr count = 3;
+
+    // Larger buffers are freed on release, so that
+    // one large value does not pin memory on the thread.
+    static std::size_t constexpr max_capacity = 1024 * 1024;
+
+private:
+    struct slots
+    {
+        buffer b[count];
+        bool busy = false;
+    };
+
+    slots* s_;
+    std::unique_ptr<slots> own_;
+
+    static
+    slots&
+    local()
+    {
+        static thread_local slots s;
+        return s;
+    }
+
+public:
+    scratch_t()
+        : s_(&local())
+    {
+        if(s_->busy)
+        {
+            own_.reset(new slots);
+            s_ = own_.get();
+        }
+        s_->busy = true;
+    }
+
+    scratch_t(scratch_t const&) = delete;
+    scratch_t& operator=(scratch_t const&) = delete;
+
+    ~scratch_t()
+    {
+        for(auto& b : s_->b)
+            if(b.capacity() > max_capacity)
+                b = buffer{};
+        s_->busy = false;
+    }
+
+    buffer&
+    operator[](std::size_t i)
+    {
+        return s_->b[i];
+    }
+};
+
+using scratch = scratch_t<>;
+
 } // detail
 } // nudb
 
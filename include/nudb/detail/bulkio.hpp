@@ -14,11 +14,41 @@
 #include <nudb/error.hpp>
 #include <algorithm>
 #include <cstddef>
+#include <cstring>
 
 namespace nudb {
 namespace detail {
 
+// Returns the alignment a file requires for efficient
+// transfers, or 1 if the file has no such requirement.
+template<class File>
+auto
+file_alignment(File const& f, int) ->
+    decltype(std::size_t{f.alignment()})
+{
+    return f.alignment();
+}
+
+template<class File>
+std::size_t
+file_alignment(File const&, long)
+{
+    return 1;
+}
+
+template<class File>
+std::size_t
+file_alignment(File const& f)
+{
+    return file_alignment(f, 0);
+}
+
+//------------------------------------------------------------------------------
+
 // Scans a file in sequential large reads
+//
+// If the file requires aligned transfers, reads start on
+// an aligned offset and land at an aligned address.
 template<class File>
 class bulk_reader
 {
@@ -28,6 +58,8 @@ class bulk_reader
     noff_t offset_;     // current position
     std::size_t avail_; // bytes left to read in buf
     std::size_t used_;  // bytes consumed in buf
+    std::size_t align_; // transfer alignment
+    std::size_t skip_;  // bytes to discard from the first read
 
 public:
     bulk_reader(File& f, noff_t offset,
@@ -36,7 +68,7 @@ public:
     noff_t
     offset() const
     {
-        return offset_ - avail_;
+        return offset_ - avail_ + skip_;
     }
 
     bool
@@ -54,12 +86,19 @@ bulk_reader<File>::
 bulk_reader(File& f, noff_t offset,
         noff_t last, std::size_t buffer_size)
     : f_(f)
+    , buf_(buffer_size, file_alignment(f))
     , last_(last)
     , offset_(offset)
     , avail_(0)
     , used_(0)
+    , align_(file_alignment(f))
+    , skip_(0)
 {
-    buf_.reserve(buffer_size);
+    if(align_ > 1)
+    {
+        skip_ = static_cast<std::size_t>(offset_ % align_);
+        offset_ -= skip_;
+    }
 }
 
 template<class File>
@@ -69,33 +108,40 @@ prepare(std::size_t needed, error_code& ec)
 {
     if(needed > avail_)
     {
-        if(offset_ + needed - avail_ > last_)
+        if(offset() + needed > last_)
         {
             ec = error::short_read;
             return {};
         }
-        if(needed > buf_.size())
+        // Place the unconsumed bytes so that
+        // the next read lands on an aligned address.
+        auto const pad = (align_ - avail_ % align_) % align_;
+        auto const more = (skip_ + needed - avail_ +
+            align_ - 1) / align_ * align_;
+        if(pad + avail_ + more > buf_.size())
         {
-            buffer buf;
-            buf.reserve(needed);
-            std::memcpy(buf.get(),
+            buffer buf{pad + avail_ + more, align_};
+            std::memcpy(buf.get() + pad,
                 buf_.get() + used_, avail_);
             buf_ = std::move(buf);
         }
         else
         {
-            std::memmove(buf_.get(),
+            std::memmove(buf_.get() + pad,
                 buf_.get() + used_, avail_);
         }
 
-        auto const n = std::min(buf_.size() - avail_,
+        auto n = std::min(buf_.size() - pad - avail_,
             static_cast<std::size_t>(last_ - offset_));
-        f_.read(offset_, buf_.get() + avail_, n, ec);
+        if(offset_ + n < last_)
+            n -= n % align_;
+        f_.read(offset_, buf_.get() + pad + avail_, n, ec);
         if(ec)
             return {};
         offset_ += n;
-        avail_ += n;
-        used_ = 0;
+        avail_ += n - skip_;
+        used_ = pad + skip_;
+        skip_ = 0;
     }
     istream is{buf_.get() + used_, needed};
     used_ += needed;
@@ -107,13 +153,20 @@ prepare(std::size_t needed, error_code& ec)
 
 // Buffers file writes
 // Caller must call flush manually at the end
+//
+// If the file requires aligned transfers, the partial block
+// at the end of each flush is kept in the buffer and written
+// again with the next flush, so that every write after the
+// first starts on an aligned offset.
 template<class File>
 class bulk_writer
 {
     File& f_;
     buffer buf_;
-    noff_t offset_;      // current position
+    noff_t offset_;      // file position of buf
     std::size_t used_;   // bytes written to buf
+    std::size_t kept_;   // leading bytes of buf already in the file
+    std::size_t align_;  // transfer alignment
 
 public:
     bulk_writer(File& f, noff_t offset,
@@ -126,7 +179,7 @@ public:
     std::size_t
     size()
     {
-        return used_;
+        return used_ - kept_;
     }
 
     // Return current offset in file. This
@@ -148,11 +201,12 @@ bulk_writer<File>::
 bulk_writer(File& f,
         noff_t offset, std::size_t buffer_size)
     : f_(f)
+    , buf_(buffer_size, file_alignment(f))
     , offset_(offset)
     , used_(0)
-
+    , kept_(0)
+    , align_(file_alignment(f))
 {
-    buf_.reserve(buffer_size);
 }
 
 template<class File>
@@ -165,9 +219,13 @@ prepare(std::size_t needed, error_code& ec)
         flush(ec);
         if(ec)
             return{};
+        if(used_ + needed > buf_.size())
+        {
+            buffer buf{used_ + needed, align_};
+            std::memcpy(buf.get(), buf_.get(), used_);
+            buf_ = std::move(buf);
+        }
     }
-    if(needed > buf_.size())
-        buf_.reserve(needed);
     ostream os(buf_.get() + used_, needed);
     used_ += needed;
     return os;
@@ -178,13 +236,19 @@ void
 bulk_writer<File>::
 flush(error_code& ec)
 {
-    if(used_)
+    if(used_ > kept_)
     {
         auto const offset = offset_;
         auto const used = used_;
-        offset_ += used_;
-        used_ = 0;
+        auto const keep = std::min<std::size_t>(used,
+            static_cast<std::size_t>((offset + used) % align_));
         f_.write(offset, buf_.get(), used, ec);
+        if(keep > 0)
+            std::memmove(buf_.get(),
+                buf_.get() + used - keep, keep);
+        offset_ += used - keep;
+        used_ = keep;
+        kept_ = keep;
         if(ec)
             return;
     }
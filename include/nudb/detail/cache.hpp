@@ -57,12 +57,14 @@ private:
         operator()(argument_type const& e) const
         {
             return std::make_pair(e.first,
-                bucket{cache_->block_size_, e.second});
+                bucket{cache_->block_size_,
+                    e.second, cache_->version_});
         }
     };
 
     nsize_t key_size_ = 0;
     nsize_t block_size_ = 0;
+    std::size_t version_ = 0;
     arena arena_;
     map_type map_;
 
@@ -80,9 +82,8 @@ public:
     
     cache_t(cache_t&& other);
 
-    explicit
-    cache_t(nsize_t key_size,
-        nsize_t block_size, char const* label);
+    cache_t(nsize_t key_size, nsize_t block_size,
+        std::size_t version, char const* label);
 
     std::size_t
     size() const
@@ -130,6 +131,12 @@ public:
     iterator
     insert(nbuck_t n, bucket const& b);
 
+    // Replace the contents of an existing bucket.
+    // Safe to call concurrently for different buckets.
+    //
+    void
+    assign(nbuck_t n, bucket const& b);
+
     template<class U>
     friend
     void
@@ -141,6 +148,7 @@ cache_t<_>::
 cache_t(cache_t&& other)
     : key_size_{other.key_size_}
     , block_size_(other.block_size_)
+    , version_(other.version_)
     , arena_(std::move(other.arena_))
     , map_(std::move(other.map_))
 {
@@ -148,10 +156,11 @@ cache_t(cache_t&& other)
 
 template<class _>
 cache_t<_>::
-cache_t(nsize_t key_size,
-        nsize_t block_size, char const* label)
+cache_t(nsize_t key_size, nsize_t block_size,
+        std::size_t version, char const* label)
     : key_size_(key_size)
     , block_size_(block_size)
+    , version_(version)
     , arena_(label)
 {
 }
@@ -201,7 +210,7 @@ create(nbuck_t n)
 {
     auto const p = arena_.alloc(block_size_);
     map_.emplace(n, p);
-    return bucket{block_size_, p, detail::empty};
+    return bucket{block_size_, p, version_, detail::empty};
 }
 
 template<class _>
@@ -211,12 +220,21 @@ insert(nbuck_t n, bucket const& b) ->
     iterator
 {
     void* const p = arena_.alloc(b.block_size());
-    ostream os{p, b.block_size()};
-    b.write(os);
+    b.copy(p);
     auto const result = map_.emplace(n, p);
     return iterator{result.first, transform(*this)};
 }
 
+template<class _>
+void
+cache_t<_>::
+assign(nbuck_t n, bucket const& b)
+{
+    auto const iter = map_.find(n);
+    BOOST_ASSERT(iter != map_.end());
+    b.copy(iter->second);
+}
+
 template<class U>
 void
 swap(cache_t<U>& lhs, cache_t<U>& rhs)
@@ -224,6 +242,7 @@ swap(cache_t<U>& lhs, cache_t<U>& rhs)
     using std::swap;
     swap(lhs.key_size_, rhs.key_size_);
     swap(lhs.block_size_, rhs.block_size_);
+    swap(lhs.version_, rhs.version_);
     swap(lhs.arena_, rhs.arena_);
     swap(lhs.map_, rhs.map_);
 }
@@ -34,7 +34,7 @@ namespace detail {
 Integer sizes
 
 block_size          less than 32 bits (maybe restrict it to 16 bits)
-buckets             more than 32 bits
+buckets             64 bits (48 bits usable, the hash size)
 capacity            (same as bucket index)
 file offsets        63 bits
 hash                up to 64 bits (48 currently)
@@ -44,7 +44,38 @@ value size          up to 32 bits (or 32-bit builds can't read it)
 
 */
 
-static std::size_t constexpr currentVersion = 2;
+// Newest version of the file format understood
+static std::size_t constexpr currentVersion = 3;
+
+// Oldest version of the file format understood
+static std::size_t constexpr minimumVersion = 2;
+
+// Version written by create and rekey unless another is chosen
+static std::size_t constexpr defaultVersion = 2;
+
+/*
+
+Bucket layouts
+
+Version 2 packs each entry as Offset (u48), Size (u48) and
+Hash (u48), big-endian, after an 8 byte Count and Spill header.
+
+Version 3 pads the header to a cache line, followed by the
+hashes of all capacity entries as little-endian u64, followed
+by the Offset (u64) and Size (u32) of each entry, also
+little-endian. The compact form of a version 3 bucket holds
+the header followed by only the hashes and values in use.
+
+*/
+
+// Size of a version 3 bucket header
+static std::size_t constexpr bucket_header_size_v3 = 64;
+
+// Size of the hash of a version 3 bucket entry
+static std::size_t constexpr bucket_hash_size_v3 = 8;
+
+// Size of the Offset and Size of a version 3 bucket entry
+static std::size_t constexpr bucket_value_size_v3 = 12;
 
 struct dat_file_header
 {
@@ -125,6 +156,34 @@ struct log_file_header
     noff_t dat_file_size;
 };
 
+struct filter_file_header
+{
+    static std::size_t constexpr size =
+        8 +     // Type
+        2 +     // Version
+        8 +     // UID
+        8 +     // Salt
+        8 +     // KeyFileSize
+        8 +     // DataFileSize
+
+        8 +     // Rate
+        8 +     // Budget
+        8 +     // Bits
+        2;      // Hashes
+
+    char type[8];
+    std::size_t version;
+    std::uint64_t uid;
+    std::uint64_t salt;
+    noff_t key_file_size;
+    noff_t dat_file_size;
+
+    std::uint64_t rate;         // False positives per billion
+    std::uint64_t budget;       // Maximum bytes
+    std::uint64_t bits;
+    std::size_t hashes;
+};
+
 // Type used to store hashes in buckets.
 // This can be smaller than the output
 // of the hash function.
@@ -182,8 +241,12 @@ pepper(std::uint64_t salt)
 //
 template<class = void>
 nsize_t
-bucket_size(nkey_t capacity)
+bucket_size(nkey_t capacity, std::size_t version)
 {
+    if(version >= 3)
+        return static_cast<nsize_t>(
+            bucket_header_size_v3 + capacity * (
+                bucket_hash_size_v3 + bucket_value_size_v3));
     // Bucket Record
     return
         field<std::uint16_t>::size +    // Count
@@ -198,13 +261,15 @@ bucket_size(nkey_t capacity)
 //
 template<class = void>
 nkey_t
-bucket_capacity(nsize_t block_size)
+bucket_capacity(nsize_t block_size, std::size_t version)
 {
     // Bucket Record
-    auto const size =
+    auto const size = version >= 3 ?
+        bucket_header_size_v3 :
         field<std::uint16_t>::size +    // Count
         field<uint48_t>::size;          // Spill
-    auto const entry_size =
+    auto const entry_size = version >= 3 ?
+        bucket_hash_size_v3 + bucket_value_size_v3 :
         field<uint48_t>::size +         // Offset
         field<uint48_t>::size +         // Size
         field<f_hash>::size;            // Hash
@@ -334,7 +399,7 @@ read(istream& is, noff_t file_size, key_file_header& kh)
 
     // VFALCO These need to be checked to handle
     //        when the file size is too small
-    kh.capacity = bucket_capacity(kh.block_size);
+    kh.capacity = bucket_capacity(kh.block_size, kh.version);
     if(file_size > kh.block_size)
     {
         if(kh.block_size > 0)
@@ -463,6 +528,40 @@ write(File& f, log_file_header const& lh, error_code& ec)
     f.write(0, buf.data(), buf.size(), ec);
 }
 
+// Read filter file header from stream
+template<class = void>
+void
+read(istream& is, filter_file_header& fh)
+{
+    read(is, fh.type, sizeof(fh.type));
+    read<std::uint16_t>(is, fh.version);
+    read<std::uint64_t>(is, fh.uid);
+    read<std::uint64_t>(is, fh.salt);
+    read<std::uint64_t>(is, fh.key_file_size);
+    read<std::uint64_t>(is, fh.dat_file_size);
+    read<std::uint64_t>(is, fh.rate);
+    read<std::uint64_t>(is, fh.budget);
+    read<std::uint64_t>(is, fh.bits);
+    read<std::uint16_t>(is, fh.hashes);
+}
+
+// Write filter file header to stream
+template<class = void>
+void
+write(ostream& os, filter_file_header const& fh)
+{
+    write(os, "nudb.flt", 8);
+    write<std::uint16_t>(os, fh.version);
+    write<std::uint64_t>(os, fh.uid);
+    write<std::uint64_t>(os, fh.salt);
+    write<std::uint64_t>(os, fh.key_file_size);
+    write<std::uint64_t>(os, fh.dat_file_size);
+    write<std::uint64_t>(os, fh.rate);
+    write<std::uint64_t>(os, fh.budget);
+    write<std::uint64_t>(os, fh.bits);
+    write<std::uint16_t>(os, fh.hashes);
+}
+
 // Verify contents of data file header
 template<class = void>
 void
@@ -474,7 +573,8 @@ verify(dat_file_header const& dh, error_code& ec)
         ec = error::not_data_file;
         return;
     }
-    if(dh.version != currentVersion)
+    if(dh.version < minimumVersion ||
+        dh.version > currentVersion)
     {
         ec = error::different_version;
         return;
@@ -497,7 +597,8 @@ verify(key_file_header const& kh, error_code& ec)
         ec = error::not_key_file;
         return;
     }
-    if(kh.version != currentVersion)
+    if(kh.version < minimumVersion ||
+        kh.version > currentVersion)
     {
         ec = error::different_version;
         return;
@@ -540,7 +641,8 @@ verify(log_file_header const& lh, error_code& ec)
         ec = error::not_log_file;
         return;
     }
-    if(lh.version != currentVersion)
+    if(lh.version < minimumVersion ||
+        lh.version > currentVersion)
     {
         ec = error::different_version;
         return;
@@ -622,6 +724,11 @@ verify(key_file_header const& kh,
         ec = error::block_size_mismatch;
         return;
     }
+    if(kh.version != lh.version)
+    {
+        ec = error::different_version;
+        return;
+    }
 }
 
 } // detail
@@ -0,0 +1,274 @@
+//
+// Copyright (c) 2015-2016 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef NUDB_DETAIL_MAPPED_FILE_HPP
+#define NUDB_DETAIL_MAPPED_FILE_HPP
+
+#include <nudb/error.hpp>
+#include <nudb/file.hpp>
+#include <nudb/posix_file.hpp>
+#include <nudb/type_traits.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#if NUDB_POSIX_FILE
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <unistd.h>
+#endif
+
+namespace nudb {
+namespace detail {
+
+// A snapshot of the readable part of a mapped file
+struct mapped_view
+{
+    std::uint8_t const* p;
+    std::size_t size;
+
+    // Returns a pointer to the range, or
+    // nullptr if it lies outside the view.
+    std::uint8_t const*
+    data(noff_t offset, std::size_t len) const
+    {
+        if(offset + len > size)
+            return nullptr;
+        return p + offset;
+    }
+};
+
+//  Read-only shared mapping of a file which only grows.
+//
+//  The mapping reserves more address space than the file
+//  needs, so that growing the file usually only extends the
+//  view. When it must be replaced, the old mapping is retired
+//  rather than unmapped, because readers may still hold
+//  pointers into it. expire() marks the mappings retired so
+//  far, and release() unmaps them once the caller knows that
+//  no reader from before the call to expire() remains.
+//  The caller synchronizes access.
+//
+template<class = void>
+class mapped_file_t
+{
+    int fd_ = -1;
+    std::uint8_t* p_ = nullptr;
+    std::size_t cap_ = 0;       // bytes mapped
+    std::size_t size_ = 0;      // bytes readable
+    std::vector<std::pair<std::uint8_t*, std::size_t>> retired_;
+    std::size_t expired_ = 0;   // retired_ which may be unmapped
+
+public:
+    mapped_file_t() = default;
+    mapped_file_t(mapped_file_t const&) = delete;
+    mapped_file_t& operator=(mapped_file_t const&) = delete;
+
+    ~mapped_file_t();
+
+    mapped_file_t(mapped_file_t&& other);
+
+    bool
+    is_open() const
+    {
+        return fd_ != -1;
+    }
+
+    mapped_view
+    view() const
+    {
+        return {p_, size_};
+    }
+
+    // Map the first size bytes of the file
+    void
+    open(path_type const& path, std::size_t size, error_code& ec);
+
+    // Retire the mapping and close the file
+    void
+    close();
+
+    // Make the first size bytes readable. If this fails
+    // the view is left unchanged.
+    void
+    grow(std::size_t size);
+
+    // Mark the mappings retired so far as unused
+    void
+    expire()
+    {
+        expired_ = retired_.size();
+    }
+
+    // Unmap expired mappings
+    void
+    release();
+
+private:
+    bool
+    map(std::size_t size);
+};
+
+template<class _>
+mapped_file_t<_>::
+~mapped_file_t()
+{
+    close();
+    expire();
+    release();
+}
+
+template<class _>
+mapped_file_t<_>::
+mapped_file_t(mapped_file_t&& other)
+    : fd_(other.fd_)
+    , p_(other.p_)
+    , cap_(other.cap_)
+    , size_(other.size_)
+    , retired_(std::move(other.retired_))
+    , expired_(other.expired_)
+{
+    other.fd_ = -1;
+    other.p_ = nullptr;
+    other.cap_ = 0;
+    other.size_ = 0;
+    other.retired_.clear();
+    other.expired_ = 0;
+}
+
+#if NUDB_POSIX_FILE
+
+template<class _>
+void
+mapped_file_t<_>::
+open(path_type const& path, std::size_t size, error_code& ec)
+{
+    BOOST_ASSERT(! is_open());
+    fd_ = ::open(path.c_str(), O_RDONLY);
+    if(fd_ == -1)
+    {
+        ec = error_code{errno, generic_category()};
+        return;
+    }
+    if(! map(size))
+    {
+        ec = error_code{errno, generic_category()};
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+template<class _>
+void
+mapped_file_t<_>::
+close()
+{
+    if(p_)
+        retired_.emplace_back(p_, cap_);
+    p_ = nullptr;
+    cap_ = 0;
+    size_ = 0;
+    if(fd_ != -1)
+    {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+template<class _>
+void
+mapped_file_t<_>::
+grow(std::size_t size)
+{
+    if(! is_open() || size <= size_)
+        return;
+    if(size <= cap_)
+    {
+        size_ = size;
+        return;
+    }
+    map(size);
+}
+
+template<class _>
+void
+mapped_file_t<_>::
+release()
+{
+    for(std::size_t i = 0; i < expired_; ++i)
+        ::munmap(retired_[i].first, retired_[i].second);
+    retired_.erase(retired_.begin(), retired_.begin() + expired_);
+    expired_ = 0;
+}
+
+template<class _>
+bool
+mapped_file_t<_>::
+map(std::size_t size)
+{
+    auto const page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    auto const cap = (2 * size + page - 1) / page * page;
+    // Pages past the end of the file are never touched
+    auto const p = ::mmap(nullptr, cap, PROT_READ, MAP_SHARED, fd_, 0);
+    if(p == MAP_FAILED)
+        return false;
+    if(p_)
+        retired_.emplace_back(p_, cap_);
+    p_ = static_cast<std::uint8_t*>(p);
+    cap_ = cap;
+    size_ = size;
+    return true;
+}
+
+#else
+
+template<class _>
+void
+mapped_file_t<_>::
+open(path_type const&, std::size_t, error_code& ec)
+{
+    ec = errc::make_error_code(errc::function_not_supported);
+}
+
+template<class _>
+void
+mapped_file_t<_>::
+close()
+{
+}
+
+template<class _>
+void
+mapped_file_t<_>::
+grow(std::size_t)
+{
+}
+
+template<class _>
+void
+mapped_file_t<_>::
+release()
+{
+}
+
+template<class _>
+bool
+mapped_file_t<_>::
+map(std::size_t)
+{
+    return false;
+}
+
+#endif
+
+using mapped_file = mapped_file_t<>;
+
+} // detail
+} // nudb
+
+#endif
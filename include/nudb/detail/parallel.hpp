@@ -0,0 +1,52 @@
+//
+// Copyright (c) 2015-2016 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef NUDB_DETAIL_PARALLEL_HPP
+#define NUDB_DETAIL_PARALLEL_HPP
+
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace nudb {
+namespace detail {
+
+// Invokes f(i) for each i in [0, n), each on its own
+// thread. The calling thread runs f(0). Returns after
+// all invocations have completed.
+//
+template<class Function>
+void
+parallel_for(std::size_t n, Function&& f)
+{
+    std::vector<std::thread> threads;
+    threads.reserve(n);
+    try
+    {
+        for(std::size_t i = 1; i < n; ++i)
+            threads.emplace_back(
+                [&f, i]
+                {
+                    f(i);
+                });
+    }
+    catch(...)
+    {
+        for(auto& t : threads)
+            t.join();
+        throw;
+    }
+    if(n > 0)
+        f(0);
+    for(auto& t : threads)
+        t.join();
+}
+
+} // detail
+} // nudb
+
+#endif
@@ -13,36 +13,47 @@
 #include <nudb/detail/format.hpp>
 #include <boost/assert.hpp>
 #include <boost/thread/lock_types.hpp>
+#include <algorithm>
 #include <cstdint>
 #include <cstring>
+#include <limits>
 #include <memory>
-#include <map>
 #include <utility>
+#include <vector>
 
 namespace nudb {
 namespace detail {
 
-// Buffers key/value pairs in a map, associating
-// them with a modifiable data file offset.
+// Buffers key/value pairs in insertion order, associating
+// them with a modifiable data file offset. Lookups go through
+// an open addressing index keyed on the hash of the key.
 template<class = void>
 class pool_t
 {
 public:
     struct value_type;
-    class compare;
 
 private:
-    using map_type = std::map<
-        value_type, noff_t, compare>;
+    using element = std::pair<value_type, noff_t>;
+
+    // A slot in the index. The tag holds the low bits
+    // of the hash so most mismatches are rejected
+    // without touching the element or the key.
+    struct slot
+    {
+        std::uint32_t tag;
+        std::uint32_t pos;      // element index + 1, 0 if empty
+    };
 
     arena arena_;
     nsize_t key_size_;
     nsize_t data_size_ = 0;
-    map_type map_;
+    std::vector<element> v_;
+    std::vector<slot> index_;   // size is a power of two
 
 public:
     using iterator =
-        typename map_type::iterator;
+        typename std::vector<element>::iterator;
 
     pool_t(pool_t const&) = delete;
     pool_t& operator=(pool_t const&) = delete;
@@ -54,26 +65,26 @@ public:
     iterator
     begin()
     {
-        return map_.begin();
+        return v_.begin();
     }
 
     iterator
     end()
     {
-        return map_.end();
+        return v_.end();
     }
 
     bool
     empty() const
     {
-        return map_.size() == 0;
+        return v_.size() == 0;
     }
 
     // Returns the number of elements in the pool
     std::size_t
     size() const
     {
-        return map_.size();
+        return v_.size();
     }
 
     // Returns the sum of data sizes in the pool
@@ -89,8 +100,10 @@ public:
     void
     periodic_activity();
 
+    // Find a value
+    // @param h The hash of the key
     iterator
-    find(void const* key);
+    find(nhash_t h, void const* key);
 
     // Insert a value
     // @param h The hash of the key
@@ -102,6 +115,19 @@ public:
     friend
     void
     swap(pool_t<U>& lhs, pool_t<U>& rhs);
+
+private:
+    static
+    std::size_t
+    start(nhash_t h, std::size_t mask)
+    {
+        // Mix the bits in case the hash is weak
+        return static_cast<std::size_t>(
+            (h * 0x9e3779b97f4a7c15ull) >> 32) & mask;
+    }
+
+    void
+    rehash(std::size_t n);
 };
 
 template<class _>
@@ -125,34 +151,6 @@ struct pool_t<_>::value_type
     }
 };
 
-template<class _>
-class pool_t<_>::compare
-{
-    std::size_t key_size_;
-
-public:
-    using result_type = bool;
-    using first_argument_type = value_type;
-    using second_argument_type = value_type;
-
-    compare(compare const&) = default;
-    compare& operator=(compare const&) = default;
-
-    explicit
-    compare(nsize_t key_size)
-        : key_size_(key_size)
-    {
-    }
-
-    bool
-    operator()(value_type const& lhs,
-        value_type const& rhs) const
-    {
-        return std::memcmp(
-            lhs.key, rhs.key, key_size_) < 0;
-    }
-};
-
 //------------------------------------------------------------------------------
 
 template<class _>
@@ -161,7 +159,8 @@ pool_t(pool_t&& other)
     : arena_(std::move(other.arena_))
     , key_size_(other.key_size_)
     , data_size_(other.data_size_)
-    , map_(std::move(other.map_))
+    , v_(std::move(other.v_))
+    , index_(std::move(other.index_))
 {
 }
 
@@ -170,7 +169,6 @@ pool_t<_>::
 pool_t(nsize_t key_size, char const* label)
     : arena_(label)
     , key_size_(key_size)
-    , map_(compare{key_size})
 {
 }
 
@@ -181,7 +179,8 @@ clear()
 {
     arena_.clear();
     data_size_ = 0;
-    map_.clear();
+    v_.clear();
+    std::fill(index_.begin(), index_.end(), slot{0, 0});
 }
 
 template<class _>
@@ -195,13 +194,25 @@ periodic_activity()
 template<class _>
 auto
 pool_t<_>::
-find(void const* key) ->
+find(nhash_t h, void const* key) ->
     iterator
 {
-    // VFALCO need is_transparent here
-    value_type tmp{0, 0, key, nullptr};
-    auto const iter = map_.find(tmp);
-    return iter;
+    if(index_.empty())
+        return v_.end();
+    auto const mask = index_.size() - 1;
+    auto const tag = static_cast<std::uint32_t>(h);
+    for(auto i = start(h, mask);; i = (i + 1) & mask)
+    {
+        auto const& s = index_[i];
+        if(s.pos == 0)
+            return v_.end();
+        if(s.tag != tag)
+            continue;
+        auto const iter = v_.begin() + (s.pos - 1);
+        if(iter->first.hash == h && std::memcmp(
+                iter->first.key, key, key_size_) == 0)
+            return iter;
+    }
 }
 
 template<class _>
@@ -210,20 +221,49 @@ pool_t<_>::
 insert(nhash_t h,
     void const* key, void const* data, nsize_t size)
 {
-    auto const k = arena_.alloc(key_size_);
-    auto const d = arena_.alloc(size);
+    // Must not already exist!
+    BOOST_ASSERT(find(h, key) == v_.end());
+    BOOST_ASSERT(v_.size() <
+        std::numeric_limits<std::uint32_t>::max());
+    // Keep the load factor at or below one half
+    if(2 * (v_.size() + 1) > index_.size())
+        rehash(std::max<std::size_t>(
+            64, 2 * index_.size()));
+    // Key and data are kept together in the arena
+    auto const k = arena_.alloc(key_size_ + size);
+    auto const d = k + key_size_;
     std::memcpy(k, key, key_size_);
     std::memcpy(d, data, size);
-    auto const result = map_.emplace(
-        std::piecewise_construct,
-            std::make_tuple(h, size, k, d),
-                std::make_tuple(0));
-   (void)result.second;
-    // Must not already exist!
-    BOOST_ASSERT(result.second);
+    v_.emplace_back(std::piecewise_construct,
+        std::make_tuple(h, size, k, d),
+            std::make_tuple(0));
+    auto const mask = index_.size() - 1;
+    auto i = start(h, mask);
+    while(index_[i].pos != 0)
+        i = (i + 1) & mask;
+    index_[i] = slot{static_cast<std::uint32_t>(h),
+        static_cast<std::uint32_t>(v_.size())};
     data_size_ += size;
 }
 
+template<class _>
+void
+pool_t<_>::
+rehash(std::size_t n)
+{
+    index_.assign(n, slot{0, 0});
+    auto const mask = n - 1;
+    for(std::size_t pos = 0; pos < v_.size(); ++pos)
+    {
+        auto const h = v_[pos].first.hash;
+        auto i = start(h, mask);
+        while(index_[i].pos != 0)
+            i = (i + 1) & mask;
+        index_[i] = slot{static_cast<std::uint32_t>(h),
+            static_cast<std::uint32_t>(pos + 1)};
+    }
+}
+
 template<class _>
 void
 swap(pool_t<_>& lhs, pool_t<_>& rhs)
@@ -232,7 +272,8 @@ swap(pool_t<_>& lhs, pool_t<_>& rhs)
     swap(lhs.arena_, rhs.arena_);
     swap(lhs.key_size_, rhs.key_size_);
     swap(lhs.data_size_, rhs.data_size_);
-    swap(lhs.map_, rhs.map_);
+    swap(lhs.v_, rhs.v_);
+    swap(lhs.index_, rhs.index_);
 }
 
 using pool = pool_t<>;
@@ -0,0 +1,161 @@
+//
+// Copyright (c) 2015-2016 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef NUDB_DETAIL_SCAN_HPP
+#define NUDB_DETAIL_SCAN_HPP
+
+#include <nudb/error.hpp>
+#include <nudb/detail/buffer.hpp>
+#include <nudb/detail/field.hpp>
+#include <nudb/detail/format.hpp>
+#include <nudb/detail/parallel.hpp>
+#include <nudb/detail/stream.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace nudb {
+namespace detail {
+
+// Scan the records of the data file from the end of the header
+// to fileSize, with the data records divided among threads.
+//
+// Records carry no marker by which a thread could find the start
+// of one from an arbitrary offset, so the calling thread reads the
+// file in windows of readSize bytes per thread which end on a
+// record boundary. Spill records are checked on the calling thread
+// and passed to spill(size). The data records of each window are
+// then divided among the threads in file order, and thread i calls
+// record(i, offset, size, p) for each of its records, where p points
+// to the key followed by the value. When record returns false the
+// thread skips the rest of its records in the window. Finally
+// done(offset, ec) is called on the calling thread with the offset
+// reached, and the scan stops if it sets ec.
+//
+template<class File, class Record, class Spill, class Done>
+void
+scan_records(
+    File& df,
+    nsize_t key_size,
+    std::size_t version,
+    noff_t fileSize,
+    std::size_t readSize,
+    std::size_t threads,
+    Record&& record,
+    Spill&& spill,
+    Done&& done,
+    error_code& ec)
+{
+    auto const window = threads * readSize;
+    buffer buf;
+    // Position in the window and size of each data record
+    std::vector<std::pair<std::size_t, nsize_t>> records;
+    noff_t offset = dat_file_header::size;
+    std::size_t want = window;
+    while(offset < fileSize)
+    {
+        auto const len = static_cast<std::size_t>(
+            std::min<noff_t>(want, fileSize - offset));
+        buf.reserve(len);
+        df.read(offset, buf.get(), len, ec);
+        if(ec)
+            return;
+        records.clear();
+        std::size_t pos = 0;
+        std::size_t need = 0;
+        error_code short_ec;
+        while(pos < len)
+        {
+            auto const avail = len - pos;
+            // Data Record or Spill Record
+            if(avail < field<uint48_t>::size)
+            {
+                need = field<uint48_t>::size;
+                short_ec = error::short_data_record;
+                break;
+            }
+            istream is{buf.get() + pos, avail};
+            nsize_t size;
+            read_size48(is, size);                  // Size
+            if(size > 0)
+            {
+                // Data Record
+                need = field<uint48_t>::size +      // Size
+                    key_size +                      // Key
+                    size;                           // Data
+                if(avail < need)
+                {
+                    short_ec = error::short_value;
+                    break;
+                }
+                records.emplace_back(pos, size);
+            }
+            else
+            {
+                // Spill Record
+                need = field<uint48_t>::size +      // Zero
+                    field<std::uint16_t>::size;     // Size
+                if(avail < need)
+                {
+                    short_ec = error::short_spill;
+                    break;
+                }
+                read<std::uint16_t>(is, size);      // Size
+                if(bucket_size(bucket_capacity(size,
+                    version), version) != size)
+                {
+                    ec = error::invalid_spill_size;
+                    return;
+                }
+                need += size;                       // Bucket
+                if(avail < need)
+                {
+                    short_ec = error::short_spill;
+                    break;
+                }
+                spill(size);
+            }
+            pos += need;
+        }
+        if(pos < len && offset + len >= fileSize)
+        {
+            // The last record is cut short
+            ec = short_ec;
+            return;
+        }
+        auto const n = records.size();
+        auto const nt = std::max<std::size_t>(
+            1, std::min(threads, n));
+        parallel_for(nt,
+            [&](std::size_t i)
+            {
+                auto const last = n * (i + 1) / nt;
+                for(auto j = n * i / nt; j < last; ++j)
+                {
+                    auto const& e = records[j];
+                    if(! record(i, offset + e.first, e.second,
+                            buf.get() + e.first +
+                                field<uint48_t>::size)) // Size
+                        break;
+                }
+            });
+        // A record larger than the window
+        // is read with a larger window.
+        want = pos > 0 ? window : need;
+        offset += pos;
+        done(offset, ec);
+        if(ec)
+            return;
+    }
+}
+
+} // detail
+} // nudb
+
+#endif
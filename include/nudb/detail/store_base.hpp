@@ -8,6 +8,9 @@
 #ifndef NUDB_DETAIL_STORE_BASE_HPP
 #define NUDB_DETAIL_STORE_BASE_HPP
 
+#include <atomic>
+#include <cstddef>
+
 namespace nudb {
 
 class context;
@@ -24,6 +27,10 @@ protected:
 
     virtual void flush() = 0;
 
+    // Approximate bytes waiting to be committed,
+    // used to choose which store to flush first.
+    std::atomic<std::size_t> pending_{0};
+
 private:
 #if ! NUDB_DOXYGEN
     friend class test::context_test;
@@ -40,6 +47,7 @@ private:
     store_base* next_ = nullptr;
     store_base* prev_ = nullptr;
     state state_ = state::none;
+    bool again_ = false;    // flush requested while flushing
 };
 
 } // detail
@@ -0,0 +1,96 @@
+//
+// Copyright (c) 2015-2016 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef NUDB_DETAIL_SYNC_HPP
+#define NUDB_DETAIL_SYNC_HPP
+
+#include <nudb/error.hpp>
+#include <nudb/file.hpp>
+#include <nudb/win32_file.hpp>
+#include <cerrno>
+#include <cstdio>
+
+namespace nudb {
+namespace detail {
+
+// The sync_data and sync_range members are optional,
+// files without them fall back to the stronger call.
+
+template<class File>
+auto
+sync_data(File& f, error_code& ec, int) ->
+    decltype(f.sync_data(ec))
+{
+    return f.sync_data(ec);
+}
+
+template<class File>
+void
+sync_data(File& f, error_code& ec, long)
+{
+    f.sync(ec);
+}
+
+template<class File>
+auto
+sync_range(File& f, error_code& ec, int) ->
+    decltype(f.sync_range(ec))
+{
+    return f.sync_range(ec);
+}
+
+template<class File>
+void
+sync_range(File& f, error_code& ec, long)
+{
+    sync_data(f, ec, 0);
+}
+
+// Synchronize a file as required by the durability policy
+template<class File>
+void
+sync_file(File& f, durability d, error_code& ec)
+{
+    switch(d)
+    {
+    case durability::full:
+        f.sync(ec);
+        break;
+    case durability::data:
+        sync_data(f, ec, 0);
+        break;
+    case durability::ordered:
+        sync_range(f, ec, 0);
+        break;
+    case durability::none:
+        break;
+    }
+}
+
+// Replace the file at `to` with the file at `from`. Neither
+// file may be open. Readers of `to` see either the old or the
+// new file, never a mixture, where the platform allows it.
+inline
+void
+rename_file(path_type const& from,
+    path_type const& to, error_code& ec)
+{
+#if NUDB_WIN32_FILE
+    if(! ::MoveFileExA(from.c_str(), to.c_str(),
+            MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+        ec = error_code{static_cast<int>(
+            ::GetLastError()), system_category()};
+#else
+    if(std::rename(from.c_str(), to.c_str()) != 0)
+        ec = error_code{errno, generic_category()};
+#endif
+}
+
+} // detail
+} // nudb
+
+#endif
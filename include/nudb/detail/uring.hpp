@@ -0,0 +1,731 @@
+//
+// Copyright (c) 2015-2016 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef NUDB_DETAIL_URING_HPP
+#define NUDB_DETAIL_URING_HPP
+
+#include <nudb/error.hpp>
+#include <boost/assert.hpp>
+#include <algorithm>
+#include <condition_variable>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// The system call numbers are shared by all
+// architectures which use the generic table.
+#ifndef __NR_io_uring_setup
+# define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+# define __NR_io_uring_enter 426
+#endif
+#ifndef __NR_io_uring_register
+# define __NR_io_uring_register 427
+#endif
+
+namespace nudb {
+
+/** Configuration for @ref io_uring_file.
+
+    An instance of this structure may be passed to the
+    constructor of @ref io_uring_file, or forwarded through
+    the variadic file arguments of @ref basic_store::open,
+    @ref create, @ref recover and @ref rekey.
+*/
+struct io_uring_options
+{
+    /// The number of submission queue entries
+    unsigned entries = 64;
+
+    /** Use a kernel thread to poll the submission queue.
+
+        When `true`, requests are submitted without a system call
+        while the kernel polling thread is awake. This usually
+        requires elevated privileges on kernels before 5.11.
+    */
+    bool sqpoll = false;
+
+    /// Milliseconds of inactivity before the polling thread sleeps
+    unsigned sq_thread_idle = 1000;
+
+    /** The number of registered buffers.
+
+        Registered buffers are pinned by the kernel once when the
+        file is opened, instead of on every request. Requests which
+        fit in a registered buffer are staged through it. Zero
+        disables registered buffers.
+    */
+    std::size_t buffers = 0;
+
+    /// The size of each registered buffer, in bytes
+    std::size_t buffer_size = 65536;
+};
+
+namespace detail {
+
+//  A submission and completion ring for one file
+//
+//  Any number of threads may submit requests. One thread
+//  at a time waits in the kernel for completions and reaps
+//  them on behalf of the others.
+//
+//  Asynchronous requests are submitted and completed along
+//  with the others, but their handlers only run inside poll.
+//
+template<class = void>
+class uring_t
+{
+    struct request
+    {
+        int res = 0;
+        bool done = false;
+        std::function<void(int)> handler;   // asynchronous only
+        std::size_t index = 0;              // position in async_
+    };
+
+    int fd_ = -1;
+    bool sqpoll_ = false;
+
+    void* sq_ptr_ = nullptr;
+    std::size_t sq_len_ = 0;
+    void* cq_ptr_ = nullptr;
+    std::size_t cq_len_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    std::size_t sqes_len_ = 0;
+
+    unsigned* sq_tail_;
+    unsigned* sq_flags_;
+    unsigned sq_mask_;
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned cq_mask_;
+    io_uring_cqe* cqes_;
+    unsigned entries_;
+
+    std::mutex m_;
+    std::condition_variable cv_;
+    unsigned inflight_ = 0;
+    unsigned unsubmitted_ = 0;
+    bool leader_ = false;
+    int failed_ = 0;
+
+    std::size_t buffer_size_ = 0;
+    std::unique_ptr<std::uint8_t[]> buffers_;
+    std::vector<unsigned> free_;
+
+    std::vector<request*> async_;       // in flight
+    std::vector<request*> completed_;   // awaiting poll
+
+public:
+    uring_t() = default;
+    uring_t(uring_t const&) = delete;
+    uring_t& operator=(uring_t const&) = delete;
+
+    ~uring_t();
+
+    void
+    open(int fd, io_uring_options const& opts, error_code& ec);
+
+    // Returns the number of bytes transferred, or -errno
+    int
+    read(std::uint64_t offset, void* buffer, std::size_t bytes);
+
+    // Returns the number of bytes transferred, or -errno
+    int
+    write(std::uint64_t offset, void const* buffer, std::size_t bytes);
+
+    // Returns 0, or -errno
+    int
+    fsync(bool datasync);
+
+    // Queue a read. The handler receives the number of bytes
+    // transferred or -errno, and is invoked from poll.
+    void
+    async_read(std::uint64_t offset, void* buffer,
+        std::size_t bytes, std::function<void(int)> handler);
+
+    // Submit queued requests and invoke the handlers of
+    // completed asynchronous requests. If block is true,
+    // waits for at least one unless none are in flight.
+    // Returns the number of handlers invoked.
+    std::size_t
+    poll(bool block);
+
+private:
+    static
+    int
+    setup(unsigned entries, io_uring_params& p)
+    {
+        return static_cast<int>(::syscall(
+            __NR_io_uring_setup, entries, &p));
+    }
+
+    int
+    enter(unsigned to_submit, unsigned min_complete, unsigned flags)
+    {
+        return static_cast<int>(::syscall(__NR_io_uring_enter,
+            fd_, to_submit, min_complete, flags, nullptr, 0));
+    }
+
+    int
+    do_register(unsigned op, void const* arg, unsigned n)
+    {
+        return static_cast<int>(::syscall(
+            __NR_io_uring_register, fd_, op, arg, n));
+    }
+
+    void
+    close();
+
+    io_uring_sqe*
+    prepare(std::unique_lock<std::mutex>& lock,
+        std::uint8_t opcode, request& r);
+
+    void
+    commit();
+
+    void
+    wait(std::unique_lock<std::mutex>& lock, request& r);
+
+    void
+    drive(std::unique_lock<std::mutex>& lock, bool block);
+
+    void
+    abandon(std::unique_lock<std::mutex>& lock);
+
+    void
+    reap();
+
+    void
+    complete(request& r, int res);
+
+    bool
+    ready() const
+    {
+        return __atomic_load_n(cq_head_, __ATOMIC_RELAXED) !=
+            __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    }
+
+    std::uint8_t*
+    slot(unsigned i) const
+    {
+        return buffers_.get() + i * buffer_size_;
+    }
+};
+
+template<class _>
+uring_t<_>::
+~uring_t()
+{
+    close();
+}
+
+template<class _>
+void
+uring_t<_>::
+open(int fd, io_uring_options const& opts, error_code& ec)
+{
+    BOOST_ASSERT(fd_ == -1);
+    io_uring_params p;
+    std::memset(&p, 0, sizeof(p));
+    if(opts.sqpoll)
+    {
+        p.flags |= IORING_SETUP_SQPOLL;
+        p.sq_thread_idle = opts.sq_thread_idle;
+    }
+    fd_ = setup(opts.entries, p);
+    if(fd_ < 0)
+    {
+        fd_ = -1;
+        ec = error_code{errno, system_category()};
+        return;
+    }
+    sqpoll_ = opts.sqpoll;
+    sq_len_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_len_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if(p.features & IORING_FEAT_SINGLE_MMAP)
+        sq_len_ = cq_len_ = (std::max)(sq_len_, cq_len_);
+    sq_ptr_ = ::mmap(nullptr, sq_len_, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    if(sq_ptr_ == MAP_FAILED)
+    {
+        sq_ptr_ = nullptr;
+        ec = error_code{errno, system_category()};
+        return close();
+    }
+    if(p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        cq_ptr_ = sq_ptr_;
+    }
+    else
+    {
+        cq_ptr_ = ::mmap(nullptr, cq_len_, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+        if(cq_ptr_ == MAP_FAILED)
+        {
+            cq_ptr_ = nullptr;
+            ec = error_code{errno, system_category()};
+            return close();
+        }
+    }
+    sqes_len_ = p.sq_entries * sizeof(io_uring_sqe);
+    auto const sqes = ::mmap(nullptr, sqes_len_, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED)
+    {
+        ec = error_code{errno, system_category()};
+        return close();
+    }
+    sqes_ = reinterpret_cast<io_uring_sqe*>(sqes);
+    auto const sq = reinterpret_cast<std::uint8_t*>(sq_ptr_);
+    auto const cq = reinterpret_cast<std::uint8_t*>(cq_ptr_);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sq_flags_ = reinterpret_cast<unsigned*>(sq + p.sq_off.flags);
+    sq_mask_ = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+    entries_ = p.sq_entries;
+    // Submission queue slots map one to one onto entries
+    auto const array =
+        reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    for(unsigned i = 0; i < p.sq_entries; ++i)
+        array[i] = i;
+    // Register the file so requests skip the descriptor lookup
+    if(do_register(IORING_REGISTER_FILES, &fd, 1) < 0)
+    {
+        ec = error_code{errno, system_category()};
+        return close();
+    }
+    if(opts.buffers > 0 && opts.buffer_size > 0)
+    {
+        buffer_size_ = opts.buffer_size;
+        buffers_.reset(new std::uint8_t[
+            opts.buffers * opts.buffer_size]);
+        std::vector<iovec> iov(opts.buffers);
+        free_.reserve(opts.buffers);
+        for(std::size_t i = 0; i < opts.buffers; ++i)
+        {
+            iov[i].iov_base = slot(static_cast<unsigned>(i));
+            iov[i].iov_len = buffer_size_;
+            free_.push_back(static_cast<unsigned>(i));
+        }
+        if(do_register(IORING_REGISTER_BUFFERS, iov.data(),
+            static_cast<unsigned>(iov.size())) < 0)
+        {
+            ec = error_code{errno, system_category()};
+            return close();
+        }
+    }
+}
+
+template<class _>
+void
+uring_t<_>::
+close()
+{
+    if(sqes_)
+        ::munmap(sqes_, sqes_len_);
+    if(cq_ptr_ && cq_ptr_ != sq_ptr_)
+        ::munmap(cq_ptr_, cq_len_);
+    if(sq_ptr_)
+        ::munmap(sq_ptr_, sq_len_);
+    if(fd_ != -1)
+        ::close(fd_);
+    sqes_ = nullptr;
+    cq_ptr_ = nullptr;
+    sq_ptr_ = nullptr;
+    fd_ = -1;
+    buffers_.reset();
+    free_.clear();
+    // Handlers of unfinished requests are never invoked
+    for(auto r : async_)
+        delete r;
+    for(auto r : completed_)
+        delete r;
+    async_.clear();
+    completed_.clear();
+}
+
+template<class _>
+int
+uring_t<_>::
+read(std::uint64_t offset, void* buffer, std::size_t bytes)
+{
+    request r;
+    std::unique_lock<std::mutex> lock{m_};
+    auto const sqe = prepare(lock, IORING_OP_READ, r);
+    if(! sqe)
+        return -failed_;
+    sqe->off = offset;
+    sqe->len = static_cast<std::uint32_t>(bytes);
+    if(bytes <= buffer_size_ && ! free_.empty())
+    {
+        auto const i = free_.back();
+        free_.pop_back();
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->addr = reinterpret_cast<std::uint64_t>(slot(i));
+        sqe->buf_index = static_cast<std::uint16_t>(i);
+        commit();
+        wait(lock, r);
+        if(r.res > 0)
+            std::memcpy(buffer, slot(i), r.res);
+        free_.push_back(i);
+        return r.res;
+    }
+    sqe->addr = reinterpret_cast<std::uint64_t>(buffer);
+    commit();
+    wait(lock, r);
+    return r.res;
+}
+
+template<class _>
+int
+uring_t<_>::
+write(std::uint64_t offset, void const* buffer, std::size_t bytes)
+{
+    request r;
+    std::unique_lock<std::mutex> lock{m_};
+    auto const sqe = prepare(lock, IORING_OP_WRITE, r);
+    if(! sqe)
+        return -failed_;
+    sqe->off = offset;
+    sqe->len = static_cast<std::uint32_t>(bytes);
+    if(bytes <= buffer_size_ && ! free_.empty())
+    {
+        auto const i = free_.back();
+        free_.pop_back();
+        std::memcpy(slot(i), buffer, bytes);
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->addr = reinterpret_cast<std::uint64_t>(slot(i));
+        sqe->buf_index = static_cast<std::uint16_t>(i);
+        commit();
+        wait(lock, r);
+        free_.push_back(i);
+        return r.res;
+    }
+    sqe->addr = reinterpret_cast<std::uint64_t>(buffer);
+    commit();
+    wait(lock, r);
+    return r.res;
+}
+
+template<class _>
+int
+uring_t<_>::
+fsync(bool datasync)
+{
+    request r;
+    std::unique_lock<std::mutex> lock{m_};
+    auto const sqe = prepare(lock, IORING_OP_FSYNC, r);
+    if(! sqe)
+        return -failed_;
+    if(datasync)
+        sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    commit();
+    wait(lock, r);
+    return r.res;
+}
+
+template<class _>
+void
+uring_t<_>::
+async_read(std::uint64_t offset, void* buffer,
+    std::size_t bytes, std::function<void(int)> handler)
+{
+    std::unique_ptr<request> r{new request};
+    r->handler = std::move(handler);
+    std::unique_lock<std::mutex> lock{m_};
+    async_.reserve(async_.size() + 1);
+    completed_.reserve(completed_.size() + async_.size() + 1);
+    if(failed_)
+    {
+        r->res = -failed_;
+        r->done = true;
+        completed_.push_back(r.release());
+        return;
+    }
+    auto const sqe = prepare(lock, IORING_OP_READ, *r);
+    if(! sqe)
+    {
+        r->res = -failed_;
+        r->done = true;
+        completed_.push_back(r.release());
+        return;
+    }
+    sqe->off = offset;
+    sqe->len = static_cast<std::uint32_t>(bytes);
+    sqe->addr = reinterpret_cast<std::uint64_t>(buffer);
+    r->index = async_.size();
+    async_.push_back(r.get());
+    commit();
+    // Submitted by the next leader or call to poll
+    r.release();
+}
+
+template<class _>
+std::size_t
+uring_t<_>::
+poll(bool block)
+{
+    std::vector<request*> v;
+    {
+        std::unique_lock<std::mutex> lock{m_};
+        if(! leader_ && ! failed_ &&
+                (unsubmitted_ > 0 || ready()))
+            drive(lock, false);
+        while(block && completed_.empty() &&
+            ! async_.empty() && ! failed_)
+        {
+            if(leader_)
+                cv_.wait(lock);
+            else
+                drive(lock, true);
+        }
+        // Keep the capacity reserved by async_read
+        v.assign(completed_.begin(), completed_.end());
+        completed_.clear();
+    }
+    std::size_t n = 0;
+    for(auto r : v)
+    {
+        std::unique_ptr<request> p{r};
+        p->handler(p->res);
+        ++n;
+    }
+    return n;
+}
+
+// Claim the next submission queue entry, or return nullptr
+// if the ring is unusable. The caller fills in the entry and
+// then calls commit while still holding the lock.
+//
+template<class _>
+io_uring_sqe*
+uring_t<_>::
+prepare(std::unique_lock<std::mutex>& lock,
+    std::uint8_t opcode, request& r)
+{
+    // Never have more requests in flight than the
+    // completion queue can hold without overflowing.
+    while(inflight_ >= entries_ && ! failed_)
+    {
+        // Nobody else may be reaping if all the
+        // requests in flight are asynchronous.
+        if(leader_)
+            cv_.wait(lock);
+        else
+            drive(lock, true);
+    }
+    if(failed_)
+        return nullptr;
+    auto& sqe = sqes_[*sq_tail_ & sq_mask_];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = opcode;
+    sqe.flags = IOSQE_FIXED_FILE;
+    sqe.fd = 0;
+    sqe.user_data = reinterpret_cast<std::uint64_t>(&r);
+    return &sqe;
+}
+
+// Publish the entry claimed by prepare. With SQPOLL the
+// kernel thread may consume it as soon as the tail moves,
+// so every field must be set before this is called.
+//
+template<class _>
+void
+uring_t<_>::
+commit()
+{
+    __atomic_store_n(sq_tail_, *sq_tail_ + 1, __ATOMIC_RELEASE);
+    ++inflight_;
+    ++unsubmitted_;
+}
+
+// Block until r completes. The first waiter becomes the
+// leader: it submits pending entries, waits in the kernel,
+// and reaps completions for everyone else.
+//
+template<class _>
+void
+uring_t<_>::
+wait(std::unique_lock<std::mutex>& lock, request& r)
+{
+    // A failed ring completes every request it holds
+    while(! r.done)
+    {
+        if(leader_)
+        {
+            cv_.wait(lock);
+            continue;
+        }
+        drive(lock, true);
+    }
+}
+
+// Submit pending entries and reap completions as the
+// leader. If block is true, waits in the kernel for at
+// least one completion unless one is already available.
+//
+template<class _>
+void
+uring_t<_>::
+drive(std::unique_lock<std::mutex>& lock, bool block)
+{
+    BOOST_ASSERT(! leader_);
+    leader_ = true;
+    unsigned to_submit = 0;
+    unsigned flags = 0;
+    if(sqpoll_)
+    {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if(__atomic_load_n(sq_flags_, __ATOMIC_RELAXED) &
+                IORING_SQ_NEED_WAKEUP)
+            flags |= IORING_ENTER_SQ_WAKEUP;
+    }
+    else
+    {
+        to_submit = unsubmitted_;
+    }
+    unsubmitted_ = 0;
+    lock.unlock();
+    if(block && sqpoll_ && ! flags)
+    {
+        // The kernel thread is running, give it a
+        // chance to complete before going to sleep.
+        for(int i = 0; i < 1024 && ! ready(); ++i)
+        {
+        #if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+        #endif
+        }
+    }
+    int result = 0;
+    if(block && ! ready())
+        result = enter(to_submit, 1,
+            flags | IORING_ENTER_GETEVENTS);
+    else if(to_submit > 0 || flags)
+        result = enter(to_submit, 0, flags);
+    auto const ev = result < 0 ? errno : 0;
+    lock.lock();
+    if(! sqpoll_)
+    {
+        // Whatever the kernel did not consume
+        // is submitted by the next leader.
+        if(result >= 0)
+            unsubmitted_ += to_submit - (std::min)(
+                to_submit, static_cast<unsigned>(result));
+        else
+            unsubmitted_ += to_submit;
+    }
+    if(ev != 0 && ev != EINTR && ev != EAGAIN && ev != EBUSY)
+    {
+        // The ring is unusable. Fail every request
+        // instead of waiting for completions which
+        // will never arrive.
+        failed_ = ev;
+        abandon(lock);
+    }
+    else
+    {
+        reap();
+    }
+    leader_ = false;
+    cv_.notify_all();
+}
+
+// Called by the leader once the ring has failed. Entries the
+// kernel never received are failed at once. The others still
+// use their buffers, so they are reaped as they complete, and
+// no caller returns while the kernel may write to its memory.
+//
+template<class _>
+void
+uring_t<_>::
+abandon(std::unique_lock<std::mutex>& lock)
+{
+    if(! sqpoll_ && unsubmitted_ > 0)
+    {
+        // Without SQPOLL the kernel only takes
+        // entries when they are submitted.
+        auto const tail = *sq_tail_;
+        for(auto i = tail - unsubmitted_; i != tail; ++i)
+            complete(*reinterpret_cast<request*>(
+                sqes_[i & sq_mask_].user_data), -failed_);
+        __atomic_store_n(sq_tail_,
+            tail - unsubmitted_, __ATOMIC_RELEASE);
+    }
+    unsubmitted_ = 0;
+    while(inflight_ > 0)
+    {
+        lock.unlock();
+        if(sqpoll_ && (__atomic_load_n(sq_flags_,
+                __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP))
+            enter(0, 0, IORING_ENTER_SQ_WAKEUP);
+        if(! ready())
+            std::this_thread::yield();
+        lock.lock();
+        reap();
+    }
+}
+
+template<class _>
+void
+uring_t<_>::
+reap()
+{
+    auto head = *cq_head_;
+    auto const tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    while(head != tail)
+    {
+        auto const& cqe = cqes_[head & cq_mask_];
+        complete(*reinterpret_cast<request*>(
+            cqe.user_data), cqe.res);
+        ++head;
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+}
+
+template<class _>
+void
+uring_t<_>::
+complete(request& r, int res)
+{
+    r.res = res;
+    r.done = true;
+    --inflight_;
+    if(r.handler)
+    {
+        // Space was reserved when the request was queued
+        BOOST_ASSERT(async_[r.index] == &r);
+        async_[r.index] = async_.back();
+        async_[r.index]->index = r.index;
+        async_.pop_back();
+        completed_.push_back(&r);
+    }
+}
+
+using uring = uring_t<>;
+
+} // detail
+} // nudb
+
+#endif
@@ -0,0 +1,295 @@
+//
+// Copyright (c) 2015-2016 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef NUDB_DIRECT_FILE_HPP
+#define NUDB_DIRECT_FILE_HPP
+
+#include <nudb/file.hpp>
+#include <nudb/error.hpp>
+#include <nudb/posix_file.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#ifndef NUDB_DIRECT_FILE
+# if NUDB_POSIX_FILE && defined(__linux__)
+#  define NUDB_DIRECT_FILE 1
+# else
+#  define NUDB_DIRECT_FILE 0
+# endif
+#endif
+
+#if NUDB_DIRECT_FILE
+
+namespace nudb {
+
+/** A file which bypasses the operating system page cache.
+
+    This class provides an implementation of the @b File concept
+    where the file is opened with `O_DIRECT`, so that reads and
+    writes transfer data directly between the device and the
+    caller's memory. This avoids keeping a second copy of the
+    data in the kernel page cache, and the memory pressure which
+    results from large sequential writes.
+
+    Direct I/O requires the file offset, the memory address and
+    the length of each transfer to be multiples of the alignment.
+    Transfers which meet these requirements are performed as is.
+    Other transfers are performed through an aligned intermediate
+    buffer, reading the partial blocks at either end first when
+    writing. The bulk readers and writers used to scan and append
+    the files align their buffers and keep their file offsets
+    aligned, so most large transfers take the direct path.
+
+    A write through the intermediate buffer rewrites the whole
+    blocks it touches, and may truncate padding written past the
+    end of the file. It excludes all other writes to the file
+    while it runs, so that concurrent writes to parts of the same
+    block, or appends, are not lost.
+
+    Opening, creating, sizing and truncating the file are delegated
+    to @ref posix_file.
+
+    @note The file system must support `O_DIRECT`, otherwise
+    opening or creating the file fails with `errc::invalid_argument`.
+*/
+class direct_file
+{
+    posix_file f_;
+    std::size_t alignment_ = 4096;
+
+    // Held exclusively by writes through the intermediate
+    // buffer and by trunc, shared by the other writes.
+    std::unique_ptr<boost::shared_mutex> m_;
+
+public:
+    /// Constructor
+    direct_file() = default;
+
+    /** Constructor
+
+        @param alignment The required alignment of direct
+        transfers. This must be a power of two which is a
+        multiple of the logical block size of the device.
+    */
+    explicit
+    direct_file(std::size_t alignment)
+        : alignment_(alignment)
+    {
+    }
+
+    /// Copy constructor (disallowed)
+    direct_file(direct_file const&) = delete;
+
+    // Copy assignment (disallowed)
+    direct_file& operator=(direct_file const&) = delete;
+
+    /// Destructor.
+    ~direct_file() = default;
+
+    /** Move constructor.
+
+        @note The state of the moved-from object is as if default constructed.
+    */
+    direct_file(direct_file&&) = default;
+
+    /** Move assignment.
+
+        @note The state of the moved-from object is as if default constructed.
+    */
+    direct_file&
+    operator=(direct_file&& other) = default;
+
+    /// Returns `true` if the file is open.
+    bool
+    is_open() const
+    {
+        return f_.is_open();
+    }
+
+    /// Returns the required alignment of direct transfers.
+    std::size_t
+    alignment() const
+    {
+        return alignment_;
+    }
+
+    /// Close the file if it is open.
+    void
+    close()
+    {
+        f_.close();
+    }
+
+    /** Create a new file.
+
+        After the file is created, it is opened as if by `open(mode, path, ec)`.
+
+        @par Requirements
+
+        The file must not already exist, or else `errc::file_exists`
+        is returned.
+
+        @param mode The open mode, which must be a valid @ref file_mode.
+
+        @param path The path of the file to create.
+
+        @param ec Set to the error, if any occurred.
+    */
+    void
+    create(file_mode mode, path_type const& path, error_code& ec);
+
+    /** Open a file.
+
+        @par Requirements
+
+        The file must not already be open.
+
+        @param mode The open mode, which must be a valid @ref file_mode.
+
+        @param path The path of the file to open.
+
+        @param ec Set to the error, if any occurred.
+    */
+    void
+    open(file_mode mode, path_type const& path, error_code& ec);
+
+    /** Remove a file from the file system.
+
+        It is not an error to attempt to erase a file that does not exist.
+
+        @param path The path of the file to remove.
+
+        @param ec Set to the error, if any occurred.
+    */
+    static
+    void
+    erase(path_type const& path, error_code& ec)
+    {
+        posix_file::erase(path, ec);
+    }
+
+    /** Return the size of the file.
+
+        @par Requirements
+
+        The file must be open.
+
+        @param ec Set to the error, if any occurred.
+
+        @return The size of the file, in bytes.
+    */
+    std::uint64_t
+    size(error_code& ec) const
+    {
+        return f_.size(ec);
+    }
+
+    /** Read data from a location in the file.
+
+        @par Requirements
+
+        The file must be open.
+
+        @param offset The position in the file to read from,
+        expressed as a byte offset from the beginning.
+
+        @param buffer The location to store the data.
+
+        @param bytes The number of bytes to read.
+
+        @param ec Set to the error, if any occurred.
+    */
+    void
+    read(std::uint64_t offset,
+        void* buffer, std::size_t bytes, error_code& ec);
+
+    /** Write data to a location in the file.
+
+        @par Requirements
+
+        The file must be open with a mode allowing writes.
+
+        @param offset The position in the file to write from,
+        expressed as a byte offset from the beginning.
+
+        @param buffer The data the write.
+
+        @param bytes The number of bytes to write.
+
+        @param ec Set to the error, if any occurred.
+    */
+    void
+    write(std::uint64_t offset,
+        void const* buffer, std::size_t bytes, error_code& ec);
+
+    /** Perform a low level file synchronization.
+
+        @par Requirements
+
+        The file must be open with a mode allowing writes.
+
+        @param ec Set to the error, if any occurred.
+    */
+    void
+    sync(error_code& ec)
+    {
+        f_.sync(ec);
+    }
+
+    /// Synchronize the file data, see @ref posix_file::sync_data.
+    void
+    sync_data(error_code& ec)
+    {
+        f_.sync_data(ec);
+    }
+
+    /// Write out the file data, see @ref posix_file::sync_range.
+    void
+    sync_range(error_code& ec)
+    {
+        f_.sync_range(ec);
+    }
+
+    /** Truncate the file at a specific size.
+
+        @par Requirements
+
+        The file must be open with a mode allowing writes.
+
+        @param length The new file size.
+
+        @param ec Set to the error, if any occurred.
+    */
+    void
+    trunc(std::uint64_t length, error_code& ec)
+    {
+        boost::unique_lock<boost::shared_mutex> lock{*m_};
+        f_.trunc(length, ec);
+    }
+
+private:
+    bool
+    aligned(std::uint64_t offset,
+        void const* buffer, std::size_t bytes) const;
+
+    std::size_t
+    pread(std::uint64_t offset,
+        void* buffer, std::size_t bytes, error_code& ec);
+
+    void
+    start(error_code& ec);
+};
+
+} // nudb
+
+#include <nudb/impl/direct_file.ipp>
+
+#endif
+
+#endif
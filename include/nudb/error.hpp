@@ -227,7 +227,14 @@ enum class error
     size_mismatch,
 
     /// duplicate value
-    duplicate_value
+    duplicate_value,
+
+    /** The database is read only.
+
+        Returned when @ref basic_store::insert is called on a
+        database opened with @ref basic_store::open_read_only.
+    */
+    read_only
 };
 
 /// Returns the error category used for database error codes.
@@ -50,6 +50,55 @@ enum class file_mode
     write
 };
 
+/** Durability policies for committing to disk.
+
+    These control how a database makes the data written by
+    a commit durable. Each commit writes a log file first,
+    so that an interrupted commit can be rolled back by
+    @ref recover, and synchronizes the files at each step.
+
+    These are used by @ref basic_store::set_durability.
+*/
+enum class durability
+{
+    /** Synchronize the files and their metadata.
+
+        A committed insert survives a power failure.
+        This is the default.
+    */
+    full,
+
+    /** Synchronize the file data only.
+
+        Metadata which is not needed to read the data back,
+        such as the modification time, is not synchronized.
+        The guarantees are the same as @ref durability::full on
+        file systems which implement `fdatasync` correctly.
+    */
+    data,
+
+    /** Write out each file and wait, without flushing.
+
+        The data of each file is written to the device before
+        the next step of the commit, which keeps the amount of
+        unwritten data small. Neither the device write cache nor
+        the file metadata are flushed. The files grow with each
+        commit, and their new sizes may be lost, so this gives
+        no more protection against an operating system crash or
+        power failure than @ref durability::none.
+    */
+    ordered,
+
+    /** Do not synchronize.
+
+        The files are written in order, so a database survives
+        the process terminating, but anything may be lost if the
+        operating system crashes. Use this for databases which
+        can be rebuilt.
+    */
+    none
+};
+
 } // nudb
 
 #endif
@@ -9,10 +9,22 @@
 #define NUDB_IMPL_BASIC_STORE_IPP
 
 #include <nudb/concepts.hpp>
+#include <nudb/native_file.hpp>
 #include <nudb/recover.hpp>
+#include <nudb/rekey.hpp>
 #include <boost/assert.hpp>
+#include <nudb/detail/async.hpp>
+#include <nudb/detail/parallel.hpp>
+#include <nudb/detail/sync.hpp>
+#include <algorithm>
+#include <atomic>
+#include <bitset>
 #include <cmath>
+#include <cstring>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #ifndef NUDB_DEBUG_LOG
 #define NUDB_DEBUG_LOG 0
@@ -39,7 +51,8 @@ state(File&& df_, File&& kf_, File&& lf_,
     , hasher(kh_.salt)
     , p0(kh_.key_size, "p0")
     , p1(kh_.key_size, "p1")
-    , c1(kh_.key_size, kh_.block_size, "c1")
+    , c1(kh_.key_size, kh_.block_size, kh_.version, "c1")
+    , bc(kh_.block_size, kh_.version)
     , kh(kh_)
 {
     static_assert(is_File<File>::value,
@@ -111,6 +124,7 @@ basic_store<Hasher, File>::
 block_size() const
 {
     BOOST_ASSERT(is_open());
+    detail::shared_lock_type m{m_};
     return s_->kh.block_size;
 }
 
@@ -149,6 +163,65 @@ open(
         return;
     // VFALCO TODO Erase empty log file if this
     //             function subsequently fails.
+    read_only_ = false;
+    open_state(std::move(df), std::move(kf), std::move(lf),
+        dat_path, key_path, log_path, ec);
+    if(ec)
+        return;
+    ctx_->insert(*this);
+}
+
+template<class Hasher, class File>
+template<class... Args>
+void
+basic_store<Hasher, File>::
+open_read_only(
+    path_type const& dat_path,
+    path_type const& key_path,
+    path_type const& log_path,
+    error_code& ec,
+    Args&&... args)
+{
+    static_assert(is_Hasher<Hasher>::value,
+        "Hasher requirements not met");
+    BOOST_ASSERT(! is_open());
+    ec_ = {};
+    ecb_.store(false);
+    File df(args...);
+    File kf(args...);
+    File lf(args...);
+    // Without recovery the files are only
+    // consistent if there is no log file.
+    lf.open(file_mode::read, log_path, ec);
+    if(! ec)
+        ec = error::log_file_exists;
+    if(ec != errc::no_such_file_or_directory)
+        return;
+    ec = {};
+    df.open(file_mode::read, dat_path, ec);
+    if(ec)
+        return;
+    kf.open(file_mode::read, key_path, ec);
+    if(ec)
+        return;
+    read_only_ = true;
+    open_state(std::move(df), std::move(kf), std::move(lf),
+        dat_path, key_path, log_path, ec);
+}
+
+template<class Hasher, class File>
+void
+basic_store<Hasher, File>::
+open_state(
+    File&& df,
+    File&& kf,
+    File&& lf,
+    path_type const& dat_path,
+    path_type const& key_path,
+    path_type const& log_path,
+    error_code& ec)
+{
+    using namespace detail;
     dat_file_header dh;
     read(df, dh, ec);
     if(ec)
@@ -180,11 +253,21 @@ open(
         ec = error::short_key_file;
         return;
     }
-    dataWriteSize_ = 32 * nudb::block_size(dat_path);
-    logWriteSize_ = 32 * nudb::block_size(log_path);
+    if(filterRate_ > 0)
+    {
+        open_filter(*s, ec);
+        if(ec)
+            return;
+    }
+    dataReadSize_ = 32 * nudb::block_size(dat_path);
+    if(! read_only_)
+    {
+        dataWriteSize_ = dataReadSize_;
+        logWriteSize_ = 32 * nudb::block_size(log_path);
+        keyWriteSize_ = 32 * nudb::block_size(key_path);
+    }
     s_.emplace(std::move(*s));
     open_ = true;
-    ctx_->insert(*this);
 }
 
 template<class Hasher, class File>
@@ -194,11 +277,24 @@ close(error_code& ec)
 {
     if(open_)
     {
+        finish_reads();
+        {
+            std::lock_guard<std::mutex> lock{rm_};
+            ready_.clear();
+            outstanding_ = 0;
+        }
         open_ = false;
+        if(read_only_)
+        {
+            // Nothing was written
+            state s{std::move(*s_)};
+            return;
+        }
         ctx_->erase(*this);
         if(! s_->p1.empty())
         {
             std::size_t work;
+            std::lock_guard<std::mutex> cm{cm_};
             detail::unique_lock_type m{m_};
             commit(m, work, ec_);
             if (ec_)
@@ -209,6 +305,7 @@ close(error_code& ec)
             ec = ec_;
             return;
         }
+        close_filter(ec);
         s_->lf.close();
         state s{std::move(*s_)};
         File::erase(s.lp, ec_);
@@ -237,10 +334,10 @@ fetch(
         hash(key, s_->kh.key_size, s_->hasher);
     shared_lock_type m{m_};
     {
-        auto iter = s_->p1.find(key);
+        auto iter = s_->p1.find(h, key);
         if(iter == s_->p1.end())
         {
-            iter = s_->p0.find(key);
+            iter = s_->p0.find(h, key);
             if(iter == s_->p0.end())
                 goto cont;
         }
@@ -248,221 +345,1486 @@ fetch(
         return;
     }
 cont:
+    if(! s_->bf.may_contain(h))
+    {
+        ec = error::key_not_found;
+        return;
+    }
     auto const n = bucket_index(h, buckets_, modulus_);
+    // Also keeps the block size from changing under
+    // a reader of c1, see rekey_swap.
+    genlock<gentex> g{g_};
     auto const iter = s_->c1.find(n);
+    scratch sc;
     if(iter != s_->c1.end())
-        return fetch(h, key, iter->second, callback, ec);
-    genlock<gentex> g{g_};
+        return fetch(h, key, iter->second, callback, sc, ec);
+    auto const mv = s_->km.view();
     m.unlock();
-    buffer buf{s_->kh.block_size};
-    // b constructs from uninitialized buf
-    bucket b{s_->kh.block_size, buf.get()};
-    b.read(s_->kf, (n + 1) * b.block_size(), ec);
+    auto& buf = sc[0];
+    buf.reserve(s_->kh.block_size, file_alignment(s_->kf));
+    auto const b = read_bucket(n, mv, buf.get(), true, ec);
     if(ec)
         return;
-    fetch(h, key, b, callback, ec);
+    fetch(h, key, b, callback, sc, ec);
 }
 
 template<class Hasher, class File>
-void
+std::size_t
 basic_store<Hasher, File>::
-insert(
+fetch(
     void const* key,
-    void const* data,
-    nsize_t size,
+    void* buffer,
+    std::size_t size,
     error_code& ec)
 {
     using namespace detail;
-    using namespace std::chrono;
     BOOST_ASSERT(is_open());
     if(ecb_)
     {
         ec = ec_;
-        return;
+        return 0;
     }
-    // Data Record
-    BOOST_ASSERT(size > 0);                     // zero disallowed
-    BOOST_ASSERT(size <= field<uint32_t>::max); // too large
     auto const h =
         hash(key, s_->kh.key_size, s_->hasher);
-    std::lock_guard<std::mutex> u{u_};
+    shared_lock_type m{m_};
     {
-        shared_lock_type m{m_};
-        if(s_->p1.find(key) != s_->p1.end() ||
-           s_->p0.find(key) != s_->p0.end())
+        auto iter = s_->p1.find(h, key);
+        if(iter == s_->p1.end())
         {
-            ec = error::key_exists;
-            return;
+            iter = s_->p0.find(h, key);
+            if(iter == s_->p0.end())
+                goto cont;
         }
-        auto const n = bucket_index(h, buckets_, modulus_);
-        auto const iter = s_->c1.find(n);
-        if(iter != s_->c1.end())
+        if(iter->first.size <= size)
+            std::memcpy(buffer,
+                iter->first.data, iter->first.size);
+        return iter->first.size;
+    }
+cont:
+    if(! s_->bf.may_contain(h))
+    {
+        ec = error::key_not_found;
+        return 0;
+    }
+    auto const n = bucket_index(h, buckets_, modulus_);
+    scratch sc;
+    bucket::value_type item;
+    bool found;
+    genlock<gentex> g{g_};
+    auto const iter = s_->c1.find(n);
+    if(iter != s_->c1.end())
+    {
+        found = exists(h, key, &m, iter->second, &item, sc, ec);
+    }
+    else
+    {
+        auto const mv = s_->km.view();
+        m.unlock();
+        auto& buf = sc[0];
+        buf.reserve(s_->kh.block_size, file_alignment(s_->kf));
+        auto const b = read_bucket(n, mv, buf.get(), true, ec);
+        if(ec)
+            return 0;
+        found = exists(h, key, nullptr, b, &item, sc, ec);
+    }
+    if(ec)
+        return 0;
+    if(! found)
+    {
+        ec = error::key_not_found;
+        return 0;
+    }
+    if(item.size <= size)
+    {
+        // Data Record
+        s_->df.read(item.offset +
+            field<uint48_t>::size +     // Size
+            s_->kh.key_size,            // Key
+            buffer, item.size, ec);
+        if(ec)
+            return 0;
+    }
+    return item.size;
+}
+
+template<class Hasher, class File>
+template<class Callback>
+void
+basic_store<Hasher, File>::
+fetch_batch(
+    void const* const* keys,
+    std::size_t count,
+    Callback&& callback,
+    error_code& ec)
+{
+    using namespace detail;
+    BOOST_ASSERT(is_open());
+    if(ecb_)
+    {
+        ec = ec_;
+        return;
+    }
+    auto const key_size = s_->kh.key_size;
+    std::vector<batch_probe> probes;
+    probes.reserve(count);
+    for(std::size_t i = 0; i < count; ++i)
+        probes.push_back({hash(keys[i], key_size, s_->hasher), 0, i});
+    shared_lock_type m{m_};
+    auto const block_size = s_->kh.block_size;
+    {
+        auto last = probes.begin();
+        for(auto& p : probes)
         {
-            auto const found = exists(
-                h, key, &m, iter->second, ec);
-            if(ec)
-                return;
-            if(found)
+            auto iter = s_->p1.find(p.h, keys[p.i]);
+            if(iter == s_->p1.end())
             {
-                ec = error::key_exists;
-                return;
+                iter = s_->p0.find(p.h, keys[p.i]);
+                if(iter == s_->p0.end())
+                {
+                    if(! s_->bf.may_contain(p.h))
+                        continue;
+                    p.n = bucket_index(p.h, buckets_, modulus_);
+                    *last++ = p;
+                    continue;
+                }
             }
-            // m is now unlocked
+            callback(p.i, iter->first.data, iter->first.size);
         }
-        else
+        probes.erase(last, probes.end());
+    }
+    if(probes.empty())
+        return;
+    std::vector<batch_candidate> candidates;
+    find_batch(probes, candidates, m, ec);
+    if(ec)
+        return;
+    if(candidates.empty())
+        return;
+    std::sort(candidates.begin(), candidates.end(),
+        [](batch_candidate const& lhs, batch_candidate const& rhs)
         {
-            // VFALCO Audit for concurrency
-            genlock<gentex> g{g_};
-            m.unlock();
-            buffer buf;
-            buf.reserve(s_->kh.block_size);
-            bucket b{s_->kh.block_size, buf.get()};
-            b.read(s_->kf,
-                   static_cast<noff_t>(n + 1) * s_->kh.block_size, ec);
-            if(ec)
-                return;
-            auto const found = exists(h, key, nullptr, b, ec);
-            if(ec)
-                return;
-            if(found)
+            return lhs.offset < rhs.offset;
+        });
+    // Read the data records in file order, merging
+    // records which lie close together into one read.
+    std::vector<bool> found(count, false);
+    buffer buf;
+    auto const span =
+        [&](batch_candidate const& c)
+        {
+            return static_cast<noff_t>(
+                field<uint48_t>::size + key_size + c.size);
+        };
+    for(auto first = candidates.begin(); first != candidates.end();)
+    {
+        auto const start = first->offset;
+        auto end = start + span(*first);
+        auto last = first + 1;
+        while(last != candidates.end() &&
+            last->offset <= end + block_size &&
+            last->offset + span(*last) - start <= dataReadSize_)
+        {
+            end = (std::max)(end, last->offset + span(*last));
+            ++last;
+        }
+        auto const len = static_cast<std::size_t>(end - start);
+        buf.reserve(len);
+        s_->df.read(start, buf.get(), len, ec);
+        if(ec)
+            return;
+        for(auto c = first; c != last; ++c)
+        {
+            if(found[c->i])
+                continue;
+            auto const p = buf.get() +
+                (c->offset - start) + field<uint48_t>::size;
+            if(std::memcmp(p, keys[c->i], key_size) == 0)
             {
-                ec = error::key_exists;
-                return;
+                found[c->i] = true;
+                callback(c->i, p + key_size, c->size);
             }
         }
+        first = last;
     }
-    // Perform insert
-    unique_lock_type m{m_};
-    s_->p1.insert(h, key, data, size);
-    auto const now = clock_type::now();
-    auto const elapsed = duration_cast<duration<float>>(
-        now > s_->when ? now - s_->when : clock_type::duration{1});
-    auto const work = s_->p1.data_size() +
-        3 * s_->p1.size() * s_->kh.block_size;
-    auto const rate = static_cast<std::size_t>(
-        std::ceil(work / elapsed.count()));
-    auto const sleep =
-        s_->rate && rate > s_->rate && work > s_->burst;
-    m.unlock();
-
-    // The caller of insert must be blocked when the rate of insertion
-    // (measured in approximate bytes per second) exceeds the maximum rate
-    // that can be flushed and a burst of data is already in memory.
-    // The precise sleep duration is not important.
-    if(sleep)
-        std::this_thread::sleep_for(milliseconds{25});
 }
 
-// Fetch key in loaded bucket b or its spills.
+// Walk the buckets of the keys of a batch, which
+// must not be empty, collecting the entries whose hash
+// matches a key. The lock m is released.
 //
 template<class Hasher, class File>
-template<class Callback>
 void
 basic_store<Hasher, File>::
-fetch(
-    detail::nhash_t h,
-    void const* key,
-    detail::bucket b,
-    Callback&& callback,
+find_batch(
+    std::vector<batch_probe>& probes,
+    std::vector<batch_candidate>& candidates,
+    detail::shared_lock_type& m,
     error_code& ec)
 {
     using namespace detail;
-    buffer buf0;
+    auto const block_size = s_->kh.block_size;
+    std::sort(probes.begin(), probes.end(),
+        [](batch_probe const& lhs, batch_probe const& rhs)
+        {
+            return lhs.n < rhs.n ||
+                (lhs.n == rhs.n && lhs.h < rhs.h);
+        });
+    // Buckets still held in the cache are copied
+    // out, the rest are read after the lock is released.
+    std::vector<std::pair<nbuck_t, std::size_t>> cached;
+    buffer cbuf;
+    for(std::size_t j = 0; j < probes.size(); ++j)
+    {
+        if(j > 0 && probes[j].n == probes[j - 1].n)
+            continue;
+        auto const iter = s_->c1.find(probes[j].n);
+        if(iter == s_->c1.end())
+            continue;
+        if(cached.empty())
+            cbuf.reserve(block_size * probes.size());
+        iter->second.copy(
+            cbuf.get() + cached.size() * block_size);
+        cached.emplace_back(probes[j].n, cached.size());
+    }
+    genlock<gentex> g{g_};
+    auto const mv = s_->km.view();
+    m.unlock();
+    // Walk each distinct bucket and its spills once,
+    // collecting the entries whose hash matches a key.
+    buffer buf0{block_size, file_alignment(s_->kf)};
     buffer buf1;
-    for(;;)
+    auto next = cached.begin();
+    for(auto first = probes.begin(); first != probes.end();)
     {
-        for(auto i = b.lower_bound(h); i < b.size(); ++i)
+        auto const n = first->n;
+        auto last = first;
+        while(last != probes.end() && last->n == n)
+            ++last;
+        bucket b;
+        while(next != cached.end() && next->first < n)
+            ++next;
+        if(next != cached.end() && next->first == n)
         {
-            auto const item = b[i];
-            if(item.hash != h)
-                break;
-            // Data Record
-            auto const len =
-                s_->kh.key_size +       // Key
-                item.size;              // Value
-            buf0.reserve(len);
-            s_->df.read(item.offset +
-                field<uint48_t>::size,  // Size
-                    buf0.get(), len, ec);
+            b = bucket{block_size, cbuf.get() +
+                next->second * block_size, s_->kh.version};
+        }
+        else
+        {
+            b = read_bucket(n, mv, buf0.get(), true, ec);
             if(ec)
                 return;
-            if(std::memcmp(buf0.get(), key,
-                s_->kh.key_size) == 0)
+        }
+        for(;;)
+        {
+            for(auto p = first; p != last; ++p)
             {
-                callback(
-                    buf0.get() + s_->kh.key_size, item.size);
+                for(auto i = b.lower_bound(p->h); i < b.size(); ++i)
+                {
+                    auto const item = b[i];
+                    if(item.hash != p->h)
+                        break;
+                    candidates.push_back({item.offset, item.size, p->i});
+                }
+            }
+            auto const spill = b.spill();
+            if(! spill)
+                break;
+            buf1.reserve(block_size);
+            b = bucket{block_size, buf1.get(), s_->kh.version};
+            b.read(s_->df, spill, ec);
+            if(ec)
+                return;
+        }
+        first = last;
+    }
+    g.unlock();
+}
+
+// State of one asynchronous fetch, shared by
+// the handlers of the reads it has queued.
+//
+template<class Hasher, class File>
+struct basic_store<Hasher, File>::fetch_op
+{
+    std::function<void(
+        error_code const&, void const*, std::size_t)> handler;
+    detail::nhash_t h;
+    nsize_t block_size = 0;
+    detail::buffer key;
+    detail::buffer bbuf;            // bucket or spill record
+    detail::buffer dbuf;            // key and value
+    detail::bucket b;
+    nkey_t i = 0;                   // next entry in b
+    error_code ec;
+    void const* value = nullptr;
+    std::size_t size = 0;
+    std::size_t kgen = 0;           // kgen_ when the bucket was read
+};
+
+template<class Hasher, class File>
+template<class Handler>
+void
+basic_store<Hasher, File>::
+async_fetch(void const* key, Handler&& handler)
+{
+    using namespace detail;
+    BOOST_ASSERT(is_open());
+    auto const op = std::make_shared<fetch_op>();
+    op->handler = std::forward<Handler>(handler);
+    ++outstanding_;
+    if(ecb_)
+        return async_complete(op, ec_);
+    auto const key_size = s_->kh.key_size;
+    op->key.reserve(key_size);
+    std::memcpy(op->key.get(), key, key_size);
+    op->h = hash(key, key_size, s_->hasher);
+    async_lookup(op);
+}
+
+// Find the bucket for the key of op, and queue the
+// read of the bucket from the key file if needed.
+//
+template<class Hasher, class File>
+void
+basic_store<Hasher, File>::
+async_lookup(std::shared_ptr<fetch_op> const& op)
+{
+    using namespace detail;
+    auto const key = op->key.get();
+    shared_lock_type m{m_};
+    // The key file is replaced by rekey under the lock
+    auto const block_size = s_->kh.block_size;
+    op->block_size = block_size;
+    {
+        auto iter = s_->p1.find(op->h, key);
+        if(iter == s_->p1.end())
+        {
+            iter = s_->p0.find(op->h, key);
+            if(iter == s_->p0.end())
+                goto cont;
+        }
+        op->dbuf.reserve(iter->first.size);
+        std::memcpy(op->dbuf.get(),
+            iter->first.data, iter->first.size);
+        m.unlock();
+        op->value = op->dbuf.get();
+        op->size = iter->first.size;
+        return async_complete(op, {});
+    }
+cont:
+    if(! s_->bf.may_contain(op->h))
+    {
+        m.unlock();
+        return async_complete(op, error::key_not_found);
+    }
+    auto const n = bucket_index(op->h, buckets_, modulus_);
+    op->bbuf.reserve(block_size, file_alignment(s_->kf));
+    auto const iter = s_->c1.find(n);
+    if(iter != s_->c1.end())
+    {
+        iter->second.copy(op->bbuf.get());
+        m.unlock();
+        op->b = bucket{block_size, op->bbuf.get(), s_->kh.version};
+        return async_bucket(op);
+    }
+    auto const offset = static_cast<noff_t>(n + 1) * block_size;
+    {
+        // Held until the bucket is copied out, but never
+        // while a read waits for the application to poll.
+        genlock<gentex> g{g_};
+        auto const mv = s_->km.view();
+        if(auto const p = mv.data(offset, block_size))
+        {
+            m.unlock();
+            std::memcpy(op->bbuf.get(), p, block_size);
+        }
+        else if(s_->bc.find(n, op->bbuf.get()))
+        {
+            m.unlock();
+        }
+        else if(kswap_)
+        {
+            // The key file is about to be closed
+            m.unlock();
+            error_code ec;
+            bucket b{block_size, op->bbuf.get(), s_->kh.version};
+            b.read_block(s_->kf, offset, ec);
+            if(ec)
+                return async_complete(op, ec);
+            s_->bc.insert(n, b);
+        }
+        else
+        {
+            op->kgen = kgen_.load();
+            ++kreads_;
+            m.unlock();
+            g.unlock();
+            return async_read(s_->kf, offset, op->bbuf.get(),
+                bucket_size(bucket_capacity(block_size,
+                    s_->kh.version), s_->kh.version),
+                [this, op, n](error_code const& ec)
+                {
+                    if(ec)
+                    {
+                        --kreads_;
+                        return async_complete(op, ec);
+                    }
+                    bool current;
+                    {
+                        // A commit which started before this lock
+                        // waits for it before updating the cache.
+                        genlock<gentex> g{g_};
+                        current = kgen_.load() == op->kgen;
+                        if(current)
+                        {
+                            op->b = bucket{op->block_size,
+                                op->bbuf.get(), s_->kh.version};
+                            if(op->b.size() <= bucket_capacity(
+                                    op->block_size, s_->kh.version))
+                                s_->bc.insert(n, op->b);
+                        }
+                    }
+                    --kreads_;
+                    // A commit may have rewritten the bucket
+                    if(! current)
+                        return async_lookup(op);
+                    if(op->b.size() > bucket_capacity(
+                            op->block_size, s_->kh.version))
+                        return async_complete(
+                            op, error::invalid_bucket_size);
+                    async_bucket(op);
+                }, 0);
+        }
+    }
+    op->b = bucket{block_size, op->bbuf.get(), s_->kh.version};
+    if(op->b.size() > bucket_capacity(block_size, s_->kh.version))
+        return async_complete(op, error::invalid_bucket_size);
+    async_bucket(op);
+}
+
+template<class Hasher, class File>
+std::size_t
+basic_store<Hasher, File>::
+poll()
+{
+    using namespace detail;
+    BOOST_ASSERT(is_open());
+    poll_file(s_->kf, 0);
+    poll_file(s_->df, 0);
+    std::vector<std::function<void()>> v;
+    {
+        std::lock_guard<std::mutex> lock{rm_};
+        v.swap(ready_);
+    }
+    for(auto const& f : v)
+    {
+        --outstanding_;
+        f();
+    }
+    return v.size();
+}
+
+template<class Hasher, class File>
+std::size_t
+basic_store<Hasher, File>::
+run_one()
+{
+    using namespace detail;
+    BOOST_ASSERT(is_open());
+    for(;;)
+    {
+        auto const n = poll();
+        if(n > 0 || outstanding_.load() == 0)
+            return n;
+        // Returns at once if the file has nothing in flight
+        if(run_one_file(s_->kf, 0) == 0 &&
+                run_one_file(s_->df, 0) == 0)
+            std::this_thread::yield();
+    }
+}
+
+// Complete the reads of outstanding fetches, so that
+// the files can be closed. The handlers are not invoked.
+//
+template<class Hasher, class File>
+void
+basic_store<Hasher, File>::
+finish_reads()
+{
+    using namespace detail;
+    for(;;)
+    {
+        {
+            std::lock_guard<std::mutex> lock{rm_};
+            if(outstanding_.load() == ready_.size())
+                return;
+        }
+        if(run_one_file(s_->kf, 0) == 0 &&
+                run_one_file(s_->df, 0) == 0)
+            std::this_thread::yield();
+    }
+}
+
+template<class Hasher, class File>
+void
+basic_store<Hasher, File>::
+insert(
+    void const* key,
+    void const* data,
+    nsize_t size,
+    error_code& ec)
+{
+    using namespace detail;
+    BOOST_ASSERT(is_open());
+    if(ecb_)
+    {
+        ec = ec_;
+        return;
+    }
+    if(read_only_)
+    {
+        ec = error::read_only;
+        return;
+    }
+    // Data Record
+    BOOST_ASSERT(size > 0);                     // zero disallowed
+    BOOST_ASSERT(size <= field<uint32_t>::max); // too large
+    auto const h =
+        hash(key, s_->kh.key_size, s_->hasher);
+    // Equal keys always map to the same stripe, so
+    // the check for duplicates below cannot race.
+    std::lock_guard<std::mutex> u{u_[h % insert_stripes]};
+    {
+        shared_lock_type m{m_};
+        if(s_->p1.find(h, key) != s_->p1.end() ||
+           s_->p0.find(h, key) != s_->p0.end())
+        {
+            ec = error::key_exists;
+            return;
+        }
+        // A key the filter rules out is not in the key file
+        if(! s_->bf.may_contain(h))
+            goto cont;
+        auto const n = bucket_index(h, buckets_, modulus_);
+        genlock<gentex> g{g_};
+        auto const iter = s_->c1.find(n);
+        scratch sc;
+        if(iter != s_->c1.end())
+        {
+            auto const found = exists(
+                h, key, &m, iter->second, nullptr, sc, ec);
+            if(ec)
+                return;
+            if(found)
+            {
+                ec = error::key_exists;
+                return;
+            }
+            // m is now unlocked
+        }
+        else
+        {
+            // VFALCO Audit for concurrency
+            auto const mv = s_->km.view();
+            m.unlock();
+            auto& buf = sc[0];
+            buf.reserve(s_->kh.block_size, file_alignment(s_->kf));
+            auto const b = read_bucket(n, mv, buf.get(), true, ec);
+            if(ec)
+                return;
+            auto const found = exists(
+                h, key, nullptr, b, nullptr, sc, ec);
+            if(ec)
+                return;
+            if(found)
+            {
+                ec = error::key_exists;
+                return;
+            }
+        }
+    }
+cont:
+    // Perform insert
+    unique_lock_type m{m_};
+    s_->p1.insert(h, key, data, size);
+    throttle(m);
+}
+
+template<class Hasher, class File>
+void
+basic_store<Hasher, File>::
+insert_unchecked(
+    void const* key,
+    void const* data,
+    nsize_t size,
+    error_code& ec)
+{
+    using namespace detail;
+    BOOST_ASSERT(is_open());
+    if(ecb_)
+    {
+        ec = ec_;
+        return;
+    }
+    if(read_only_)
+    {
+        ec = error::read_only;
+        return;
+    }
+    // Data Record
+    BOOST_ASSERT(size > 0);                     // zero disallowed
+    BOOST_ASSERT(size <= field<uint32_t>::max); // too large
+    auto const h =
+        hash(key, s_->kh.key_size, s_->hasher);
+    std::lock_guard<std::mutex> u{u_[h % insert_stripes]};
+    // The pools are checked and
+    // the value inserted under one lock.
+    unique_lock_type m{m_};
+    if(s_->p1.find(h, key) != s_->p1.end() ||
+       s_->p0.find(h, key) != s_->p0.end())
+    {
+        ec = error::key_exists;
+        return;
+    }
+    s_->p1.insert(h, key, data, size);
+    throttle(m);
+}
+
+template<class Hasher, class File>
+void
+basic_store<Hasher, File>::
+insert_batch(
+    item_type const* items,
+    std::size_t count,
+    error_code* results,
+    error_code& ec)
+{
+    using namespace detail;
+    BOOST_ASSERT(is_open());
+    if(ecb_)
+    {
+        ec = ec_;
+        return;
+    }
+    if(read_only_)
+    {
+        ec = error::read_only;
+        return;
+    }
+    if(count == 0)
+        return;
+    auto const key_size = s_->kh.key_size;
+    std::vector<nhash_t> hashes;
+    std::vector<batch_probe> probes;
+    hashes.reserve(count);
+    probes.reserve(count);
+    for(std::size_t i = 0; i < count; ++i)
+    {
+        // Data Record
+        BOOST_ASSERT(items[i].size > 0);                    // zero disallowed
+        BOOST_ASSERT(items[i].size <= field<uint32_t>::max);// too large
+        results[i] = {};
+        hashes.push_back(hash(items[i].key, key_size, s_->hasher));
+        probes.push_back({hashes.back(), 0, i});
+    }
+    // Keys which are equal within the batch
+    // are found next to each other.
+    std::sort(probes.begin(), probes.end(),
+        [](batch_probe const& lhs, batch_probe const& rhs)
+        {
+            return lhs.h < rhs.h ||
+                (lhs.h == rhs.h && lhs.i < rhs.i);
+        });
+    for(auto p = probes.begin(); p != probes.end(); ++p)
+    {
+        for(auto q = p + 1; q != probes.end() && q->h == p->h; ++q)
+        {
+            if(! results[q->i] && std::memcmp(items[p->i].key,
+                    items[q->i].key, key_size) == 0)
+                results[q->i] = error::key_exists;
+        }
+    }
+    // Each stripe the batch needs is locked once,
+    // in index order so batches cannot deadlock.
+    std::bitset<insert_stripes> stripes;
+    for(auto const& p : probes)
+        stripes.set(p.h % insert_stripes);
+    std::vector<std::unique_lock<std::mutex>> u;
+    u.reserve(stripes.count());
+    for(std::size_t i = 0; i < insert_stripes; ++i)
+        if(stripes.test(i))
+            u.emplace_back(u_[i]);
+    {
+        shared_lock_type m{m_};
+        auto last = probes.begin();
+        for(auto& p : probes)
+        {
+            if(results[p.i])
+                continue;
+            auto const key = items[p.i].key;
+            if(s_->p1.find(p.h, key) != s_->p1.end() ||
+               s_->p0.find(p.h, key) != s_->p0.end())
+            {
+                results[p.i] = error::key_exists;
+                continue;
+            }
+            // A key the filter rules out is not in the key file
+            if(! s_->bf.may_contain(p.h))
+                continue;
+            p.n = bucket_index(p.h, buckets_, modulus_);
+            *last++ = p;
+        }
+        probes.erase(last, probes.end());
+        if(! probes.empty())
+        {
+            std::vector<batch_candidate> candidates;
+            find_batch(probes, candidates, m, ec);
+            if(ec)
+                return;
+            std::sort(candidates.begin(), candidates.end(),
+                [](batch_candidate const& lhs,
+                    batch_candidate const& rhs)
+                {
+                    return lhs.offset < rhs.offset;
+                });
+            scratch sc;
+            auto& buf = sc[0];
+            buf.reserve(key_size);
+            for(auto const& c : candidates)
+            {
+                if(results[c.i])
+                    continue;
+                // Data Record
+                s_->df.read(c.offset +
+                    field<uint48_t>::size,          // Size
+                    buf.get(), key_size, ec);       // Key
+                if(ec)
+                    return;
+                if(std::memcmp(buf.get(),
+                        items[c.i].key, key_size) == 0)
+                    results[c.i] = error::key_exists;
+            }
+        }
+    }
+    // Perform insert
+    unique_lock_type m{m_};
+    for(std::size_t i = 0; i < count; ++i)
+    {
+        if(results[i])
+            continue;
+        s_->p1.insert(hashes[i],
+            items[i].key, items[i].data, items[i].size);
+    }
+    u.clear();
+    throttle(m);
+}
+
+// Called after values are added to p1 with m
+// held. Requests an early flush if needed, and
+// blocks the caller when inserts outpace flushing.
+//
+template<class Hasher, class File>
+void
+basic_store<Hasher, File>::
+throttle(detail::unique_lock_type& m)
+{
+    using namespace std::chrono;
+    auto const now = clock_type::now();
+    auto const elapsed = duration_cast<duration<float>>(
+        now > s_->when ? now - s_->when : clock_type::duration{1});
+    auto const work = s_->p1.data_size() +
+        3 * s_->p1.size() * s_->kh.block_size;
+    auto const rate = static_cast<std::size_t>(
+        std::ceil(work / elapsed.count()));
+    auto const sleep =
+        s_->rate && rate > s_->rate && work > s_->burst;
+    auto const request = ! s_->requested && (
+        (s_->flush_bytes && s_->p1.data_size() >= s_->flush_bytes) ||
+        (s_->flush_items && s_->p1.size() >= s_->flush_items));
+    if(request)
+        s_->requested = true;
+    pending_.store(work);
+    m.unlock();
+    if(request)
+        ctx_->request_flush(*this);
+
+    // The caller of insert must be blocked when the rate of insertion
+    // (measured in approximate bytes per second) exceeds the maximum rate
+    // that can be flushed and a burst of data is already in memory.
+    // The precise sleep duration is not important.
+    if(sleep)
+        std::this_thread::sleep_for(milliseconds{25});
+}
+
+// Fetch key in loaded bucket b or its spills.
+//
+template<class Hasher, class File>
+template<class Callback>
+void
+basic_store<Hasher, File>::
+fetch(
+    detail::nhash_t h,
+    void const* key,
+    detail::bucket b,
+    Callback&& callback,
+    detail::scratch& sc,
+    error_code& ec)
+{
+    using namespace detail;
+    auto& buf0 = sc[1];
+    auto& buf1 = sc[2];
+    for(;;)
+    {
+        for(auto i = b.lower_bound(h); i < b.size(); ++i)
+        {
+            auto const item = b[i];
+            if(item.hash != h)
+                break;
+            // Data Record
+            auto const len =
+                s_->kh.key_size +       // Key
+                item.size;              // Value
+            buf0.reserve(len);
+            s_->df.read(item.offset +
+                field<uint48_t>::size,  // Size
+                    buf0.get(), len, ec);
+            if(ec)
+                return;
+            if(std::memcmp(buf0.get(), key,
+                s_->kh.key_size) == 0)
+            {
+                callback(
+                    buf0.get() + s_->kh.key_size, item.size);
+                return;
+            }
+        }
+        auto const spill = b.spill();
+        if(! spill)
+            break;
+        buf1.reserve(s_->kh.block_size);
+        b = bucket(s_->kh.block_size,
+            buf1.get(), s_->kh.version);
+        b.read(s_->df, spill, ec);
+        if(ec)
+            return;
+    }
+    ec = error::key_not_found;
+}
+
+// Scan the bucket in op->b for the key
+//
+template<class Hasher, class File>
+void
+basic_store<Hasher, File>::
+async_bucket(std::shared_ptr<fetch_op> const& op)
+{
+    op->i = op->b.lower_bound(op->h);
+    async_scan(op);
+}
+
+// Read the next data record with a matching hash,
+// or move on to the spill record when there are none.
+//
+template<class Hasher, class File>
+void
+basic_store<Hasher, File>::
+async_scan(std::shared_ptr<fetch_op> const& op)
+{
+    using namespace detail;
+    if(op->i >= op->b.size())
+        return async_spill(op);
+    auto const item = op->b[op->i];
+    if(item.hash != op->h)
+        return async_spill(op);
+    ++op->i;
+    // Data Record
+    auto const len =
+        s_->kh.key_size +       // Key
+        item.size;              // Value
+    op->dbuf.reserve(len);
+    op->size = item.size;
+    async_read(s_->df, item.offset +
+        field<uint48_t>::size,  // Size
+            op->dbuf.get(), len,
+        [this, op](error_code const& ec)
+        {
+            if(ec)
+                return async_complete(op, ec);
+            if(std::memcmp(op->dbuf.get(),
+                op->key.get(), s_->kh.key_size) == 0)
+            {
+                op->value = op->dbuf.get() + s_->kh.key_size;
+                return async_complete(op, {});
+            }
+            async_scan(op);
+        }, 0);
+}
+
+template<class Hasher, class File>
+void
+basic_store<Hasher, File>::
+async_spill(std::shared_ptr<fetch_op> const& op)
+{
+    using namespace detail;
+    auto const spill = op->b.spill();
+    if(! spill)
+        return async_complete(op, error::key_not_found);
+    auto const capacity = bucket_capacity(
+        op->block_size, s_->kh.version);
+    // op->b is replaced by the spill record
+    async_read(s_->df, spill, op->bbuf.get(),
+        bucket_size(capacity, s_->kh.version),
+        [this, op, capacity](error_code const& ec)
+        {
+            if(ec)
+                return async_complete(op, ec);
+            op->b = bucket{op->block_size,
+                op->bbuf.get(), s_->kh.version};
+            if(op->b.size() > capacity)
+                return async_complete(
+                    op, error::invalid_bucket_size);
+            async_bucket(op);
+        }, 0);
+}
+
+// Queue the handler for the next call to poll
+//
+template<class Hasher, class File>
+void
+basic_store<Hasher, File>::
+async_complete(std::shared_ptr<fetch_op> const& op,
+    error_code const& ec)
+{
+    op->ec = ec;
+    if(ec)
+    {
+        op->value = nullptr;
+        op->size = 0;
+    }
+    std::lock_guard<std::mutex> lock{rm_};
+    ready_.emplace_back(
+        [op]
+        {
+            op->handler(op->ec, op->value, op->size);
+        });
+}
+
+// Returns `true` if the key exists, and sets
+// match to its entry if match is not null.
+// lock is unlocked after the first bucket processed
+//
+template<class Hasher, class File>
+bool
+basic_store<Hasher, File>::
+exists(
+    detail::nhash_t h,
+    void const* key,
+    detail::shared_lock_type* lock,
+    detail::bucket b,
+    detail::bucket::value_type* match,
+    detail::scratch& sc,
+    error_code& ec)
+{
+    using namespace detail;
+    sc[1].reserve(s_->kh.key_size);
+    sc[2].reserve(s_->kh.block_size);
+    void* pk = sc[1].get();
+    void* pb = sc[2].get();
+    for(;;)
+    {
+        for(auto i = b.lower_bound(h); i < b.size(); ++i)
+        {
+            auto const item = b[i];
+            if(item.hash != h)
+                break;
+            // Data Record
+            s_->df.read(item.offset +
+                field<uint48_t>::size,      // Size
+                pk, s_->kh.key_size, ec);       // Key
+            if(ec)
+                return false;
+            if(std::memcmp(pk, key, s_->kh.key_size) == 0)
+            {
+                if(match)
+                    *match = item;
+                return true;
+            }
+        }
+        auto spill = b.spill();
+        if(lock && lock->owns_lock())
+            lock->unlock();
+        if(! spill)
+            break;
+        b = bucket(s_->kh.block_size, pb, s_->kh.version);
+        b.read(s_->df, spill, ec);
+        if(ec)
+            return false;
+    }
+    return false;
+}
+
+//  Set the burst size
+//
+template<class Hasher, class File>
+void
+basic_store<Hasher, File>::
+set_burst(
+    std::size_t burst_size)
+{
+    detail::unique_lock_type m{m_};
+    s_->burst = burst_size;
+}
+
+template<class Hasher, class File>
+void
+basic_store<Hasher, File>::
+set_commit_threads(
+    std::size_t threads)
+{
+    BOOST_ASSERT(is_open());
+    if(threads == 0)
+        threads = std::max<std::size_t>(1,
+            std::thread::hardware_concurrency());
+    detail::unique_lock_type m{m_};
+    s_->threads = threads;
+}
+
+template<class Hasher, class File>
+void
+basic_store<Hasher, File>::
+set_durability(
+    durability policy)
+{
+    BOOST_ASSERT(is_open());
+    detail::unique_lock_type m{m_};
+    s_->dur = policy;
+}
+
+template<class Hasher, class File>
+void
+basic_store<Hasher, File>::
+set_flush_threshold(
+    std::size_t bytes, std::size_t items)
+{
+    BOOST_ASSERT(is_open());
+    detail::unique_lock_type m{m_};
+    s_->flush_bytes = bytes;
+    s_->flush_items = items;
+}
+
+template<class Hasher, class File>
+void
+basic_store<Hasher, File>::
+set_cache_size(
+    std::size_t bytes)
+{
+    BOOST_ASSERT(is_open());
+    // The cache synchronizes its own members, the lock
+    // keeps rekey from replacing it while it is reset.
+    detail::shared_lock_type m{m_};
+    s_->bc.reset(bytes);
+}
+
+template<class Hasher, class File>
+void
+basic_store<Hasher, File>::
+set_key_file_mapped(
+    bool mapped,
+    error_code& ec)
+{
+    BOOST_ASSERT(is_open());
+    detail::unique_lock_type m{m_};
+    if(mapped == s_->km.is_open())
+        return;
+    if(! mapped)
+    {
+        s_->km.close();
+        return;
+    }
+    // Buckets added by a commit in progress are
+    // not in the file yet, so map only what is.
+    auto const size = s_->kf.size(ec);
+    if(ec)
+        return;
+    s_->km.open(s_->kp, static_cast<std::size_t>(size), ec);
+}
+
+template<class Hasher, class File>
+void
+basic_store<Hasher, File>::
+set_filter(
+    double rate,
+    std::size_t bytes)
+{
+    BOOST_ASSERT(! is_open());
+    BOOST_ASSERT(rate >= 0 && rate < 1);
+    filterRate_ = rate;
+    filterBytes_ = bytes;
+}
+
+template<class Hasher, class File>
+template<class Progress, class... Args>
+void
+basic_store<Hasher, File>::
+rekey(
+    std::size_t blockSize,
+    float loadFactor,
+    std::size_t bufferSize,
+    std::size_t threads,
+    error_code& ec,
+    Progress&& progress,
+    Args&&... args)
+{
+    static_assert(is_Progress<Progress>::value,
+        "Progress requirements not met");
+    using namespace detail;
+    BOOST_ASSERT(is_open());
+    if(ecb_)
+    {
+        ec = ec_;
+        return;
+    }
+    if(read_only_)
+    {
+        ec = error::read_only;
+        return;
+    }
+    if(blockSize > field<std::uint16_t>::max)
+    {
+        ec = error::invalid_block_size;
+        return;
+    }
+    if(loadFactor <= 0.f || loadFactor >= 1.f)
+    {
+        ec = error::invalid_load_factor;
+        return;
+    }
+    std::lock_guard<std::mutex> rk{rk_};
+    // The salt is kept, so the hashes held
+    // in the pools and the filter stay valid.
+    auto kh = s_->kh;
+    kh.block_size = static_cast<nsize_t>(blockSize);
+    kh.capacity = bucket_capacity(kh.block_size, kh.version);
+    if(kh.capacity < 1)
+    {
+        ec = error::invalid_block_size;
+        return;
+    }
+    kh.load_factor = std::min<std::size_t>(
+        static_cast<std::size_t>(65536.0f * loadFactor), 65535);
+    {
+        shared_lock_type m{m_};
+        // Each split follows thresh_ / 65536 inserts
+        auto const items =
+            static_cast<double>(buckets_) * thresh_ / 65536;
+        kh.buckets = std::max<nbuck_t>(1, static_cast<nbuck_t>(
+            std::ceil(items / (kh.capacity * loadFactor))));
+    }
+    kh.modulus = ceil_pow2(kh.buckets);
+    auto const readSize = 1024 * nudb::block_size(s_->dp);
+    auto const writeSize = 16 * nudb::block_size(s_->kp);
+    dat_file_header dh;
+    read(s_->df, dh, ec);
+    if(ec)
+        return;
+    // Records below this size are built
+    // into the new key file by the scan.
+    noff_t dataFileSize;
+    {
+        std::lock_guard<std::mutex> cm{cm_};
+        dataFileSize = s_->df.size(ec);
+        if(ec)
+            return;
+    }
+
+    auto const path = s_->kp + ".rekey";
+    File kf{args...};
+    kf.create(file_mode::write, path, ec);
+    if(ec)
+        return;
+    // The new key file is removed on every path
+    // out, unless it replaced the key file.
+    struct cleanup
+    {
+        File& kf;
+        path_type const& path;
+
+        ~cleanup()
+        {
+            kf.close();
+            error_code ec;
+            File::erase(path, ec);
+        }
+    };
+    cleanup c{kf, path};
+    {
+        // Write key file header
+        buffer buf{kh.block_size, file_alignment(kf)};
+        std::memset(buf.get(), 0, kh.block_size);
+        ostream os{buf.get(), kh.block_size};
+        write(os, kh);
+        kf.write(0, buf.get(), kh.block_size, ec);
+        if(ec)
+            return;
+        // Pre-allocate space for the entire key file
+        std::uint8_t zero = 0;
+        kf.write(
+            static_cast<noff_t>(kh.buckets + 1) * kh.block_size - 1,
+                &zero, 1, ec);
+        if(ec)
+            return;
+    }
+
+    // Spill records are appended between commits,
+    // so that they never interleave with commit data.
+    auto const spill =
+        [this](bucket& b, error_code& ec1)
+        {
+            std::lock_guard<std::mutex> cm{cm_};
+            rekey_spill(b, ec1);
+        };
+    if(threads == 0)
+        threads = std::max<std::size_t>(1,
+            std::thread::hardware_concurrency());
+    auto chunkSize = std::max<std::size_t>(1,
+        bufferSize / (threads * kh.block_size));
+    chunkSize = static_cast<std::size_t>(std::min<nbuck_t>(
+        chunkSize, (kh.buckets + threads - 1) / threads));
+    rekey_partitioned<Hasher>(s_->df, kf, dh, kh, dataFileSize,
+        path, chunkSize, threads, readSize, writeSize,
+            spill, ec, progress, args...);
+    if(ec)
+        return;
+
+    // Add the records committed during the scan, until
+    // what remains is small enough to add while commits
+    // are held back.
+    auto first = dataFileSize;
+    for(int i = 0; i < 4; ++i)
+    {
+        noff_t last;
+        {
+            std::lock_guard<std::mutex> cm{cm_};
+            last = s_->df.size(ec);
+            if(ec)
+                return;
+        }
+        if(last - first <= readSize)
+            break;
+        rekey_catch_up(kf, kh, first, last, readSize, spill, ec);
+        if(ec)
+            return;
+        first = last;
+    }
+    std::lock_guard<std::mutex> cm{cm_};
+    if(ecb_)
+    {
+        ec = ec_;
+        return;
+    }
+    auto const last = s_->df.size(ec);
+    if(ec)
+        return;
+    rekey_catch_up(kf, kh, first, last, readSize,
+        [this](bucket& b, error_code& ec1)
+        {
+            rekey_spill(b, ec1);
+        }, ec);
+    if(ec)
+        return;
+    rekey_swap(kf, kh, path, ec);
+}
+
+//  Insert the data records in [first, last) of the data
+//  file into the new key file kf. Spill records are skipped,
+//  and buckets which fill up are passed to spill.
+//
+template<class Hasher, class File>
+template<class Spill>
+void
+basic_store<Hasher, File>::
+rekey_catch_up(
+    File& kf,
+    detail::key_file_header const& kh,
+    noff_t first,
+    noff_t last,
+    std::size_t readSize,
+    Spill&& spill,
+    error_code& ec)
+{
+    using namespace detail;
+    if(first >= last)
+        return;
+    cache c{kh.key_size, kh.block_size, kh.version, "rekey"};
+    buffer buf{kh.block_size, file_alignment(kf)};
+    bulk_reader<File> r{s_->df, first, last, readSize};
+    while(! r.eof())
+    {
+        auto const offset = r.offset();
+        // Data Record or Spill Record
+        nsize_t size;
+        auto is = r.prepare(
+            field<uint48_t>::size, ec); // Size
+        if(ec)
+            return;
+        read_size48(is, size);
+        if(size > 0)
+        {
+            // Data Record
+            is = r.prepare(
+                kh.key_size +           // Key
+                size, ec);              // Data
+            if(ec)
+                return;
+            auto const h = hash(
+                is.data(kh.key_size), kh.key_size, s_->hasher);
+            auto const n = bucket_index(h, kh.buckets, kh.modulus);
+            auto iter = c.find(n);
+            if(iter == c.end())
+            {
+                bucket tmp{kh.block_size, buf.get(), kh.version};
+                tmp.read_block(kf,
+                    static_cast<noff_t>(n + 1) * kh.block_size, ec);
+                if(ec)
+                    return;
+                iter = c.insert(n, tmp);
+            }
+            auto b = iter->second;
+            if(b.full())
+            {
+                spill(b, ec);
+                if(ec)
+                    return;
+            }
+            b.insert(offset, size, h);
+        }
+        else
+        {
+            // Spill Record
+            is = r.prepare(
+                field<std::uint16_t>::size, ec);
+            if(ec)
+                return;
+            read<std::uint16_t>(is, size);  // Size
+            r.prepare(size, ec); // skip
+            if(ec)
                 return;
-            }
         }
-        auto const spill = b.spill();
-        if(! spill)
-            break;
-        buf1.reserve(s_->kh.block_size);
-        b = bucket(s_->kh.block_size,
-            buf1.get());
-        b.read(s_->df, spill, ec);
+    }
+    for(auto const e : c)
+    {
+        e.second.write(kf, static_cast<noff_t>(
+            e.first + 1) * kh.block_size, ec);
         if(ec)
             return;
     }
-    ec = error::key_not_found;
 }
 
-// Returns `true` if the key exists
-// lock is unlocked after the first bucket processed
+//  Append a spill record for the full bucket b to the
+//  data file. The caller must hold cm_.
 //
 template<class Hasher, class File>
-bool
+void
 basic_store<Hasher, File>::
-exists(
-    detail::nhash_t h,
-    void const* key,
-    detail::shared_lock_type* lock,
-    detail::bucket b,
-    error_code& ec)
+rekey_spill(detail::bucket& b, error_code& ec)
 {
     using namespace detail;
-    buffer buf{s_->kh.key_size + s_->kh.block_size};
-    void* pk = buf.get();
-    void* pb = buf.get() + s_->kh.key_size;
-    for(;;)
-    {
-        for(auto i = b.lower_bound(h); i < b.size(); ++i)
-        {
-            auto const item = b[i];
-            if(item.hash != h)
-                break;
-            // Data Record
-            s_->df.read(item.offset +
-                field<uint48_t>::size,      // Size
-                pk, s_->kh.key_size, ec);       // Key
-            if(ec)
-                return false;
-            if(std::memcmp(pk, key, s_->kh.key_size) == 0)
-                return true;
-        }
-        auto spill = b.spill();
-        if(lock && lock->owns_lock())
-            lock->unlock();
-        if(! spill)
-            break;
-        b = bucket(s_->kh.block_size, pb);
-        b.read(s_->df, spill, ec);
-        if(ec)
-            return false;
-    }
-    return false;
+    auto const size = s_->df.size(ec);
+    if(ec)
+        return;
+    bulk_writer<File> w{s_->df, size, dataWriteSize_};
+    maybe_spill(b, w, ec);
+    if(ec)
+        return;
+    w.flush(ec);
 }
 
-//  Set the burst size
+//  Replace the key file with the complete key file kf
+//  described by kh. The caller must hold cm_.
 //
 template<class Hasher, class File>
 void
 basic_store<Hasher, File>::
-set_burst(
-    std::size_t burst_size)
+rekey_swap(
+    File& kf,
+    detail::key_file_header const& kh,
+    path_type const& path,
+    error_code& ec)
 {
-    detail::unique_lock_type m{m_};
-    s_->burst = burst_size;
+    using namespace detail;
+    // The new key file refers to spill records,
+    // which must reach the disk before it does.
+    s_->df.sync(ec);
+    if(ec)
+        return;
+    kf.sync(ec);
+    if(ec)
+        return;
+    kf.close();
+    // Complete the queued reads of the key file. Fetches
+    // which start meanwhile read it without queueing.
+    {
+        unique_lock_type m{m_};
+        kswap_ = true;
+    }
+    while(kreads_.load() > 0)
+        if(run_one_file(s_->kf, 0) == 0)
+            std::this_thread::yield();
+    unique_lock_type m{m_};
+    kswap_ = false;
+    // Reads which completed before now are stale
+    ++kgen_;
+    // Wait for the readers of the key file, new readers
+    // wait for the lock. No reader holding the generation
+    // waits for the lock or the application.
+    g_.start();
+    g_.finish();
+    s_->kf.close();
+    rename_file(path, s_->kp, ec);
+    // If the rename failed, this reopens the old key file
+    error_code ec1;
+    s_->kf.open(file_mode::write, s_->kp, ec1);
+    if(ec1)
+    {
+        ec_ = ec1;
+        ecb_.store(true);
+        if(! ec)
+            ec = ec1;
+        return;
+    }
+    if(ec)
+        return;
+    // Fetches and inserts read the other fields of the
+    // header, such as the key size, without the lock.
+    s_->kh.version = kh.version;
+    s_->kh.block_size = kh.block_size;
+    s_->kh.load_factor = kh.load_factor;
+    s_->kh.capacity = kh.capacity;
+    s_->kh.buckets = kh.buckets;
+    s_->kh.modulus = kh.modulus;
+    {
+        cache c1{kh.key_size, kh.block_size, kh.version, "c1"};
+        swap(c1, s_->c1);
+    }
+    auto const bytes = s_->bc.capacity();
+    s_->bc = bucket_cache{kh.block_size, kh.version};
+    s_->bc.reset(bytes);
+    thresh_ = std::max<std::size_t>(65536UL,
+        kh.load_factor * kh.capacity);
+    frac_ = thresh_ / 2;
+    buckets_ = kh.buckets;
+    modulus_ = kh.modulus;
+    if(s_->km.is_open())
+    {
+        // No reader holds a view of the old mapping
+        s_->km.close();
+        s_->km.expire();
+        s_->km.release();
+        // Fetches read the key file if this fails
+        error_code ec2;
+        s_->km.open(s_->kp, static_cast<std::size_t>(
+            kh.buckets + 1) * kh.block_size, ec2);
+    }
 }
 
 //  Split the bucket in b1 to b2
@@ -482,9 +1844,17 @@ split(
     nbuck_t buckets,
     nbuck_t modulus,
     detail::bulk_writer<File>& w,
+    std::mutex* wm,
     error_code& ec)
 {
     using namespace detail;
+    // Locks w, if it is shared with other threads
+    auto const lock =
+        [wm]
+        {
+            return wm ? std::unique_lock<std::mutex>{*wm} :
+                std::unique_lock<std::mutex>{};
+        };
     // Trivial case: split empty bucket
     if(b1.empty())
         return;
@@ -514,12 +1884,16 @@ split(
         {
             // If any part of the spill record is
             // in the write buffer then flush first
-            if(spill + bucket_size(s_->kh.capacity) >
-               w.offset() - w.size())
             {
-                w.flush(ec);
-                if(ec)
-                    return;
+                auto const l = lock();
+                if(spill + bucket_size(
+                        s_->kh.capacity, s_->kh.version) >
+                   w.offset() - w.size())
+                {
+                    w.flush(ec);
+                    if(ec)
+                        return;
+                }
             }
             tmp.read(s_->df, spill, ec);
             if(ec)
@@ -530,25 +1904,223 @@ split(
                 auto const n = bucket_index(
                     e.hash, buckets, modulus);
                 BOOST_ASSERT(n==n1 || n==n2);
-                if(n == n2)
+                auto& b = n == n2 ? b2 : b1;
+                if(b.full())
                 {
-                    maybe_spill(b2, w, ec);
+                    auto const l = lock();
+                    maybe_spill(b, w, ec);
                     if(ec)
                         return;
-                    b2.insert(e.offset, e.size, e.hash);
+                }
+                b.insert(e.offset, e.size, e.hash);
+            }
+            spill = tmp.spill();
+        }
+        while(spill);
+    }
+}
+
+//  Load the key filter saved by close if it matches the
+//  database, otherwise build it from the key file. The
+//  saved filter is removed, since it becomes stale as soon
+//  as anything is inserted.
+//
+template<class Hasher, class File>
+void
+basic_store<Hasher, File>::
+open_filter(state& s, error_code& ec)
+{
+    using namespace detail;
+    auto const& kh = s.kh;
+    filter_file_header fh;
+    fh.version = currentVersion;
+    fh.uid = kh.uid;
+    fh.salt = kh.salt;
+    fh.key_file_size = s.kf.size(ec);
+    if(ec)
+        return;
+    fh.dat_file_size = s.df.size(ec);
+    if(ec)
+        return;
+    fh.rate = static_cast<std::uint64_t>(
+        std::llround(filterRate_ * 1e9));
+    fh.budget = filterBytes_;
+    // Leave room for the database to double
+    auto const keys = static_cast<std::size_t>(
+        2 * kh.buckets * kh.capacity * kh.load_factor / 65536);
+    auto const dim = bloom_filter::dimension(
+        keys, filterRate_, filterBytes_);
+    auto const path = s.kp + ".bf";
+    {
+        // Any failure to load the saved filter
+        // just means it has to be rebuilt.
+        error_code ec2;
+        native_file f;
+        f.open(file_mode::read, path, ec2);
+        if(! ec2)
+        {
+            std::array<std::uint8_t, filter_file_header::size> hb;
+            filter_file_header fh2;
+            f.read(0, hb.data(), hb.size(), ec2);
+            if(! ec2)
+            {
+                istream is{hb};
+                read(is, fh2);
+            }
+            auto const size = f.size(ec2);
+            if(! ec2 &&
+                std::string{fh2.type, 8} == "nudb.flt" &&
+                fh2.version == fh.version &&
+                fh2.uid == fh.uid &&
+                fh2.salt == fh.salt &&
+                fh2.key_file_size == fh.key_file_size &&
+                fh2.dat_file_size == fh.dat_file_size &&
+                fh2.rate == fh.rate &&
+                fh2.budget == fh.budget &&
+                2 * fh2.bits >= dim.first)
+            {
+                s.bf.reset(static_cast<std::size_t>(
+                    fh2.bits), fh2.hashes);
+                if(size == filter_file_header::size + s.bf.size())
+                {
+                    buffer buf{s.bf.size()};
+                    f.read(filter_file_header::size,
+                        buf.get(), buf.size(), ec2);
+                    if(! ec2)
+                    {
+                        istream is{buf.get(), buf.size()};
+                        s.bf.read(is);
+                    }
                 }
                 else
                 {
-                    maybe_spill(b1, w, ec);
-                    if(ec)
-                        return;
-                    b1.insert(e.offset, e.size, e.hash);
+                    ec2 = error::short_read;
                 }
+                if(ec2)
+                    s.bf.clear();
+            }
+            f.close();
+            // A read only database leaves the files unchanged,
+            // so the saved filter stays valid for the next open.
+            if(! read_only_)
+            {
+                native_file::erase(path, ec);
+                if(ec)
+                    return;
             }
-            spill = tmp.spill();
         }
-        while(spill);
     }
+    if(! s.bf.empty())
+        return;
+    s.bf.reset(dim.first, dim.second);
+    buffer buf{kh.block_size};
+    buffer sbuf{kh.block_size};
+    bulk_reader<File> r{s.kf, kh.block_size,
+        static_cast<noff_t>(kh.buckets + 1) * kh.block_size,
+            1024 * kh.block_size};
+    while(! r.eof())
+    {
+        auto is = r.prepare(kh.block_size, ec);
+        if(ec)
+            return;
+        std::memcpy(buf.get(), is.data(kh.block_size), kh.block_size);
+        bucket b{kh.block_size, buf.get(), kh.version};
+        for(;;)
+        {
+            for(nkey_t i = 0; i < b.size(); ++i)
+                s.bf.insert(b[i].hash);
+            auto const spill = b.spill();
+            if(! spill)
+                break;
+            b = bucket{kh.block_size, sbuf.get(), kh.version};
+            b.read(s.df, spill, ec);
+            if(ec)
+                return;
+        }
+    }
+}
+
+//  Save the key filter for the next open
+//
+template<class Hasher, class File>
+void
+basic_store<Hasher, File>::
+close_filter(error_code& ec)
+{
+    using namespace detail;
+    if(s_->bf.empty())
+        return;
+    filter_file_header fh;
+    fh.version = currentVersion;
+    fh.uid = s_->kh.uid;
+    fh.salt = s_->kh.salt;
+    fh.key_file_size = s_->kf.size(ec);
+    if(ec)
+        return;
+    fh.dat_file_size = s_->df.size(ec);
+    if(ec)
+        return;
+    fh.rate = static_cast<std::uint64_t>(
+        std::llround(filterRate_ * 1e9));
+    fh.budget = filterBytes_;
+    fh.bits = s_->bf.bits();
+    fh.hashes = s_->bf.hashes();
+    buffer buf{filter_file_header::size + s_->bf.size()};
+    ostream os{buf.get(), buf.size()};
+    write(os, fh);
+    s_->bf.write(os);
+    // The filter is a sidecar, written with a native_file
+    // since File may need arguments given only to open.
+    native_file f;
+    f.create(file_mode::write, s_->kp + ".bf", ec);
+    if(ec)
+        return;
+    f.write(0, buf.get(), buf.size(), ec);
+    if(ec)
+        return;
+    f.sync(ec);
+}
+
+//  Read bucket n from the key file mapping if it covers the
+//  bucket, else from the bucket cache or the key file. buf
+//  must hold a block. When fill is true, buckets read from
+//  the key file are added to the bucket cache.
+//
+template<class Hasher, class File>
+detail::bucket
+basic_store<Hasher, File>::
+read_bucket(
+    nbuck_t n,
+    detail::mapped_view const& mv,
+    void* buf,
+    bool fill,
+    error_code& ec)
+{
+    using namespace detail;
+    auto const block_size = s_->kh.block_size;
+    auto const offset = static_cast<noff_t>(n + 1) * block_size;
+    if(auto const p = mv.data(offset, block_size))
+    {
+        // Checked as bucket::read does
+        bucket b{block_size,
+            const_cast<std::uint8_t*>(p), s_->kh.version};
+        if(b.size() > bucket_capacity(block_size, s_->kh.version))
+        {
+            ec = error::invalid_bucket_size;
+            return {};
+        }
+        return b;
+    }
+    if(s_->bc.find(n, buf))
+        return bucket{block_size, buf, s_->kh.version};
+    // b constructs from uninitialized buf
+    bucket b{block_size, buf, s_->kh.version};
+    b.read_block(s_->kf, offset, ec);
+    if(ec)
+        return {};
+    if(fill)
+        s_->bc.insert(n, b);
+    return b;
 }
 
 template<class Hasher, class File>
@@ -558,6 +2130,7 @@ load(
     nbuck_t n,
     detail::cache& c1,
     detail::cache& c0,
+    detail::mapped_view const& mv,
     void* buf,
     error_code& ec)
 {
@@ -568,15 +2141,255 @@ load(
     iter = c0.find(n);
     if(iter != c0.end())
         return c1.insert(n, iter->second)->second;
-    bucket tmp{s_->kh.block_size, buf};
-    tmp.read(s_->kf,
-             static_cast<noff_t>(n + 1) * s_->kh.block_size, ec);
+    auto const tmp = read_bucket(n, mv, buf, false, ec);
     if(ec)
         return {};
     c0.insert(n, tmp);
     return c1.insert(n, tmp)->second;
 }
 
+//  Replays the splits and inserts performed by a commit
+//  of p0, starting from the given load and bucket count.
+//  split(n1, n2, buckets, modulus) and insert(e, n) are
+//  invoked in order, and the replay stops when one of
+//  them returns false.
+//
+template<class Hasher, class File>
+template<class Split, class Insert>
+void
+basic_store<Hasher, File>::
+replay(
+    std::size_t& frac,
+    nbuck_t& buckets,
+    nbuck_t& modulus,
+    Split&& split,
+    Insert&& insert)
+{
+    using namespace detail;
+    for(auto const& e : s_->p0)
+    {
+        if((frac += 65536) >= thresh_)
+        {
+            frac -= thresh_;
+            if(buckets == modulus)
+                modulus *= 2;
+            auto const n1 = buckets - (modulus / 2);
+            auto const n2 = buckets++;
+            if(! split(n1, n2, buckets, modulus))
+                return;
+        }
+        auto const n = bucket_index(
+            e.first.hash, buckets, modulus);
+        if(! insert(e, n))
+            return;
+    }
+}
+
+//  Performs the inserts and splits of a commit on
+//  several threads, producing the same buckets as
+//  the serial loop in commit.
+//
+//  Since the modulus only grows, the bucket index of a
+//  hash modulo half the starting modulus never changes,
+//  and the two halves of a split share it. Each thread
+//  owns the buckets with some of these residues, replays
+//  the whole commit, and performs only the operations on
+//  its own buckets. The buckets are created in c1 and c0
+//  beforehand so that the threads only read the maps.
+//  Spill records are appended under a mutex.
+//
+template<class Hasher, class File>
+void
+basic_store<Hasher, File>::
+update_parallel(
+    std::size_t threads,
+    detail::cache& c1,
+    detail::cache& c0,
+    detail::mapped_view const& mv,
+    detail::bulk_writer<File>& w,
+    nbuck_t& buckets,
+    nbuck_t& modulus,
+    error_code& ec)
+{
+    using namespace detail;
+    auto const part = modulus / 2;
+    BOOST_ASSERT(threads > 1 && part >= threads);
+    auto const owner =
+        [part, threads](nbuck_t n)
+        {
+            return static_cast<std::size_t>((n % part) % threads);
+        };
+    // Create every bucket which will be modified,
+    // noting which ones must be read from the key file.
+    std::vector<std::vector<nbuck_t>> loads(threads);
+    auto const first = buckets;
+    auto const touch =
+        [&](nbuck_t n)
+        {
+            if(c1.find(n) != c1.end())
+                return;
+            c1.create(n);
+            if(n >= first)
+                return;
+            c0.create(n);
+            loads[owner(n)].push_back(n);
+        };
+    auto frac = frac_;
+    replay(frac, buckets, modulus,
+        [&](nbuck_t n1, nbuck_t n2, nbuck_t, nbuck_t)
+        {
+            touch(n1);
+            touch(n2);
+            return true;
+        },
+        [&](typename pool::iterator::value_type const&, nbuck_t n)
+        {
+            touch(n);
+            return true;
+        });
+    std::mutex wm;
+    std::atomic<bool> failed{false};
+    std::vector<error_code> errors(threads);
+    parallel_for(threads,
+        [&](std::size_t i)
+        {
+            auto& ei = errors[i];
+            auto const align = file_alignment(s_->kf);
+            buffer buf1{s_->kh.block_size, align};
+            buffer buf2{s_->kh.block_size, align};
+            bucket tmp{s_->kh.block_size,
+        buf1.get(), s_->kh.version};
+            for(auto const n : loads[i])
+            {
+                auto const b = read_bucket(
+                    n, mv, buf2.get(), false, ei);
+                if(ei)
+                {
+                    failed = true;
+                    return;
+                }
+                c0.assign(n, b);
+                c1.assign(n, b);
+            }
+            auto f = frac_;
+            auto nb = first;
+            auto nm = 2 * part;
+            replay(f, nb, nm,
+                [&](nbuck_t n1, nbuck_t n2,
+                    nbuck_t nb, nbuck_t nm)
+                {
+                    if(owner(n1) != i)
+                        return ! failed;
+                    auto b1 = c1.find(n1)->second;
+                    auto b2 = c1.find(n2)->second;
+                    split(b1, b2, tmp, n1, n2,
+                        nb, nm, w, &wm, ei);
+                    if(ei)
+                        failed = true;
+                    return ! failed;
+                },
+                [&](typename pool::iterator::value_type const& e, nbuck_t n)
+                {
+                    if(owner(n) != i)
+                        return true;
+                    auto b = c1.find(n)->second;
+                    if(b.full())
+                    {
+                        std::lock_guard<std::mutex> l{wm};
+                        maybe_spill(b, w, ei);
+                        if(ei)
+                        {
+                            failed = true;
+                            return false;
+                        }
+                    }
+                    b.insert(e.second, e.first.size, e.first.hash);
+                    return true;
+                });
+        });
+    for(auto const& e : errors)
+    {
+        if(e)
+        {
+            ec = e;
+            return;
+        }
+    }
+    frac_ = frac;
+}
+
+//  Write the buckets in s_->c1 to the key file, dividing
+//  them among threads by ranges of bucket index, and bring
+//  the bucket cache up to date. Runs of adjacent buckets
+//  are gathered into one buffer and written together.
+//
+template<class Hasher, class File>
+void
+basic_store<Hasher, File>::
+write_buckets(std::size_t threads, error_code& ec)
+{
+    using namespace detail;
+    std::vector<cache::value_type> v;
+    v.reserve(s_->c1.size());
+    for(auto const e : s_->c1)
+        v.push_back(e);
+    std::sort(v.begin(), v.end(),
+        [](cache::value_type const& lhs,
+            cache::value_type const& rhs)
+        {
+            return lhs.first < rhs.first;
+        });
+    auto const block_size = s_->kh.block_size;
+    auto const blocks = std::max<std::size_t>(
+        1, keyWriteSize_ / block_size);
+    threads = std::max<std::size_t>(1,
+        std::min<std::size_t>(threads, v.size() / 64));
+    std::vector<error_code> errors(threads);
+    parallel_for(threads,
+        [&](std::size_t i)
+        {
+            auto const first = v.size() * i / threads;
+            auto const last = v.size() * (i + 1) / threads;
+            buffer buf{std::min(blocks, last - first) * block_size,
+                file_alignment(s_->kf)};
+            for(auto j = first; j < last;)
+            {
+                // Buckets are written with the zero
+                // pad up to the block size.
+                std::size_t k = 0;
+                do
+                {
+                    v[j + k].second.copy(
+                        buf.get() + k * block_size);
+                    ++k;
+                }
+                while(j + k < last && k < blocks &&
+                    v[j + k].first == v[j].first + k);
+                s_->kf.write((v[j].first + 1) * block_size,
+                    buf.get(), k * block_size, errors[i]);
+                if(errors[i])
+                    return;
+                j += k;
+            }
+            // Readers still find the new buckets in c1, so the
+            // bucket cache can be brought up to date without the
+            // lock. Readers of the previous generation, which might
+            // have cached the old images, finished before g_.finish().
+            // Modified buckets do not evict anything, they are only
+            // kept if they were cached already or there is room.
+            for(auto j = first; j < last; ++j)
+                s_->bc.update(v[j].first, v[j].second);
+        });
+    for(auto const& e : errors)
+    {
+        if(e)
+        {
+            ec = e;
+            return;
+        }
+    }
+}
+
 template<class Hasher, class File>
 void
 basic_store<Hasher, File>::
@@ -587,10 +2400,16 @@ commit(detail::unique_lock_type& m,
     BOOST_ASSERT(m.owns_lock());
     BOOST_ASSERT(! s_->p1.empty());
     swap(s_->p0, s_->p1);
+    pending_.store(0);
+    auto const mv = s_->km.view();
+    auto threads = s_->threads;
+    auto const dur = s_->dur;
     m.unlock();
     work = s_->p0.data_size();
-    cache c0(s_->kh.key_size, s_->kh.block_size, "c0");
-    cache c1(s_->kh.key_size, s_->kh.block_size, "c1");
+    cache c0(s_->kh.key_size,
+        s_->kh.block_size, s_->kh.version, "c0");
+    cache c1(s_->kh.key_size,
+        s_->kh.block_size, s_->kh.version, "c1");
     // 0.63212 ~= 1 - 1/e
     {
         auto const size = static_cast<std::size_t>(
@@ -598,12 +2417,14 @@ commit(detail::unique_lock_type& m,
         c0.reserve(size);
         c1.reserve(size);
     }
-    buffer buf1{s_->kh.block_size};
-    buffer buf2{s_->kh.block_size};
-    bucket tmp{s_->kh.block_size, buf1.get()};
+    auto const align = file_alignment(s_->kf);
+    buffer buf1{s_->kh.block_size, align};
+    buffer buf2{s_->kh.block_size, align};
+    bucket tmp{s_->kh.block_size,
+        buf1.get(), s_->kh.version};
     // Prepare rollback information
     log_file_header lh;
-    lh.version = currentVersion;            // Version
+    lh.version = s_->kh.version;            // Version
     lh.uid = s_->kh.uid;                    // UID
     lh.appnum = s_->kh.appnum;              // Appnum
     lh.key_size = s_->kh.key_size;          // Key Size
@@ -620,7 +2441,7 @@ commit(detail::unique_lock_type& m,
     if(ec)
         return;
     // Checkpoint
-    s_->lf.sync(ec);
+    sync_file(s_->lf, dur, ec);
     if(ec)
         return;
     // Append data and spills to data file
@@ -648,47 +2469,65 @@ commit(detail::unique_lock_type& m,
             write(os, e.first.key, s_->kh.key_size);    // Key
             write(os, e.first.data, e.first.size);      // Data
         }
-        // Do inserts, splits, and build view
-        // of original and modified buckets
-        for(auto const& e : s_->p0)
+        // Each thread needs a distinct
+        // residue of the bucket index.
+        auto const workers = static_cast<std::size_t>(
+            std::min<nbuck_t>(threads, modulus / 2));
+        if(workers > 1)
         {
-            // VFALCO Should this be >= or > ?
-            if((frac_ += 65536) >= thresh_)
+            update_parallel(workers, c1, c0, mv,
+                w, buckets, modulus, ec);
+            if(ec)
+                return;
+        }
+        else
+        {
+            // Do inserts, splits, and build view
+            // of original and modified buckets
+            for(auto const& e : s_->p0)
             {
-                // split
-                frac_ -= thresh_;
-                if(buckets == modulus)
-                    modulus *= 2;
-                auto const n1 = buckets - (modulus / 2);
-                auto const n2 = buckets++;
-                auto b1 = load(n1, c1, c0, buf2.get(), ec);
+                // VFALCO Should this be >= or > ?
+                if((frac_ += 65536) >= thresh_)
+                {
+                    // split
+                    frac_ -= thresh_;
+                    if(buckets == modulus)
+                        modulus *= 2;
+                    auto const n1 = buckets - (modulus / 2);
+                    auto const n2 = buckets++;
+                    auto b1 = load(n1, c1, c0, mv, buf2.get(), ec);
+                    if(ec)
+                        return;
+                    auto b2 = c1.create(n2);
+                    // If split spills, the writer is
+                    // flushed which can amplify writes.
+                    split(b1, b2, tmp, n1, n2,
+                        buckets, modulus, w, nullptr, ec);
+                    if(ec)
+                        return;
+                }
+                // Insert
+                auto const n = bucket_index(
+                    e.first.hash, buckets, modulus);
+                auto b = load(n, c1, c0, mv, buf2.get(), ec);
                 if(ec)
                     return;
-                auto b2 = c1.create(n2);
-                // If split spills, the writer is
-                // flushed which can amplify writes.
-                split(b1, b2, tmp, n1, n2,
-                    buckets, modulus, w, ec);
+                // This can amplify writes if it spills.
+                maybe_spill(b, w, ec);
                 if(ec)
                     return;
+                b.insert(e.second, e.first.size, e.first.hash);
             }
-            // Insert
-            auto const n = bucket_index(
-                e.first.hash, buckets, modulus);
-            auto b = load(n, c1, c0, buf2.get(), ec);
-            if(ec)
-                return;
-            // This can amplify writes if it spills.
-            maybe_spill(b, w, ec);
-            if(ec)
-                return;
-            b.insert(e.second, e.first.size, e.first.hash);
         }
         w.flush(ec);
         if(ec)
             return;
     }
     work += s_->kh.block_size * (2 * c0.size() + c1.size());
+    // The filter must hold the new keys
+    // before they leave the pool.
+    for(auto const& e : s_->p0)
+        s_->bf.insert(e.first.hash);
     // Give readers a view of the new buckets.
     // This might be slightly better than the old
     // view since there could be fewer spills.
@@ -697,6 +2536,11 @@ commit(detail::unique_lock_type& m,
     s_->p0.clear();
     buckets_ = buckets;
     modulus_ = modulus;
+    // Mappings retired before now are unused
+    // once the previous generation finishes.
+    s_->km.expire();
+    // Key file reads from before now might be stale
+    ++kgen_;
     g_.start();
     m.unlock();
     // Write clean buckets to log file
@@ -721,30 +2565,25 @@ commit(detail::unique_lock_type& m,
         w.flush(ec);
         if(ec)
             return;
-        s_->lf.sync(ec);
+        sync_file(s_->lf, dur, ec);
         if(ec)
             return;
     }
     g_.finish();
-    // Write new buckets to key file
-    for(auto const e : s_->c1)
-    {
-        e.second.write(s_->kf,
-           (e.first + 1) * s_->kh.block_size, ec);
-        if(ec)
-            return;
-    }
+    write_buckets(threads, ec);
+    if(ec)
+        return;
     // Finalize the commit
-    s_->df.sync(ec);
+    sync_file(s_->df, dur, ec);
     if(ec)
         return;
-    s_->kf.sync(ec);
+    sync_file(s_->kf, dur, ec);
     if(ec)
         return;
     s_->lf.trunc(0, ec);
     if(ec)
         return;
-    s_->lf.sync(ec);
+    sync_file(s_->lf, dur, ec);
     if(ec)
         return;
     // Cache is no longer needed, all fetches will go straight
@@ -752,6 +2591,9 @@ commit(detail::unique_lock_type& m,
     // might get blocked longer due to the extra I/O.
     m.lock();
     s_->c1.clear();
+    s_->km.release();
+    s_->km.grow(static_cast<std::size_t>(
+        buckets_ + 1) * s_->kh.block_size);
 }
 
 template<class Hasher, class File>
@@ -766,8 +2608,10 @@ flush()
     beast::unit_test::dstream dout{std::cout};
 #endif
     {
+        std::lock_guard<std::mutex> cm{cm_};
         unique_lock_type m{m_};
         s_->when = clock_type::now();
+        s_->requested = false;
         if(! s_->p1.empty())
         {
             std::size_t work;
@@ -0,0 +1,138 @@
+//
+// Copyright (c) 2015-2016 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef NUDB_IMPL_BULK_LOAD_IPP
+#define NUDB_IMPL_BULK_LOAD_IPP
+
+#include <nudb/concepts.hpp>
+#include <nudb/create.hpp>
+#include <nudb/native_file.hpp>
+#include <nudb/rekey.hpp>
+#include <nudb/detail/bulkio.hpp>
+#include <nudb/detail/format.hpp>
+#include <boost/assert.hpp>
+#include <algorithm>
+#include <cstdint>
+
+namespace nudb {
+
+template<
+    class Hasher,
+    class File,
+    class Source,
+    class Progress,
+    class... Args
+>
+void
+bulk_load(
+    path_type const& dat_path,
+    path_type const& key_path,
+    path_type const& log_path,
+    std::uint64_t appnum,
+    nsize_t key_size,
+    nsize_t blockSize,
+    float loadFactor,
+    std::size_t bufferSize,
+    std::size_t threads,
+    Source&& source,
+    error_code& ec,
+    Progress&& progress,
+    Args&&... args)
+{
+    static_assert(is_File<File>::value,
+        "File requirements not met");
+    static_assert(is_Hasher<Hasher>::value,
+        "Hasher requirements not met");
+    static_assert(is_Progress<Progress>::value,
+        "Progress requirements not met");
+    using namespace detail;
+    // Validates the parameters and writes the data file header.
+    // The key file is written again once the item count is known.
+    create<Hasher, File>(dat_path, key_path, log_path,
+        appnum, make_salt(), key_size, blockSize, loadFactor,
+            ec, args...);
+    if(ec)
+        return;
+    // The files are removed on every path out but success
+    struct cleanup
+    {
+        path_type const& dat_path;
+        path_type const& key_path;
+        path_type const& log_path;
+        bool done;
+
+        ~cleanup()
+        {
+            if(done)
+                return;
+            erase_file<File>(dat_path);
+            erase_file<File>(key_path);
+            erase_file<File>(log_path);
+        }
+    };
+    cleanup c{dat_path, key_path, log_path, false};
+    File::erase(key_path, ec);
+    if(ec)
+        return;
+    File::erase(log_path, ec);
+    if(ec)
+        return;
+
+    // Append the records to the data file
+    std::uint64_t itemCount = 0;
+    {
+        File df{args...};
+        df.open(file_mode::append, dat_path, ec);
+        if(ec)
+            return;
+        bulk_writer<File> w{df, dat_file_header::size,
+            1024 * block_size(dat_path)};
+        for(;;)
+        {
+            void const* key;
+            void const* data;
+            nsize_t size;
+            if(! source(key, data, size, ec))
+                break;
+            if(ec)
+                return;
+            // Data Record
+            BOOST_ASSERT(size > 0);                     // zero disallowed
+            BOOST_ASSERT(size <= field<uint32_t>::max); // too large
+            auto os = w.prepare(
+                field<uint48_t>::size + // Size
+                key_size +              // Key
+                size, ec);              // Data
+            if(ec)
+                return;
+            write<uint48_t>(os, size);  // Size
+            write(os, key, key_size);   // Key
+            write(os, data, size);      // Data
+            ++itemCount;
+        }
+        if(ec)
+            return;
+        w.flush(ec);
+        if(ec)
+            return;
+        df.sync(ec);
+        if(ec)
+            return;
+    }
+
+    // Build the key file
+    rekey<Hasher, File>(dat_path, key_path, log_path, blockSize,
+        loadFactor, std::max<std::uint64_t>(itemCount, 1), bufferSize,
+            defaultVersion, threads, ec, progress, args...);
+    if(ec)
+        return;
+    c.done = true;
+}
+
+} // nudb
+
+#endif
@@ -25,10 +25,20 @@ context::
 void
 context::
 start()
+{
+    start(1);
+}
+
+void
+context::
+start(std::size_t threads)
 {
     std::lock_guard<std::mutex> lock(m_);
-    if(! stop_ && ! t_.joinable())
-        t_ = std::thread(&context::run, this);
+    if(stop_ || t_.joinable())
+        return;
+    t_ = std::thread(&context::run, this);
+    for(std::size_t i = 1; i < threads; ++i)
+        tv_.emplace_back(&context::run, this);
 }
 
 void
@@ -50,7 +60,10 @@ stop_all()
     {
         lock.unlock();
         t_.join();
+        for(auto& t : tv_)
+            t.join();
         lock.lock();
+        tv_.clear();
     }
     stop_ = false;
 }
@@ -59,63 +72,39 @@ void
 context::
 run()
 {
-    bool const first = [&]
-    {
-        std::lock_guard<std::mutex> lock(m_);
-        return ++num_threads_ == 1;
-    }();
+    std::unique_lock<std::mutex> lock(m_);
+    if(num_threads_++ == 0)
+        when_ = clock_type::now();
+    cv_f_.notify_all();
 
-    auto when = clock_type::now();
-    for(;;)
+    // Every thread flushes. Whichever thread finds the
+    // period elapsed moves the waiting stores to flushing_,
+    // and idle threads take the next store from there.
+    while(! stop_)
     {
+        auto const now = clock_type::now();
+        if(now >= when_ + std::chrono::seconds{1})
         {
-            std::unique_lock<std::mutex> lock(m_);
-            if(stop_)
-                break;
-            if(first)
-            {
-                cv_f_.wait_until(lock, when + std::chrono::seconds{1});
-                if(stop_)
-                    break;
-                if(! waiting_.empty())
-                {
-                    // Move everything in waiting_ to flushing_
-                    for(auto store = waiting_.head_; store;
-                        store = store->next_)
-                        store->state_ = store_base::state::flushing;
-                    flushing_.splice(waiting_);
-                }
-
-                when = clock_type::now();
-                if(flushing_.empty())
-                    continue;
-
-                if (num_threads_ > 1)
-                {
-                    // Let other threads flush while this one splices
-                    cv_f_.notify_all();
-                    continue;
-                }
-            }
-            else
-            {
-                cv_f_.wait(lock,
-                    [this]
-                    {
-                        return ! flushing_.empty() || stop_;
-                    });
-                if(stop_)
-                    break;
-            }
+            // Move everything in waiting_ to flushing_
+            for(auto store = waiting_.head_; store;
+                store = store->next_)
+                store->state_ = store_base::state::flushing;
+            flushing_.splice(waiting_);
+            when_ = now;
+            if(! flushing_.empty())
+                cv_f_.notify_all();
         }
-
-        // Process everything in flushing_
-        for(;;)
-            if(! flush_one())
-                break;
+        if(flushing_.empty())
+        {
+            // Woken early when a store requests a flush
+            cv_f_.wait_until(lock, when_ + std::chrono::seconds{1});
+            continue;
+        }
+        lock.unlock();
+        flush_one();
+        lock.lock();
     }
 
-    std::lock_guard<std::mutex> lock(m_);
     --num_threads_;
     cv_w_.notify_all();
 }
@@ -190,6 +179,25 @@ erase(store_base& store)
     store.state_ = state::none;
 }
 
+void
+context::
+request_flush(store_base& store)
+{
+    std::lock_guard<std::mutex> lock(m_);
+    // A store being flushed is flushed again afterwards
+    if(store.state_ == store_base::state::intermediate)
+    {
+        store.again_ = true;
+        return;
+    }
+    if(store.state_ != store_base::state::waiting)
+        return;
+    waiting_.erase(&store);
+    store.state_ = store_base::state::flushing;
+    flushing_.push_back(&store);
+    cv_f_.notify_all();
+}
+
 bool
 context::
 flush_one()
@@ -199,7 +207,11 @@ flush_one()
         std::lock_guard<std::mutex> lock(m_);
         if(flushing_.empty())
             return false;
+        // The store with the most pending data goes first
         store = flushing_.head_;
+        for(auto s = store->next_; s; s = s->next_)
+            if(s->pending_.load() > store->pending_.load())
+                store = s;
         store->state_ = store_base::state::intermediate;
         flushing_.erase(store);
     }
@@ -207,8 +219,18 @@ flush_one()
     store->flush();
 
     std::lock_guard<std::mutex> lock(m_);
-    store->state_ = store_base::state::waiting;
-    waiting_.push_back(store);
+    if(store->again_)
+    {
+        store->again_ = false;
+        store->state_ = store_base::state::flushing;
+        flushing_.push_back(store);
+        cv_f_.notify_all();
+    }
+    else
+    {
+        store->state_ = store_base::state::waiting;
+        waiting_.push_back(store);
+    }
     cv_w_.notify_all();
     return true;
 }
@@ -58,11 +58,41 @@ create(
     float load_factor,
     error_code& ec,
     Args&&... args)
+{
+    create<Hasher, File>(dat_path, key_path, log_path,
+            appnum, uid, salt, key_size, blockSize, load_factor,
+            detail::defaultVersion, ec, args...);
+}
+
+template<
+    class Hasher,
+    class File,
+    class... Args
+>
+void
+create(
+    path_type const& dat_path,
+    path_type const& key_path,
+    path_type const& log_path,
+    std::uint64_t appnum,
+    std::uint64_t uid,
+    std::uint64_t salt,
+    nsize_t key_size,
+    nsize_t blockSize,
+    float load_factor,
+    std::size_t version,
+    error_code& ec,
+    Args&&... args)
 {
     static_assert(is_File<File>::value,
         "File requirements not met");
 
     using namespace detail;
+    if(version < minimumVersion || version > currentVersion)
+    {
+        ec = error::different_version;
+        return;
+    }
     if(key_size < 1)
     {
         ec = error::invalid_key_size;
@@ -79,7 +109,7 @@ create(
         return;
     }
     auto const capacity =
-        bucket_capacity(blockSize);
+        bucket_capacity(blockSize, version);
     if(capacity < 1)
     {
         ec = error::invalid_block_size;
@@ -105,13 +135,13 @@ create(
             goto fail;
         elf = true;
         dat_file_header dh;
-        dh.version = currentVersion;
+        dh.version = version;
         dh.uid = uid;
         dh.appnum = appnum;
         dh.key_size = key_size;
 
         key_file_header kh;
-        kh.version = currentVersion;
+        kh.version = version;
         kh.uid = dh.uid;
         kh.appnum = appnum;
         kh.key_size = key_size;
@@ -129,7 +159,7 @@ create(
             goto fail;
         buffer buf{blockSize};
         std::memset(buf.get(), 0, blockSize);
-        bucket b(blockSize, buf.get(), empty);
+        bucket b(blockSize, buf.get(), version, empty);
         b.write(kf, blockSize, ec);
         if(ec)
             goto fail;
@@ -173,7 +203,7 @@ create(
     error_code& ec,
     Args&&... args)
 {
-    create<Hasher>(dat_path, key_path, log_path,
+    create<Hasher, File>(dat_path, key_path, log_path,
             appnum, make_uid(), salt, key_size, blockSize,
             load_factor, ec, args...);
 }
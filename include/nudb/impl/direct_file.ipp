@@ -0,0 +1,183 @@
+//
+// Copyright (c) 2015-2016 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef NUDB_IMPL_DIRECT_FILE_IPP
+#define NUDB_IMPL_DIRECT_FILE_IPP
+
+#include <nudb/detail/buffer.hpp>
+#include <boost/assert.hpp>
+#include <algorithm>
+#include <cstring>
+#include <limits.h>
+
+namespace nudb {
+
+inline
+void
+direct_file::
+create(file_mode mode, path_type const& path, error_code& ec)
+{
+    f_.create(mode, path, ec);
+    if(ec)
+        return;
+    start(ec);
+}
+
+inline
+void
+direct_file::
+open(file_mode mode, path_type const& path, error_code& ec)
+{
+    f_.open(mode, path, ec);
+    if(ec)
+        return;
+    start(ec);
+}
+
+inline
+void
+direct_file::
+read(std::uint64_t offset,
+    void* buffer, std::size_t bytes, error_code& ec)
+{
+    if(aligned(offset, buffer, bytes))
+        return f_.read(offset, buffer, bytes, ec);
+    // Read the enclosing blocks into an aligned buffer
+    auto const first = offset - offset % alignment_;
+    auto const last = (offset + bytes + alignment_ - 1) /
+        alignment_ * alignment_;
+    detail::buffer buf{
+        static_cast<std::size_t>(last - first), alignment_};
+    auto const n = pread(first, buf.get(), buf.size(), ec);
+    if(ec)
+        return;
+    if(first + n < offset + bytes)
+    {
+        ec = error::short_read;
+        return;
+    }
+    std::memcpy(buffer, buf.get() + (offset - first), bytes);
+}
+
+inline
+void
+direct_file::
+write(std::uint64_t offset,
+    void const* buffer, std::size_t bytes, error_code& ec)
+{
+    if(aligned(offset, buffer, bytes))
+    {
+        boost::shared_lock<boost::shared_mutex> lock{*m_};
+        return f_.write(offset, buffer, bytes, ec);
+    }
+    boost::unique_lock<boost::shared_mutex> lock{*m_};
+    auto const size = f_.size(ec);
+    if(ec)
+        return;
+    auto const first = offset - offset % alignment_;
+    auto const last = (offset + bytes + alignment_ - 1) /
+        alignment_ * alignment_;
+    detail::buffer buf{
+        static_cast<std::size_t>(last - first), alignment_};
+    std::memset(buf.get(), 0, buf.size());
+    // Preserve the parts of the end blocks which are
+    // not overwritten, unless they lie past the end.
+    if(offset > first && first < size)
+    {
+        pread(first, buf.get(), alignment_, ec);
+        if(ec)
+            return;
+    }
+    auto const tail = last - alignment_;
+    if(offset + bytes < last && tail < size &&
+        (tail > first || offset == first))
+    {
+        pread(tail, buf.get() + (tail - first), alignment_, ec);
+        if(ec)
+            return;
+    }
+    std::memcpy(buf.get() + (offset - first), buffer, bytes);
+    f_.write(first, buf.get(), buf.size(), ec);
+    if(ec)
+        return;
+    // Remove the padding written past the end
+    auto const end = std::max<std::uint64_t>(size, offset + bytes);
+    if(last > end)
+        f_.trunc(end, ec);
+}
+
+inline
+bool
+direct_file::
+aligned(std::uint64_t offset,
+    void const* buffer, std::size_t bytes) const
+{
+    return offset % alignment_ == 0 &&
+        bytes % alignment_ == 0 &&
+        reinterpret_cast<std::uintptr_t>(buffer) % alignment_ == 0;
+}
+
+// Returns the number of bytes read, which
+// is less than requested at the end of file.
+inline
+std::size_t
+direct_file::
+pread(std::uint64_t offset,
+    void* buffer, std::size_t bytes, error_code& ec)
+{
+    std::size_t total = 0;
+    while(bytes > 0)
+    {
+        auto const amount = static_cast<ssize_t>(
+            std::min(bytes, static_cast<std::size_t>(SSIZE_MAX)));
+        auto const n = ::pread(
+            f_.native_handle(), buffer, amount, offset);
+        if(n == -1)
+        {
+            auto const ev = errno;
+            if(ev == EINTR)
+                continue;
+            ec = error_code{ev, system_category()};
+            return total;
+        }
+        offset += n;
+        bytes -= n;
+        total += n;
+        buffer = reinterpret_cast<char*>(buffer) + n;
+        // A short read ends at the end of the file. The file
+        // may grow meanwhile, but the rest of the transfer is
+        // no longer aligned, so it is not retried.
+        if(n < amount)
+            break;
+    }
+    return total;
+}
+
+inline
+void
+direct_file::
+start(error_code& ec)
+{
+    BOOST_ASSERT(alignment_ > 0 &&
+        (alignment_ & (alignment_ - 1)) == 0);
+    if(! m_)
+        m_.reset(new boost::shared_mutex);
+    // Writes through the bounce buffer rewrite the
+    // start of the last block, so they cannot append.
+    auto const fd = f_.native_handle();
+    auto const flags = ::fcntl(fd, F_GETFL);
+    if(flags == -1 || ::fcntl(fd, F_SETFL,
+        (flags | O_DIRECT) & ~O_APPEND) == -1)
+    {
+        ec = error_code{errno, system_category()};
+        f_.close();
+    }
+}
+
+} // nudb
+
+#endif
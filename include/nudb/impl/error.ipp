@@ -144,6 +144,9 @@ nudb_category()
 
             case error::duplicate_value:
                 return "duplicate value";
+
+            case error::read_only:
+                return "database is read only";
             }
         }
 
@@ -0,0 +1,256 @@
+//
+// Copyright (c) 2015-2016 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef NUDB_IMPL_IO_URING_FILE_IPP
+#define NUDB_IMPL_IO_URING_FILE_IPP
+
+#include <boost/assert.hpp>
+#include <algorithm>
+#include <memory>
+
+namespace nudb {
+
+inline
+io_uring_file::
+~io_uring_file()
+{
+    close();
+}
+
+inline
+io_uring_file::
+io_uring_file(io_uring_file&& other)
+    : f_(std::move(other.f_))
+    , opts_(other.opts_)
+    , ring_(std::move(other.ring_))
+{
+}
+
+inline
+io_uring_file&
+io_uring_file::
+operator=(io_uring_file&& other)
+{
+    if(&other == this)
+        return *this;
+    close();
+    f_ = std::move(other.f_);
+    opts_ = other.opts_;
+    ring_ = std::move(other.ring_);
+    return *this;
+}
+
+inline
+void
+io_uring_file::
+close()
+{
+    // The ring holds a reference to the
+    // registered descriptor, release it first.
+    ring_.reset();
+    f_.close();
+}
+
+inline
+void
+io_uring_file::
+create(file_mode mode, path_type const& path, error_code& ec)
+{
+    f_.create(mode, path, ec);
+    if(ec)
+        return;
+    start(ec);
+}
+
+inline
+void
+io_uring_file::
+open(file_mode mode, path_type const& path, error_code& ec)
+{
+    f_.open(mode, path, ec);
+    if(ec)
+        return;
+    start(ec);
+}
+
+inline
+void
+io_uring_file::
+read(std::uint64_t offset,
+    void* buffer, std::size_t bytes, error_code& ec)
+{
+    BOOST_ASSERT(ring_);
+    while(bytes > 0)
+    {
+        auto const amount = std::min<std::size_t>(bytes, 0x40000000);
+        auto const n = ring_->read(offset, buffer, amount);
+        if(n < 0)
+        {
+            if(n == -EINTR || n == -EAGAIN)
+                continue;
+            ec = error_code{-n, system_category()};
+            return;
+        }
+        if(n == 0)
+        {
+            ec = error::short_read;
+            return;
+        }
+        offset += n;
+        bytes -= n;
+        buffer = reinterpret_cast<char*>(buffer) + n;
+    }
+}
+
+// Continues an asynchronous read until every
+// byte has been transferred or an error occurs.
+//
+struct io_uring_file::read_op
+{
+    detail::uring& ring;
+    std::uint64_t offset;
+    char* buffer;
+    std::size_t bytes;
+    std::function<void(error_code const&)> handler;
+
+    void
+    start()
+    {
+        auto const amount = std::min<std::size_t>(bytes, 0x40000000);
+        auto self = std::make_shared<read_op>(std::move(*this));
+        ring.async_read(offset, buffer, amount,
+            [self](int n)
+            {
+                (*self)(n);
+            });
+    }
+
+    void
+    operator()(int n)
+    {
+        if(n < 0)
+        {
+            if(n == -EINTR || n == -EAGAIN)
+                return start();
+            return handler(error_code{-n, system_category()});
+        }
+        if(n == 0 && bytes > 0)
+            return handler(error::short_read);
+        offset += n;
+        bytes -= n;
+        buffer += n;
+        if(bytes > 0)
+            return start();
+        handler(error_code{});
+    }
+};
+
+inline
+void
+io_uring_file::
+async_read(std::uint64_t offset, void* buffer, std::size_t bytes,
+    std::function<void(error_code const&)> handler)
+{
+    BOOST_ASSERT(ring_);
+    read_op op{*ring_, offset,
+        reinterpret_cast<char*>(buffer), bytes, std::move(handler)};
+    op.start();
+}
+
+inline
+std::size_t
+io_uring_file::
+poll()
+{
+    BOOST_ASSERT(ring_);
+    return ring_->poll(false);
+}
+
+inline
+std::size_t
+io_uring_file::
+run_one()
+{
+    BOOST_ASSERT(ring_);
+    return ring_->poll(true);
+}
+
+inline
+void
+io_uring_file::
+write(std::uint64_t offset,
+    void const* buffer, std::size_t bytes, error_code& ec)
+{
+    BOOST_ASSERT(ring_);
+    while(bytes > 0)
+    {
+        auto const amount = std::min<std::size_t>(bytes, 0x40000000);
+        auto const n = ring_->write(offset, buffer, amount);
+        if(n < 0)
+        {
+            if(n == -EINTR || n == -EAGAIN)
+                continue;
+            ec = error_code{-n, system_category()};
+            return;
+        }
+        offset += n;
+        bytes -= n;
+        buffer = reinterpret_cast<char const*>(buffer) + n;
+    }
+}
+
+inline
+void
+io_uring_file::
+sync(error_code& ec)
+{
+    BOOST_ASSERT(ring_);
+    for(;;)
+    {
+        auto const n = ring_->fsync(false);
+        if(n == 0)
+            break;
+        if(n == -EINTR || n == -EAGAIN)
+            continue;
+        ec = error_code{-n, system_category()};
+        return;
+    }
+}
+
+inline
+void
+io_uring_file::
+sync_data(error_code& ec)
+{
+    BOOST_ASSERT(ring_);
+    for(;;)
+    {
+        auto const n = ring_->fsync(true);
+        if(n == 0)
+            break;
+        if(n == -EINTR || n == -EAGAIN)
+            continue;
+        ec = error_code{-n, system_category()};
+        return;
+    }
+}
+
+inline
+void
+io_uring_file::
+start(error_code& ec)
+{
+    std::unique_ptr<detail::uring> ring{new detail::uring};
+    ring->open(f_.native_handle(), opts_, ec);
+    if(ec)
+        return f_.close();
+    ring_ = std::move(ring);
+}
+
+} // nudb
+
+#endif
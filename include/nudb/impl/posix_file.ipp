@@ -182,6 +182,49 @@ sync(error_code& ec)
     }
 }
 
+inline
+void
+posix_file::
+sync_data(error_code& ec)
+{
+    for(;;)
+    {
+#ifdef __APPLE__
+        if(::fsync(fd_) == 0)
+#else
+        if(::fdatasync(fd_) == 0)
+#endif
+            break;
+        auto const ev = errno;
+        if(ev == EINTR)
+            continue;
+        return err(ev, ec);
+    }
+}
+
+inline
+void
+posix_file::
+sync_range(error_code& ec)
+{
+#ifdef __linux__
+    for(;;)
+    {
+        if(::sync_file_range(fd_, 0, 0,
+                SYNC_FILE_RANGE_WAIT_BEFORE |
+                SYNC_FILE_RANGE_WRITE |
+                SYNC_FILE_RANGE_WAIT_AFTER) == 0)
+            break;
+        auto const ev = errno;
+        if(ev == EINTR)
+            continue;
+        return err(ev, ec);
+    }
+#else
+    sync_data(ec);
+#endif
+}
+
 inline
 void
 posix_file::
@@ -122,9 +122,9 @@ recover(
             return;
 
         auto const readSize = 1024 * kh.block_size;
-        auto const bucketSize = bucket_size(kh.capacity);
+        auto const bucketSize = bucket_size(kh.capacity, kh.version);
         buffer buf{kh.block_size};
-        bucket b{kh.block_size, buf.get()};
+        bucket b{kh.block_size, buf.get(), kh.version};
         bulk_reader<File> r{lf,
             log_file_header::size, logFileSize, readSize};
         while(! r.eof())
@@ -139,20 +139,16 @@ recover(
             }
             if(ec)
                 return;
-            nsize_t n;
-            {
-                std::uint64_t v;
-                // VFALCO This should have been a uint32_t
-                read<std::uint64_t>(is, v); // Index
-                BOOST_ASSERT(v <= std::numeric_limits<std::uint32_t>::max());
-                n = static_cast<nsize_t>(v);
-            }
+            nbuck_t n;
+            read<std::uint64_t>(is, n);     // Index
             b.read(r, ec);                  // Bucket
             if(ec == error::short_read)
             {
                 ec = {};
                 break;
             }
+            if(ec)
+                return;
             if(b.spill() && b.spill() + bucketSize > dataFileSize)
             {
                 ec = error::invalid_log_spill;
@@ -13,10 +13,290 @@
 #include <nudb/detail/bucket.hpp>
 #include <nudb/detail/bulkio.hpp>
 #include <nudb/detail/format.hpp>
+#include <nudb/detail/parallel.hpp>
+#include <atomic>
 #include <cmath>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 namespace nudb {
 
+namespace detail {
+
+// The most partition files open at once. Partitions
+// beyond this are handled by another data file scan.
+static std::size_t constexpr rekey_max_runs = 256;
+
+// Size of an entry in a partition file
+static std::size_t constexpr rekey_entry_size =
+    field<std::uint64_t>::size +    // Hash
+    field<uint48_t>::size +         // Offset
+    field<uint48_t>::size;          // Size
+
+// Build the buckets of the key file from a single scan of the data
+// file per group of partitions. Each partition is a range of
+// chunkSize buckets. The scan appends the hash, offset and size of
+// every record to a temporary file for its partition, then threads
+// fill the buckets of the partitions in parallel and write them to
+// the key file. A full bucket is passed to spill(b, ec), which must
+// write it to the data file and empty it, and which may be called
+// from several threads at once.
+//
+template<class Hasher, class File,
+    class Spill, class Progress, class... Args>
+void
+rekey_partitioned(
+    File& df,
+    File& kf,
+    dat_file_header const& dh,
+    key_file_header const& kh,
+    noff_t dataFileSize,
+    path_type const& key_path,
+    std::size_t chunkSize,
+    std::size_t threads,
+    std::size_t readSize,
+    std::size_t writeSize,
+    Spill&& spill,
+    error_code& ec,
+    Progress& progress,
+    Args&&... args)
+{
+    auto const partitions = static_cast<std::size_t>(
+        (kh.buckets + chunkSize - 1) / chunkSize);
+    auto const scans =
+        (partitions + rekey_max_runs - 1) / rekey_max_runs;
+    // Each scan counts the data file twice, once
+    // for reading it and once for filling buckets.
+    auto const nwork = 2 * scans * dataFileSize;
+    std::mutex pm;
+    std::uint64_t work = 0;
+    progress(0, nwork);
+
+    std::vector<std::unique_ptr<File>> files;
+    std::vector<path_type> paths;
+    // Temporary files are removed on every path out
+    struct cleanup
+    {
+        std::vector<std::unique_ptr<File>>& files;
+        std::vector<path_type>& paths;
+
+        ~cleanup()
+        {
+            files.clear();
+            for(auto const& path : paths)
+            {
+                error_code ec;
+                File::erase(path, ec);
+            }
+            paths.clear();
+        }
+    };
+    for(std::size_t p0 = 0; p0 < partitions; p0 += rekey_max_runs)
+    {
+        cleanup c{files, paths};
+        auto const p1 = std::min(p0 + rekey_max_runs, partitions);
+        std::vector<std::unique_ptr<bulk_writer<File>>> writers;
+        for(auto p = p0; p < p1; ++p)
+        {
+            // Only files created here are removed, so an existing
+            // file with the same name is left alone.
+            auto path = key_path + ".rk" + std::to_string(p);
+            std::unique_ptr<File> f{new File{args...}};
+            f->create(file_mode::write, path, ec);
+            if(ec)
+                return;
+            paths.push_back(std::move(path));
+            files.push_back(std::move(f));
+            writers.emplace_back(new bulk_writer<File>{
+                *files.back(), 0, writeSize});
+        }
+        // Scan the data file
+        bulk_reader<File> r{df,
+            dat_file_header::size, dataFileSize, readSize};
+        while(! r.eof())
+        {
+            auto const offset = r.offset();
+            // Data Record or Spill Record
+            nsize_t size;
+            auto is = r.prepare(
+                field<uint48_t>::size, ec); // Size
+            if(ec)
+                return;
+            progress(work + r.offset(), nwork);
+            read_size48(is, size);
+            if(size > 0)
+            {
+                // Data Record
+                is = r.prepare(
+                    dh.key_size +           // Key
+                    size, ec);              // Data
+                if(ec)
+                    return;
+                std::uint8_t const* const key =
+                    is.data(dh.key_size);
+                auto const h = hash<Hasher>(
+                    key, dh.key_size, kh.salt);
+                auto const p = static_cast<std::size_t>(bucket_index(
+                    h, kh.buckets, kh.modulus) / chunkSize);
+                if(p < p0 || p >= p1)
+                    continue;
+                auto os = writers[p - p0]->prepare(
+                    rekey_entry_size, ec);
+                if(ec)
+                    return;
+                write<std::uint64_t>(os, h);        // Hash
+                write<uint48_t>(os, offset);        // Offset
+                write<uint48_t>(os, size);          // Size
+            }
+            else
+            {
+                // Spill Record
+                is = r.prepare(
+                    field<std::uint16_t>::size, ec);
+                if(ec)
+                    return;
+                read<std::uint16_t>(is, size);  // Size
+                r.prepare(size, ec); // skip
+                if(ec)
+                    return;
+            }
+        }
+        work += dataFileSize;
+        std::vector<noff_t> sizes;
+        for(auto& w : writers)
+        {
+            sizes.push_back(w->offset());
+            w->flush(ec);
+            if(ec)
+                return;
+        }
+        writers.clear();
+
+        // Fill the buckets of each partition
+        std::mutex em;
+        std::atomic<std::size_t> next{p0};
+        std::atomic<bool> failed{false};
+        auto const share = dataFileSize / (p1 - p0);
+        parallel_for(std::min(threads, p1 - p0),
+            [&](std::size_t)
+            {
+                error_code ec1;
+                buffer buf{chunkSize * kh.block_size};
+                while(! failed)
+                {
+                    auto const p = next++;
+                    if(p >= p1)
+                        break;
+                    auto const b0 = static_cast<nbuck_t>(p) * chunkSize;
+                    auto const b1 = std::min<nbuck_t>(
+                        b0 + chunkSize, kh.buckets);
+                    auto const bn = static_cast<std::size_t>(b1 - b0);
+                    // Create empty buckets
+                    for(std::size_t i = 0; i < bn; ++i)
+                        bucket b{kh.block_size, buf.get() +
+                            i * kh.block_size, kh.version, empty};
+                    bulk_reader<File> r{*files[p - p0],
+                        0, sizes[p - p0], readSize};
+                    while(! r.eof())
+                    {
+                        auto is = r.prepare(rekey_entry_size, ec1);
+                        if(ec1)
+                            break;
+                        nhash_t h;
+                        noff_t offset;
+                        nsize_t size;
+                        read<std::uint64_t>(is, h);     // Hash
+                        read<uint48_t>(is, offset);     // Offset
+                        read<uint48_t>(is, size);       // Size
+                        auto const n = bucket_index(
+                            h, kh.buckets, kh.modulus);
+                        bucket b{kh.block_size, buf.get() +
+                           (n - b0) * kh.block_size, kh.version};
+                        if(b.full())
+                        {
+                            spill(b, ec1);
+                            if(ec1)
+                                break;
+                        }
+                        b.insert(offset, size, h);
+                    }
+                    if(! ec1)
+                        kf.write((b0 + 1) * kh.block_size, buf.get(),
+                            static_cast<std::size_t>(
+                                bn * kh.block_size), ec1);
+                    if(ec1)
+                    {
+                        std::lock_guard<std::mutex> l{em};
+                        if(! ec)
+                            ec = ec1;
+                        failed = true;
+                        break;
+                    }
+                    std::lock_guard<std::mutex> l{pm};
+                    work += share;
+                    progress(work, nwork);
+                }
+            });
+        if(ec)
+            return;
+        work = 2 * (p0 / rekey_max_runs + 1) * dataFileSize;
+    }
+}
+
+} // detail
+
+template<
+    class Hasher,
+    class File,
+    class Progress,
+    class... Args
+>
+void
+rekey(
+    path_type const& dat_path,
+    path_type const& key_path,
+    path_type const& log_path,
+    std::size_t blockSize,
+    float loadFactor,
+    std::uint64_t itemCount,
+    std::size_t bufferSize,
+    error_code& ec,
+    Progress&& progress,
+    Args&&... args)
+{
+    rekey<Hasher, File>(dat_path, key_path, log_path,
+        blockSize, loadFactor, itemCount, bufferSize,
+            detail::defaultVersion, ec, progress, args...);
+}
+
+template<
+    class Hasher,
+    class File,
+    class Progress,
+    class... Args
+>
+void
+rekey(
+    path_type const& dat_path,
+    path_type const& key_path,
+    path_type const& log_path,
+    std::size_t blockSize,
+    float loadFactor,
+    std::uint64_t itemCount,
+    std::size_t bufferSize,
+    std::size_t version,
+    error_code& ec,
+    Progress&& progress,
+    Args&&... args)
+{
+    rekey<Hasher, File>(dat_path, key_path, log_path,
+        blockSize, loadFactor, itemCount, bufferSize,
+            version, 1, ec, progress, args...);
+}
+
 // VFALCO Should this delete the key file on an error?
 template<
     class Hasher,
@@ -33,6 +313,8 @@ rekey(
     float loadFactor,
     std::uint64_t itemCount,
     std::size_t bufferSize,
+    std::size_t version,
+    std::size_t threads,
     error_code& ec,
     Progress&& progress,
     Args&&... args)
@@ -44,6 +326,11 @@ rekey(
     static_assert(is_Progress<Progress>::value,
         "Progress requirements not met");
     using namespace detail;
+    if(version < minimumVersion || version > currentVersion)
+    {
+        ec = error::different_version;
+        return;
+    }
     auto const readSize = 1024 * block_size(dat_path);
     auto const writeSize = 16 * block_size(key_path);
 
@@ -74,7 +361,7 @@ rekey(
 
     // Set up key file header
     key_file_header kh;
-    kh.version = currentVersion;
+    kh.version = version;
     kh.uid = dh.uid;
     kh.appnum = dh.appnum;
     kh.key_size = dh.key_size;
@@ -83,9 +370,9 @@ rekey(
     kh.block_size = blockSize;
     kh.load_factor = std::min<std::size_t>(
         static_cast<std::size_t>(65536.0f * loadFactor), 65535);
-    kh.buckets = static_cast<std::size_t>(
+    kh.buckets = static_cast<nbuck_t>(
         std::ceil(itemCount /(
-            bucket_capacity(kh.block_size) * loadFactor)));
+            bucket_capacity(kh.block_size, kh.version) * loadFactor)));
     kh.modulus = ceil_pow2(kh.buckets);
     // Create key file
     File kf{args...};
@@ -113,7 +400,7 @@ rekey(
     // Write log file header
     {
         log_file_header lh;
-        lh.version = currentVersion;            // Version
+        lh.version = kh.version;                // Version
         lh.uid = kh.uid;                        // UID
         lh.appnum = kh.appnum;                  // Appnum
         lh.key_size = kh.key_size;              // Key Size
@@ -155,11 +442,41 @@ rekey(
             return;
     }
     
+    if(threads == 0)
+        threads = std::max<std::size_t>(1,
+            std::thread::hardware_concurrency());
+    auto chunkSize = std::max<std::size_t>(1,
+        bufferSize / kh.block_size);
+    bulk_writer<File> dw{df, dataFileSize, writeSize};
+    if(threads > 1 && chunkSize < kh.buckets)
+    {
+        std::mutex dwm;
+        // The buffer is shared by the threads, and every
+        // thread gets at least one range of buckets.
+        chunkSize = std::max<std::size_t>(1,
+            bufferSize / (threads * kh.block_size));
+        chunkSize = static_cast<std::size_t>(std::min<nbuck_t>(
+            chunkSize, (kh.buckets + threads - 1) / threads));
+        rekey_partitioned<Hasher>(df, kf, dh, kh, dataFileSize,
+            key_path, chunkSize, threads, readSize, writeSize,
+            [&](bucket& b, error_code& ec1)
+            {
+                std::lock_guard<std::mutex> l{dwm};
+                maybe_spill(b, dw, ec1);
+            }, ec, progress, args...);
+        if(ec)
+            return;
+        dw.flush(ec);
+        if(ec)
+            return;
+        lf.close();
+        File::erase(log_path, ec);
+        return;
+    }
+
     // Build contiguous sequential sections of the
     // key file using multiple passes over the data.
     //
-    auto const chunkSize = std::max<std::size_t>(1,
-        bufferSize / kh.block_size);
     // Calculate work required
     auto const passes =
        (kh.buckets + chunkSize - 1) / chunkSize;
@@ -167,16 +484,15 @@ rekey(
     progress(0, nwork);
 
     buf.reserve(chunkSize * kh.block_size);
-    bulk_writer<File> dw{df, dataFileSize, writeSize};
     for(nbuck_t b0 = 0; b0 < kh.buckets; b0 += chunkSize)
     {
-        auto const b1 = std::min<std::size_t>(b0 + chunkSize, kh.buckets);
+        auto const b1 = std::min<nbuck_t>(b0 + chunkSize, kh.buckets);
         // Buffered range is [b0, b1)
-        auto const bn = b1 - b0;
+        auto const bn = static_cast<std::size_t>(b1 - b0);
         // Create empty buckets
         for(std::size_t i = 0; i < bn; ++i)
-            bucket b{kh.block_size,
-                buf.get() + i * kh.block_size, empty};
+            bucket b{kh.block_size, buf.get() +
+                i * kh.block_size, kh.version, empty};
         // Insert all keys into buckets
         // Iterate Data File
         bulk_reader<File> r{df,
@@ -209,7 +525,7 @@ rekey(
                 if(n < b0 || n >= b1)
                     continue;
                 bucket b{kh.block_size, buf.get() +
-                   (n - b0) * kh.block_size};
+                   (n - b0) * kh.block_size, kh.version};
                 maybe_spill(b, dw, ec);
                 if(ec)
                     return;
@@ -14,16 +14,135 @@
 #include <nudb/detail/bucket.hpp>
 #include <nudb/detail/bulkio.hpp>
 #include <nudb/detail/format.hpp>
+#include <nudb/detail/parallel.hpp>
+#include <nudb/detail/scan.hpp>
 #include <boost/core/ignore_unused.hpp>
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cstddef>
 #include <limits>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 namespace nudb {
 
 namespace detail {
 
+// Statistics gathered by one thread, added
+// to the verify_info when the threads finish.
+//
+struct verify_counts
+{
+    std::uint64_t key_count = 0;
+    std::uint64_t value_count = 0;
+    std::uint64_t value_bytes = 0;
+    std::uint64_t spill_count = 0;
+    std::uint64_t spill_bytes = 0;
+    std::uint64_t fetches = 0;
+    std::array<nbuck_t, 10> hist;
+    error_code ec;
+
+    verify_counts()
+    {
+        hist.fill(0);
+    }
+};
+
+// Add the counts of each thread to info. Returns the
+// number of fetches, or sets ec to the first error.
+//
+inline
+std::uint64_t
+verify_merge(verify_info& info,
+    std::vector<verify_counts> const& counts, error_code& ec)
+{
+    std::uint64_t fetches = 0;
+    for(auto const& c : counts)
+    {
+        if(c.ec)
+        {
+            ec = c.ec;
+            return 0;
+        }
+        info.key_count += c.key_count;
+        info.value_count += c.value_count;
+        info.value_bytes += c.value_bytes;
+        info.spill_count += c.spill_count;
+        info.spill_bytes += c.spill_bytes;
+        for(std::size_t i = 0; i < info.hist.size(); ++i)
+            info.hist[i] += c.hist[i];
+        fetches += c.fetches;
+    }
+    return fetches;
+}
+
+// Calculate the statistics derived from the counts
+//
+inline
+void
+verify_finish(verify_info& info, std::uint64_t fetches)
+{
+    if(info.value_count)
+        info.avg_fetch =
+            float(fetches) / info.value_count;
+    else
+        info.avg_fetch = 0;
+    info.waste = (info.spill_bytes_tot - info.spill_bytes) /
+        float(info.dat_file_size);
+    if(info.value_count)
+        info.overhead =
+            float(info.key_file_size + info.dat_file_size) /
+            (
+                info.value_bytes +
+                info.key_count *
+                    (info.key_size +
+                    // Data Record
+                     field<uint48_t>::size) // Size
+                        ) - 1;
+    else
+        info.overhead = 0;
+    info.actual_load = info.key_count / float(
+        info.capacity * info.buckets);
+}
+
+// Read the spill record whose bucket starts at offset into b.
+//
+// The buckets of the key file only refer to spill records of its
+// own block size, which hold a full bucket of spillSize bytes.
+// The scan of the data file cannot check this, because a rekey
+// to another block size leaves the older spill records in place.
+//
+template<class File>
+void
+verify_spill(File& df, noff_t offset,
+    bucket& b, std::size_t spillSize, error_code& ec)
+{
+    std::array<std::uint8_t, field<std::uint16_t>::size> buf;
+    if(offset < dat_file_header::size + field<uint48_t>::size +
+        buf.size())
+    {
+        ec = error::invalid_spill_size;
+        return;
+    }
+    df.read(offset - buf.size(), buf.data(), buf.size(), ec);
+    if(ec)
+        return;
+    istream is{buf.data(), buf.size()};
+    std::uint16_t size;
+    read<std::uint16_t>(is, size);              // Size
+    if(size != spillSize)
+    {
+        ec = error::invalid_spill_size;
+        return;
+    }
+    b.read(df, offset, ec);
+}
+
 // Normal verify that does not require a buffer
 //
 template<
@@ -37,6 +156,7 @@ verify_normal(
     File& kf,
     dat_file_header& dh,
     key_file_header& kh,
+    std::size_t threads,
     Progress&& progress,
     error_code& ec)
 {
@@ -63,216 +183,177 @@ verify_normal(
     std::uint64_t work = 0;
     progress(0, nwork);
 
-    // Iterate Data File
     // Data Record
     auto const dh_len =
         field<uint48_t>::size + // Size
         kh.key_size;            // Key
-    std::uint64_t fetches = 0;
-    buffer buf{kh.block_size + dh_len};
-    bucket b{kh.block_size, buf.get()};
-    std::uint8_t* pd = buf.get() + kh.block_size;
-    {
-        bulk_reader<File> r{df, dat_file_header::size,
-            info.dat_file_size, readSize};
-        while(! r.eof())
+    std::vector<verify_counts> counts(threads);
+    std::vector<buffer> bufs;
+    for(std::size_t i = 0; i < threads; ++i)
+        bufs.emplace_back(kh.block_size + dh_len);
+
+    // Iterate Data File
+    auto const check =
+        [&](std::size_t i, noff_t offset,
+            nsize_t size, std::uint8_t const* key)
         {
-            auto const offset = r.offset();
-            // Data Record or Spill Record
-            auto is = r.prepare(
-                field<uint48_t>::size, ec); // Size
-            if(ec)
+            auto& c = counts[i];
+            bucket b{kh.block_size, bufs[i].get(), kh.version};
+            auto const h = hash<Hasher>(
+                key, kh.key_size, kh.salt);
+            // Check bucket and spills
+            auto const n = bucket_index(
+                h, kh.buckets, kh.modulus);
+            b.read(kf,
+                   static_cast<noff_t>(n + 1) * kh.block_size, c.ec);
+            if(c.ec)
                 return;
-            nsize_t size;
-            read_size48(is, size);
-            if(size > 0)
-            {
-                // Data Record
-                is = r.prepare(
-                    kh.key_size +           // Key
-                    size, ec);              // Data
-                if(ec)
-                    return;
-                std::uint8_t const* const key =
-                    is.data(kh.key_size);
-                std::uint8_t const* const data =
-                    is.data(size);
-                (void)data;
-                auto const h = hash<Hasher>(
-                    key, kh.key_size, kh.salt);
-                // Check bucket and spills
-                auto const n = bucket_index(
-                    h, kh.buckets, kh.modulus);
-                b.read(kf,
-                       static_cast<noff_t>(n + 1) * kh.block_size, ec);
-                if(ec)
-                    return;
-                work += kh.block_size;
-                ++fetches;
-                for(;;)
-                {
-                    for(auto i = b.lower_bound(h);
-                        i < b.size(); ++i)
-                    {
-                        auto const item = b[i];
-                        if(item.hash != h)
-                            break;
-                        if(item.offset == offset)
-                            goto found;
-                        ++fetches;
-                    }
-                    auto const spill = b.spill();
-                    if(! spill)
-                    {
-                        ec = error::orphaned_value;
-                        return;
-                    }
-                    b.read(df, spill, ec);
-                    if(ec == error::short_read)
-                    {
-                        ec = error::short_spill;
-                        return;
-                    }
-                    if(ec)
-                        return;
-                    ++fetches;
-                }
-            found:
-                // Update
-                ++info.value_count;
-                info.value_bytes += size;
-            }
-            else
+            ++c.fetches;
+            for(;;)
             {
-                // Spill Record
-                is = r.prepare(
-                    field<std::uint16_t>::size, ec);
-                if(ec == error::short_read)
+                for(auto j = b.lower_bound(h);
+                    j < b.size(); ++j)
                 {
-                    ec = error::short_spill;
-                    return;
+                    auto const item = b[j];
+                    if(item.hash != h)
+                        break;
+                    if(item.offset == offset)
+                        goto found;
+                    ++c.fetches;
                 }
-                if(ec)
-                    return;
-                read<std::uint16_t>(is, size);  // Size
-                if(size != info.bucket_size)
+                auto const spill = b.spill();
+                if(! spill)
                 {
-                    ec = error::invalid_spill_size;
+                    c.ec = error::orphaned_value;
                     return;
                 }
-                if(ec)
+                verify_spill(df, spill, b, info.bucket_size, c.ec);
+                if(c.ec == error::short_read)
+                    c.ec = error::short_spill;
+                if(c.ec)
                     return;
-                b.read(r, ec);                  // Bucket
-                if(ec == error::short_read)
+                ++c.fetches;
+            }
+        found:
+            // Update
+            ++c.value_count;
+            c.value_bytes += size;
+        };
+    scan_records(df, kh.key_size, kh.version, info.dat_file_size,
+        readSize, threads,
+        [&](std::size_t i, noff_t offset,
+            nsize_t size, std::uint8_t const* key)
+        {
+            check(i, offset, size, key);
+            return ! counts[i].ec;
+        },
+        [&](nsize_t size)
+        {
+            ++info.spill_count_tot;
+            info.spill_bytes_tot +=
+                field<uint48_t>::size +     // Zero
+                field<uint16_t>::size +     // Size
+                size;                       // Bucket
+        },
+        [&](noff_t offset, error_code& ec1)
+        {
+            for(auto const& c : counts)
+            {
+                if(c.ec)
                 {
-                    ec = error::short_spill;
+                    ec1 = c.ec;
                     return;
                 }
-                if(ec)
-                    return;
-                ++info.spill_count_tot;
-                info.spill_bytes_tot +=
-                    field<uint48_t>::size +     // Zero
-                    field<uint16_t>::size +     // Size
-                    b.actual_size();            // Bucket
             }
+            // The key file reads of the records
+            // are counted with the scan.
             progress(work + offset, nwork);
-        }
-        work += info.dat_file_size;
-    }
+        }, ec);
+    if(ec)
+        return;
+    work += info.dat_file_size;
 
     // Iterate Key File
-    {
-        for(std::size_t n = 0; n < kh.buckets; ++n)
+    std::mutex pm;
+    parallel_for(threads,
+        [&](std::size_t i)
         {
-            std::size_t nspill = 0;
-            b.read(kf, static_cast<noff_t>(
-                n + 1) * kh.block_size, ec);
-            if(ec)
-                return;
-            work += static_cast<std::uint64_t>(
-                adjust * kh.block_size);
-            bool spill = false;
-            for(;;)
+            auto& c = counts[i];
+            bucket b{kh.block_size, bufs[i].get(), kh.version};
+            std::uint8_t* pd = bufs[i].get() + kh.block_size;
+            auto const n0 = kh.buckets * i / threads;
+            auto const n1 = kh.buckets * (i + 1) / threads;
+            for(auto n = n0; n < n1; ++n)
             {
-                info.key_count += b.size();
-                for(nkey_t i = 0; i < b.size(); ++i)
+                std::uint64_t w = 0;
+                std::size_t nspill = 0;
+                b.read(kf, static_cast<noff_t>(
+                    n + 1) * kh.block_size, c.ec);
+                if(c.ec)
+                    return;
+                w += static_cast<std::uint64_t>(
+                    adjust * kh.block_size);
+                bool spill = false;
+                for(;;)
                 {
-                    auto const e = b[i];
-                    df.read(e.offset, pd, dh_len, ec);
-                    if(ec == error::short_read)
+                    c.key_count += b.size();
+                    for(nkey_t j = 0; j < b.size(); ++j)
                     {
-                        ec = error::missing_value;
-                        return;
+                        auto const e = b[j];
+                        df.read(e.offset, pd, dh_len, c.ec);
+                        if(c.ec == error::short_read)
+                            c.ec = error::missing_value;
+                        if(c.ec)
+                            return;
+                        if(! spill)
+                            w += static_cast<std::uint64_t>(
+                                adjust * kh.block_size);
+                        // Data Record
+                        istream is{pd, dh_len};
+                        std::uint64_t size;
+                        // VFALCO This should really be a 32-bit field
+                        read<uint48_t>(is, size);   // Size
+                        void const* key =
+                            is.data(kh.key_size);   // Key
+                        if(size != e.size)
+                        {
+                            c.ec = error::size_mismatch;
+                            return;
+                        }
+                        auto const h = hash<Hasher>(key,
+                            kh.key_size, kh.salt);
+                        if(h != e.hash)
+                        {
+                            c.ec = error::hash_mismatch;
+                            return;
+                        }
                     }
-                    if(ec)
+                    if(! b.spill())
+                        break;
+                    verify_spill(df, b.spill(),
+                        b, info.bucket_size, c.ec);
+                    if(c.ec)
                         return;
-                    if(! spill)
-                        work += static_cast<std::uint64_t>(
-                            adjust * kh.block_size);
-                    // Data Record
-                    istream is{pd, dh_len};
-                    std::uint64_t size;
-                    // VFALCO This should really be a 32-bit field
-                    read<uint48_t>(is, size);   // Size
-                    void const* key =
-                        is.data(kh.key_size);   // Key
-                    if(size != e.size)
-                    {
-                        ec = error::size_mismatch;
-                        return;
-                    }
-                    auto const h = hash<Hasher>(key,
-                        kh.key_size, kh.salt);
-                    if(h != e.hash)
-                    {
-                        ec = error::hash_mismatch;
-                        return;
-                    }
+                    spill = true;
+                    ++nspill;
+                    ++c.spill_count;
+                    c.spill_bytes +=
+                        field<uint48_t>::size + // Zero
+                        field<uint16_t>::size + // Size
+                        b.actual_size();        // SpillBucket
                 }
-                if(! b.spill())
-                    break;
-                b.read(df, b.spill(), ec);
-                if(ec)
-                    return;
-                spill = true;
-                ++nspill;
-                ++info.spill_count;
-                info.spill_bytes +=
-                    field<uint48_t>::size + // Zero
-                    field<uint16_t>::size + // Size
-                    b.actual_size();        // SpillBucket
+                if(nspill >= c.hist.size())
+                    nspill = c.hist.size() - 1;
+                ++c.hist[nspill];
+                std::lock_guard<std::mutex> lock{pm};
+                work += w;
+                progress(work, nwork);
             }
-            if(nspill >= info.hist.size())
-                nspill = info.hist.size() - 1;
-            ++info.hist[nspill];
-            progress(work, nwork);
-        }
-    }
-    float sum = 0;
-    for(size_t i = 0; i < info.hist.size(); ++i)
-        sum += info.hist[i] * (i + 1);
-    if(info.value_count)
-        info.avg_fetch =
-            float(fetches) / info.value_count;
-    else
-        info.avg_fetch = 0;
-    info.waste = (info.spill_bytes_tot - info.spill_bytes) /
-        float(info.dat_file_size);
-    if(info.value_count)
-        info.overhead =
-            float(info.key_file_size + info.dat_file_size) /
-            (
-                info.value_bytes +
-                info.key_count *
-                    (info.key_size +
-                    // Data Record
-                     field<uint48_t>::size) // Size
-                        ) - 1;
-    else
-        info.overhead = 0;
-    info.actual_load = info.key_count / float(
-        info.capacity * info.buckets);
+        });
+    auto const fetches = verify_merge(info, counts, ec);
+    if(ec)
+        return;
+    verify_finish(info, fetches);
 }
 
 // Fast version of verify that uses a buffer
@@ -286,6 +367,7 @@ verify_fast(
     dat_file_header& dh,
     key_file_header& kh,
     std::size_t bufferSize,
+    std::size_t threads,
     Progress&& progress,
     error_code& ec)
 {
@@ -295,24 +377,25 @@ verify_fast(
     auto const readSize = 1024 * kh.block_size;
 
     // Counts unverified keys per bucket
-    if(kh.buckets > std::numeric_limits<nbuck_t>::max())
+    if(kh.buckets > std::numeric_limits<std::size_t>::max())
     {
         ec = error::too_many_buckets;
         return;
     }
-    std::unique_ptr<nkey_t[]> nkeys(
-        new nkey_t[kh.buckets]);
 
     // Verify contiguous sequential sections of the
     // key file using multiple passes over the data.
     //
     if(bufferSize < 2 * kh.block_size + sizeof(nkey_t))
         throw std::logic_error("invalid buffer size");
-    auto chunkSize = std::min(kh.buckets,
-        (bufferSize - kh.block_size) /
-            (kh.block_size + sizeof(nkey_t)));
+    auto chunkSize = static_cast<std::size_t>(
+        std::min<nbuck_t>(kh.buckets,
+            (bufferSize - kh.block_size) /
+                (kh.block_size + sizeof(nkey_t))));
     auto const passes =
         (kh.buckets + chunkSize - 1) / chunkSize;
+    std::unique_ptr<std::atomic<nkey_t>[]> nkeys(
+        new std::atomic<nkey_t>[chunkSize]);
 
     // Calculate the work required
     std::uint64_t work = 0;
@@ -320,16 +403,16 @@ verify_fast(
         passes * info.dat_file_size + info.key_file_size;
     progress(0, nwork);
 
-    std::uint64_t fetches = 0;
-    buffer buf{(chunkSize + 1) * kh.block_size};
-    bucket tmp{kh.block_size,
-        buf.get() + chunkSize * kh.block_size};
-    for(nsize_t b0 = 0; b0 < kh.buckets; b0 += chunkSize)
+    std::vector<verify_counts> counts(threads);
+    buffer buf{chunkSize * kh.block_size};
+    // Each thread reads spill records into its own block
+    buffer tbuf{threads * kh.block_size};
+    for(nbuck_t b0 = 0; b0 < kh.buckets; b0 += chunkSize)
     {
         // Load key file chunk to buffer
-        auto const b1 = std::min(b0 + chunkSize, kh.buckets);
+        auto const b1 = std::min<nbuck_t>(b0 + chunkSize, kh.buckets);
         // Buffered range is [b0, b1)
-        auto const bn = b1 - b0;
+        auto const bn = static_cast<std::size_t>(b1 - b0);
         kf.read(
             static_cast<noff_t>(b0 + 1) * kh.block_size,
             buf.get(),
@@ -340,83 +423,70 @@ verify_fast(
         work += bn * kh.block_size;
         progress(work, nwork);
         // Count keys in buckets, including spills
-        for(nbuck_t i = 0 ; i < bn; ++i)
-        {
-            bucket b{kh.block_size,
-                buf.get() + i * kh.block_size};
-            nkeys[i] = b.size();
-            std::size_t nspill = 0;
-            auto spill = b.spill();
-            while(spill != 0)
+        auto const nt = std::max<std::size_t>(
+            1, std::min(threads, bn / 64));
+        parallel_for(nt,
+            [&](std::size_t t)
             {
-                tmp.read(df, spill, ec);
-                if(ec == error::short_read)
+                auto& c = counts[t];
+                bucket tmp{kh.block_size, tbuf.get() +
+                    t * kh.block_size, kh.version};
+                auto const last = bn * (t + 1) / nt;
+                for(auto i = bn * t / nt; i < last; ++i)
                 {
-                    ec = error::short_spill;
-                    return;
+                    bucket b{kh.block_size,
+                        buf.get() + i * kh.block_size, kh.version};
+                    nkey_t nkey = b.size();
+                    std::size_t nspill = 0;
+                    auto spill = b.spill();
+                    while(spill != 0)
+                    {
+                        verify_spill(df, spill,
+                            tmp, info.bucket_size, c.ec);
+                        if(c.ec == error::short_read)
+                            c.ec = error::short_spill;
+                        if(c.ec)
+                            return;
+                        nkey += tmp.size();
+                        spill = tmp.spill();
+                        ++nspill;
+                        ++c.spill_count;
+                        c.spill_bytes +=
+                            field<uint48_t>::size + // Zero
+                            field<uint16_t>::size + // Size
+                            tmp.actual_size();      // SpillBucket
+                    }
+                    if(nspill >= c.hist.size())
+                        nspill = c.hist.size() - 1;
+                    ++c.hist[nspill];
+                    c.key_count += nkey;
+                    nkeys[i].store(nkey, std::memory_order_relaxed);
                 }
-                if(ec)
-                    return;
-                nkeys[i] += tmp.size();
-                spill = tmp.spill();
-                ++nspill;
-                ++info.spill_count;
-                info.spill_bytes +=
-                    field<uint48_t>::size + // Zero
-                    field<uint16_t>::size + // Size
-                    tmp.actual_size();      // SpillBucket
-            }
-            if(nspill >= info.hist.size())
-                nspill = info.hist.size() - 1;
-            ++info.hist[nspill];
-            info.key_count += nkeys[i];
-        }
-        // Iterate Data File
-        bulk_reader<File> r(df, dat_file_header::size,
-            info.dat_file_size, readSize);
-        while(! r.eof())
+            });
+        for(auto const& c : counts)
         {
-            auto const offset = r.offset();
-            // Data Record or Spill Record
-            auto is = r.prepare(
-                field<uint48_t>::size, ec); // Size
-            if(ec == error::short_read)
+            if(c.ec)
             {
-                ec = error::short_data_record;
+                ec = c.ec;
                 return;
             }
-            if(ec)
-                return;
-            nsize_t size;
-            detail::read_size48(is, size);
-            if(size > 0)
+        }
+        // Iterate Data File
+        auto const check =
+            [&](std::size_t t, noff_t offset,
+                nsize_t size, std::uint8_t const* key)
             {
-                // Data Record
-                is = r.prepare(
-                    kh.key_size +           // Key
-                    size, ec);              // Data
-                if(ec == error::short_read)
-                {
-                    ec = error::short_value;
-                    return;
-                }
-                if(ec)
-                    return;
-                std::uint8_t const* const key =
-                    is.data(kh.key_size);
-                std::uint8_t const* const data =
-                    is.data(size);
-                (void)data;
+                auto& c = counts[t];
                 auto const h = hash<Hasher>(
                     key, kh.key_size, kh.salt);
                 auto const n = bucket_index(
                     h, kh.buckets, kh.modulus);
                 if(n < b0 || n >= b1)
-                    continue;
+                    return;
                 // Check bucket and spills
                 bucket b{kh.block_size, buf.get() +
-                    (n - b0) * kh.block_size};
-                ++fetches;
+                    (n - b0) * kh.block_size, kh.version};
+                ++c.fetches;
                 for(;;)
                 {
                     for(auto i = b.lower_bound(h);
@@ -427,77 +497,67 @@ verify_fast(
                             break;
                         if(item.offset == offset)
                             goto found;
-                        ++fetches;
+                        ++c.fetches;
                     }
                     auto const spill = b.spill();
                     if(! spill)
                     {
-                        ec = error::orphaned_value;
-                        return;
-                    }
-                    b = tmp;
-                    b.read(df, spill, ec);
-                    if(ec == error::short_read)
-                    {
-                        ec = error::short_spill;
+                        c.ec = error::orphaned_value;
                         return;
                     }
-                    if(ec)
+                    b = bucket{kh.block_size, tbuf.get() +
+                        t * kh.block_size, kh.version};
+                    b.read(df, spill, c.ec);
+                    if(c.ec == error::short_read)
+                        c.ec = error::short_spill;
+                    if(c.ec)
                         return;
-                    ++fetches;
+                    ++c.fetches;
                 }
             found:
                 // Update
-                ++info.value_count;
-                info.value_bytes += size;
-                if(nkeys[n - b0]-- == 0)
-                {
-                    ec = error::orphaned_value;
-                    return;
-                }
-            }
-            else
+                ++c.value_count;
+                c.value_bytes += size;
+                if(nkeys[n - b0].fetch_sub(1,
+                        std::memory_order_relaxed) == 0)
+                    c.ec = error::orphaned_value;
+            };
+        scan_records(df, kh.key_size, kh.version, info.dat_file_size,
+            readSize, threads,
+            [&](std::size_t t, noff_t offset,
+                nsize_t size, std::uint8_t const* key)
             {
-                // Spill Record
-                is = r.prepare(
-                    field<std::uint16_t>::size, ec);
-                if(ec == error::short_read)
-                {
-                    ec = error::short_spill;
-                    return;
-                }
-                if(ec)
-                    return;
-                read<std::uint16_t>(is, size);      // Size
-                if(bucket_size(
-                    bucket_capacity(size)) != size)
-                {
-                    ec = error::invalid_spill_size;
-                    return;
-                }
-                r.prepare(size, ec);                // Bucket
-                if(ec == error::short_read)
-                {
-                    ec = error::short_spill;
-                    return;
-                }
-                if(ec)
+                check(t, offset, size, key);
+                return ! counts[t].ec;
+            },
+            [&](nsize_t size)
+            {
+                if(b0 != 0)
                     return;
-                if(b0 == 0)
+                ++info.spill_count_tot;
+                info.spill_bytes_tot +=
+                    field<uint48_t>::size +     // Zero
+                    field<uint16_t>::size +     // Size
+                    size;                       // Bucket
+            },
+            [&](noff_t offset, error_code& ec1)
+            {
+                for(auto const& c : counts)
                 {
-                    ++info.spill_count_tot;
-                    info.spill_bytes_tot +=
-                        field<uint48_t>::size +     // Zero
-                        field<uint16_t>::size +     // Size
-                        tmp.actual_size();          // Bucket
+                    if(c.ec)
+                    {
+                        ec1 = c.ec;
+                        return;
+                    }
                 }
-            }
-            progress(work + offset, nwork);
-        }
+                progress(work + offset, nwork);
+            }, ec);
+        if(ec)
+            return;
         // Make sure every key in every bucket was visited
         for(std::size_t i = 0; i < bn; ++i)
         {
-            if(nkeys[i] != 0)
+            if(nkeys[i].load(std::memory_order_relaxed) != 0)
             {
                 ec = error::missing_value;
                 return;
@@ -505,31 +565,10 @@ verify_fast(
         }
         work += info.dat_file_size;
     }
-
-    float sum = 0;
-    for(std::size_t i = 0; i < info.hist.size(); ++i)
-        sum += info.hist[i] * (i + 1);
-    if(info.value_count)
-        info.avg_fetch =
-            float(fetches) / info.value_count;
-    else
-        info.avg_fetch = 0;
-    info.waste = (info.spill_bytes_tot - info.spill_bytes) /
-        float(info.dat_file_size);
-    if(info.value_count)
-        info.overhead =
-            float(info.key_file_size + info.dat_file_size) /
-            (
-                info.value_bytes +
-                info.key_count *
-                    (info.key_size +
-                    // Data Record
-                     field<uint48_t>::size) // Size
-                        ) - 1;
-    else
-        info.overhead = 0;
-    info.actual_load = info.key_count / float(
-        info.capacity * info.buckets);
+    auto const fetches = verify_merge(info, counts, ec);
+    if(ec)
+        return;
+    verify_finish(info, fetches);
 }
 
 } // detail
@@ -543,6 +582,21 @@ verify(
     std::size_t bufferSize,
     Progress&& progress,
     error_code& ec)
+{
+    verify<Hasher>(info, dat_path, key_path,
+        bufferSize, 1, progress, ec);
+}
+
+template<class Hasher, class Progress>
+void
+verify(
+    verify_info& info,
+    path_type const& dat_path,
+    path_type const& key_path,
+    std::size_t bufferSize,
+    std::size_t threads,
+    Progress&& progress,
+    error_code& ec)
 {
     static_assert(is_Hasher<Hasher>::value,
         "Hasher requirements not met");
@@ -588,21 +642,25 @@ verify(
     info.load_factor = kh.load_factor / 65536.f;
     info.capacity = kh.capacity;
     info.buckets = kh.buckets;
-    info.bucket_size = bucket_size(kh.capacity);
+    info.bucket_size = bucket_size(kh.capacity, kh.version);
     info.key_file_size = kf.size(ec);
     if(ec)
         return;
     info.dat_file_size = df.size(ec);
     if(ec)
         return;
+    if(threads == 0)
+        threads = std::max<std::size_t>(1,
+            std::thread::hardware_concurrency());
 
     // Determine which algorithm requires the least amount
     // of file I/O given the available buffer size
     std::size_t chunkSize;
     if(bufferSize >= 2 * kh.block_size + sizeof(nkey_t))
-        chunkSize = std::min(kh.buckets,
-            (bufferSize - kh.block_size) /
-                (kh.block_size + sizeof(nkey_t)));
+        chunkSize = static_cast<std::size_t>(
+            std::min<nbuck_t>(kh.buckets,
+                (bufferSize - kh.block_size) /
+                    (kh.block_size + sizeof(nkey_t))));
     else
         chunkSize = 0;
     std::size_t passes;
@@ -620,12 +678,12 @@ verify(
         )))
     {
         detail::verify_normal<Hasher>(info,
-            df, kf, dh, kh, progress, ec);
+            df, kf, dh, kh, threads, progress, ec);
     }
     else
     {
         detail::verify_fast<Hasher>(info,
-            df, kf, dh, kh, bufferSize, progress, ec);
+            df, kf, dh, kh, bufferSize, threads, progress, ec);
     }
 }
 
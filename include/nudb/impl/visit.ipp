@@ -14,9 +14,12 @@
 #include <nudb/native_file.hpp>
 #include <nudb/detail/bulkio.hpp>
 #include <nudb/detail/format.hpp>
+#include <nudb/detail/scan.hpp>
 #include <algorithm>
 #include <cstddef>
 #include <string>
+#include <thread>
+#include <vector>
 
 namespace nudb {
 
@@ -91,6 +94,69 @@ visit(
     }
 }
 
+template<
+    class Callback,
+    class Progress>
+void
+visit_parallel(
+    path_type const& path,
+    std::size_t threads,
+    Callback&& callback,
+    Progress&& progress,
+    error_code& ec)
+{
+    // VFALCO Need concept check for Callback
+    static_assert(is_Progress<Progress>::value,
+        "Progress requirements not met");
+    using namespace detail;
+    using File = native_file;
+    if(threads == 0)
+        threads = std::max<std::size_t>(
+            1, std::thread::hardware_concurrency());
+    auto const readSize = 1024 * block_size(path);
+    File df;
+    df.open(file_mode::scan, path, ec);
+    if(ec)
+        return;
+    dat_file_header dh;
+    read(df, dh, ec);
+    if(ec)
+        return;
+    verify(dh, ec);
+    if(ec)
+        return;
+    auto const fileSize = df.size(ec);
+    if(ec)
+        return;
+    // Each thread reports its own error
+    std::vector<error_code> errors(threads);
+    progress(0, fileSize);
+    scan_records(df, dh.key_size, dh.version, fileSize,
+        readSize, threads,
+        [&](std::size_t i, noff_t,
+            nsize_t size, std::uint8_t const* p)
+        {
+            callback(p, dh.key_size,
+                p + dh.key_size, size, errors[i]);
+            return ! errors[i];
+        },
+        [](nsize_t)
+        {
+        },
+        [&](noff_t offset, error_code& ec1)
+        {
+            for(auto const& e : errors)
+            {
+                if(e)
+                {
+                    ec1 = e;
+                    return;
+                }
+            }
+            progress(offset, fileSize);
+        }, ec);
+}
+
 } // nudb
 
 #endif
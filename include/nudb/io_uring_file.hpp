@@ -0,0 +1,316 @@
+//
+// Copyright (c) 2015-2016 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef NUDB_IO_URING_FILE_HPP
+#define NUDB_IO_URING_FILE_HPP
+
+#include <nudb/file.hpp>
+#include <nudb/error.hpp>
+#include <nudb/posix_file.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#ifndef NUDB_IO_URING_FILE
+# if NUDB_POSIX_FILE && defined(__linux__) && defined(__has_include)
+#  if __has_include(<linux/io_uring.h>)
+#   define NUDB_IO_URING_FILE 1
+#  else
+#   define NUDB_IO_URING_FILE 0
+#  endif
+# else
+#  define NUDB_IO_URING_FILE 0
+# endif
+#endif
+
+#if NUDB_IO_URING_FILE
+
+#include <nudb/detail/uring.hpp>
+
+namespace nudb {
+
+/** A file which performs its I/O through a Linux io_uring.
+
+    This class provides an implementation of the @b File concept
+    where reads, writes, and synchronization are submitted to and
+    reaped from a ring shared with the kernel, instead of being
+    issued as individual `pread`, `pwrite` and `fsync` system calls.
+    Opening, creating, sizing and truncating the file are delegated
+    to @ref posix_file.
+
+    Each open file owns one ring. Any number of threads may perform
+    I/O on the file concurrently; while one thread waits in the
+    kernel for completions, requests from other threads are queued
+    on the same ring and reaped together.
+
+    With @ref io_uring_options::sqpoll set, a kernel thread polls
+    the submission queue and requests are issued without entering
+    the kernel at all while that thread is awake.
+
+    @note Requires Linux 5.6 or later.
+*/
+class io_uring_file
+{
+    posix_file f_;
+    io_uring_options opts_;
+    std::unique_ptr<detail::uring> ring_;
+
+public:
+    /// Constructor
+    io_uring_file() = default;
+
+    /** Constructor
+
+        @param opts The options used when the ring is
+        created for this file.
+    */
+    explicit
+    io_uring_file(io_uring_options const& opts)
+        : opts_(opts)
+    {
+    }
+
+    /// Copy constructor (disallowed)
+    io_uring_file(io_uring_file const&) = delete;
+
+    // Copy assignment (disallowed)
+    io_uring_file& operator=(io_uring_file const&) = delete;
+
+    /** Destructor.
+
+        If open, the file is closed.
+    */
+    ~io_uring_file();
+
+    /** Move constructor.
+
+        @note The state of the moved-from object is as if default constructed.
+    */
+    io_uring_file(io_uring_file&&);
+
+    /** Move assignment.
+
+        @note The state of the moved-from object is as if default constructed.
+    */
+    io_uring_file&
+    operator=(io_uring_file&& other);
+
+    /// Returns `true` if the file is open.
+    bool
+    is_open() const
+    {
+        return f_.is_open();
+    }
+
+    /// Close the file if it is open.
+    void
+    close();
+
+    /** Create a new file.
+
+        After the file is created, it is opened as if by `open(mode, path, ec)`.
+
+        @par Requirements
+
+        The file must not already exist, or else `errc::file_exists`
+        is returned.
+
+        @param mode The open mode, which must be a valid @ref file_mode.
+
+        @param path The path of the file to create.
+
+        @param ec Set to the error, if any occurred.
+    */
+    void
+    create(file_mode mode, path_type const& path, error_code& ec);
+
+    /** Open a file.
+
+        @par Requirements
+
+        The file must not already be open.
+
+        @param mode The open mode, which must be a valid @ref file_mode.
+
+        @param path The path of the file to open.
+
+        @param ec Set to the error, if any occurred.
+    */
+    void
+    open(file_mode mode, path_type const& path, error_code& ec);
+
+    /** Remove a file from the file system.
+
+        It is not an error to attempt to erase a file that does not exist.
+
+        @param path The path of the file to remove.
+
+        @param ec Set to the error, if any occurred.
+    */
+    static
+    void
+    erase(path_type const& path, error_code& ec)
+    {
+        posix_file::erase(path, ec);
+    }
+
+    /** Return the size of the file.
+
+        @par Requirements
+
+        The file must be open.
+
+        @param ec Set to the error, if any occurred.
+
+        @return The size of the file, in bytes.
+    */
+    std::uint64_t
+    size(error_code& ec) const
+    {
+        return f_.size(ec);
+    }
+
+    /** Read data from a location in the file.
+
+        @par Requirements
+
+        The file must be open.
+
+        @param offset The position in the file to read from,
+        expressed as a byte offset from the beginning.
+
+        @param buffer The location to store the data.
+
+        @param bytes The number of bytes to read.
+
+        @param ec Set to the error, if any occurred.
+    */
+    void
+    read(std::uint64_t offset,
+        void* buffer, std::size_t bytes, error_code& ec);
+
+    /** Start an asynchronous read from a location in the file.
+
+        The read is queued on the ring and this function returns
+        immediately. The handler is invoked with the result from
+        within a later call to @ref poll or @ref run_one, after
+        all of the requested bytes have been read.
+
+        @par Requirements
+
+        The file must be open, and the buffer must remain
+        valid until the handler is invoked.
+
+        @param offset The position in the file to read from,
+        expressed as a byte offset from the beginning.
+
+        @param buffer The location to store the data.
+
+        @param bytes The number of bytes to read.
+
+        @param handler The function to invoke upon completion.
+        It must have this equivalent signature:
+        @code
+        void handler(error_code const& ec);
+        @endcode
+    */
+    void
+    async_read(std::uint64_t offset, void* buffer, std::size_t bytes,
+        std::function<void(error_code const&)> handler);
+
+    /** Invoke the handlers of completed asynchronous reads.
+
+        Queued reads are submitted to the kernel. This function
+        does not block.
+
+        @return The number of handlers invoked.
+    */
+    std::size_t
+    poll();
+
+    /** Block until at least one asynchronous read completes.
+
+        The handlers of all completed reads are invoked. If no
+        reads are outstanding, returns immediately.
+
+        @return The number of handlers invoked.
+    */
+    std::size_t
+    run_one();
+
+    /** Write data to a location in the file.
+
+        @par Requirements
+
+        The file must be open with a mode allowing writes.
+
+        @param offset The position in the file to write from,
+        expressed as a byte offset from the beginning.
+
+        @param buffer The data the write.
+
+        @param bytes The number of bytes to write.
+
+        @param ec Set to the error, if any occurred.
+    */
+    void
+    write(std::uint64_t offset,
+        void const* buffer, std::size_t bytes, error_code& ec);
+
+    /** Perform a low level file synchronization.
+
+        @par Requirements
+
+        The file must be open with a mode allowing writes.
+
+        @param ec Set to the error, if any occurred.
+    */
+    void
+    sync(error_code& ec);
+
+    /// Synchronize the file data, see @ref posix_file::sync_data.
+    void
+    sync_data(error_code& ec);
+
+    /// Write out the file data, see @ref posix_file::sync_range.
+    void
+    sync_range(error_code& ec)
+    {
+        f_.sync_range(ec);
+    }
+
+    /** Truncate the file at a specific size.
+
+        @par Requirements
+
+        The file must be open with a mode allowing writes.
+
+        @param length The new file size.
+
+        @param ec Set to the error, if any occurred.
+    */
+    void
+    trunc(std::uint64_t length, error_code& ec)
+    {
+        f_.trunc(length, ec);
+    }
+
+private:
+    struct read_op;
+
+    void
+    start(error_code& ec);
+};
+
+} // nudb
+
+#include <nudb/impl/io_uring_file.ipp>
+
+#endif
+
+#endif
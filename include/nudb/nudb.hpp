@@ -8,10 +8,13 @@
 #ifndef NUDB_HPP
 #define NUDB_HPP
 
+#include <nudb/bulk_load.hpp>
 #include <nudb/concepts.hpp>
 #include <nudb/create.hpp>
+#include <nudb/direct_file.hpp>
 #include <nudb/error.hpp>
 #include <nudb/file.hpp>
+#include <nudb/io_uring_file.hpp>
 #include <nudb/posix_file.hpp>
 #include <nudb/progress.hpp>
 #include <nudb/recover.hpp>
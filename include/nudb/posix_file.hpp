@@ -75,6 +75,13 @@ public:
         return fd_ != -1;
     }
 
+    /// Returns the native file descriptor, or -1 if closed.
+    int
+    native_handle() const
+    {
+        return fd_;
+    }
+
     /// Close the file if it is open.
     void
     close();
@@ -186,6 +193,29 @@ public:
     void
     sync(error_code& ec);
 
+    /** Synchronize the file data.
+
+        This is like @ref sync, except that metadata which
+        is not needed to read the data, such as the time of
+        the last modification, is not synchronized.
+
+        @param ec Set to the error, if any occurred.
+    */
+    void
+    sync_data(error_code& ec);
+
+    /** Write out the file data and wait for completion.
+
+        Dirty pages of the file are written to the device,
+        without flushing the file metadata or the device write
+        cache. Where `sync_file_range` is not available, this
+        is the same as @ref sync_data.
+
+        @param ec Set to the error, if any occurred.
+    */
+    void
+    sync_range(error_code& ec);
+
     /** Truncate the file at a specific size.
 
         @par Requirements
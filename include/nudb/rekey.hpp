@@ -103,6 +103,208 @@ rekey(
     Progress&& progress,
     Args&&... args);
 
+/** Create a new key file of a chosen format from a data file.
+
+    This algorithm rebuilds a key file for the given data file.
+    It works efficiently by iterating the data file multiple times.
+    During the iteration, a contiguous block of the key file is
+    rendered in memory, then flushed to disk when the iteration is
+    complete. The size of this memory buffer is controlled by the
+    `bufferSize` parameter, larger is better. The algorithm works
+    the fastest when `bufferSize` is large enough to hold the entire
+    key file in memory; only a single iteration of the data file
+    is needed in this case.
+
+    During the rekey, spill records may be appended to the data
+    file. If the rekey operation is abnormally terminated, this
+    would normally result in a corrupted data file. To prevent this,
+    the function creates a log file using the specified path so
+    that the database can be fixed in a subsequent call to
+    @ref recover.
+
+    @note If a log file is already present, this function will
+    fail with @ref error::log_file_exists.
+
+    @par Template Parameters
+
+    @tparam Hasher The hash function to use. This type must
+    meet the requirements of @b Hasher. The hash function
+    must be the same as that used to create the database, or
+    else an error is returned.
+
+    @tparam File The type of file to use. This type must meet
+    the requirements of @b File.
+
+    @param dat_path The path to the data file.
+
+    @param key_path The path to the key file.
+
+    @param log_path The path to the log file.
+
+    @param blockSize The size of a key file block. Larger
+    blocks hold more keys but require more I/O cycles per
+    operation. The ideal block size the largest size that
+    may be read in a single I/O cycle, and device dependent.
+    The return value of @ref block_size returns a suitable
+    value for the volume of a given path.
+
+    @param loadFactor A number between zero and one
+    representing the average bucket occupancy (number of
+    items). A value of 0.5 is perfect. Lower numbers
+    waste space, and higher numbers produce negligible
+    savings at the cost of increased I/O cycles.
+
+    @param itemCount The number of items in the data file.
+
+    @param bufferSize The number of bytes to allocate for the buffer.
+
+    @param version The version of the key file format, 2 or 3.
+    The other overload writes a version 2 key file. See
+    @ref create for a description of the formats.
+
+    @param ec Set to the error if any occurred.
+
+    @param progress A function which will be called periodically
+    as the algorithm proceeds. The equivalent signature of the
+    progress function must be:
+    @code
+    void progress(
+        std::uint64_t amount,   // Amount of work done so far
+        std::uint64_t total     // Total amount of work to do
+    );
+    @endcode
+
+    @param args Optional arguments passed to @b File constructors.
+*/
+template<
+    class Hasher,
+    class File,
+    class Progress,
+    class... Args
+>
+void
+rekey(
+    path_type const& dat_path,
+    path_type const& key_path,
+    path_type const& log_path,
+    std::size_t blockSize,
+    float loadFactor,
+    std::uint64_t itemCount,
+    std::size_t bufferSize,
+    std::size_t version,
+    error_code& ec,
+    Progress&& progress,
+    Args&&... args);
+
+/** Create a new key file from a data file using several threads.
+
+    This algorithm rebuilds a key file for the given data file.
+    When the `bufferSize` parameter is large enough to hold the
+    entire key file, or when `threads` is one, it works as the
+    overloads without a thread count: the key file is rendered
+    in memory one contiguous block at a time, each block taking
+    an iteration of the data file.
+
+    Otherwise a single iteration of the data file sorts the
+    records by bucket into temporary files, one for each
+    contiguous block of the key file that fits in a thread's
+    share of the buffer. The blocks are then rendered in memory
+    from their files by `threads` threads in parallel, and
+    flushed to disk. Spill records appended to the data file
+    during the rekey are written one at a time.
+
+    The temporary files are created next to the key file, named
+    by appending ".rk" and a number to `key_path`, and are
+    removed before the function returns. Together they need up
+    to 20 bytes of free space for each record in the data file.
+    If a file with one of these names already exists, the
+    function fails and leaves that file in place.
+
+    During the rekey, spill records may be appended to the data
+    file. If the rekey operation is abnormally terminated, this
+    would normally result in a corrupted data file. To prevent this,
+    the function creates a log file using the specified path so
+    that the database can be fixed in a subsequent call to
+    @ref recover.
+
+    @note If a log file is already present, this function will
+    fail with @ref error::log_file_exists.
+
+    @par Template Parameters
+
+    @tparam Hasher The hash function to use. This type must
+    meet the requirements of @b Hasher. The hash function
+    must be the same as that used to create the database, or
+    else an error is returned.
+
+    @tparam File The type of file to use. This type must meet
+    the requirements of @b File.
+
+    @param dat_path The path to the data file.
+
+    @param key_path The path to the key file.
+
+    @param log_path The path to the log file.
+
+    @param blockSize The size of a key file block. Larger
+    blocks hold more keys but require more I/O cycles per
+    operation. The ideal block size the largest size that
+    may be read in a single I/O cycle, and device dependent.
+    The return value of @ref block_size returns a suitable
+    value for the volume of a given path.
+
+    @param loadFactor A number between zero and one
+    representing the average bucket occupancy (number of
+    items). A value of 0.5 is perfect. Lower numbers
+    waste space, and higher numbers produce negligible
+    savings at the cost of increased I/O cycles.
+
+    @param itemCount The number of items in the data file.
+
+    @param bufferSize The number of bytes to allocate for the buffer.
+
+    @param version The version of the key file format, 2 or 3.
+    See @ref create for a description of the formats.
+
+    @param threads The number of threads which render blocks
+    of the key file. Zero uses one thread per hardware thread.
+    One never creates temporary files.
+
+    @param ec Set to the error if any occurred.
+
+    @param progress A function which will be called periodically
+    as the algorithm proceeds. The equivalent signature of the
+    progress function must be:
+    @code
+    void progress(
+        std::uint64_t amount,   // Amount of work done so far
+        std::uint64_t total     // Total amount of work to do
+    );
+    @endcode
+
+    @param args Optional arguments passed to @b File constructors.
+*/
+template<
+    class Hasher,
+    class File,
+    class Progress,
+    class... Args
+>
+void
+rekey(
+    path_type const& dat_path,
+    path_type const& key_path,
+    path_type const& log_path,
+    std::size_t blockSize,
+    float loadFactor,
+    std::uint64_t itemCount,
+    std::size_t bufferSize,
+    std::size_t version,
+    std::size_t threads,
+    error_code& ec,
+    Progress&& progress,
+    Args&&... args);
+
 } // nudb
 
 #include <nudb/impl/rekey.ipp>
@@ -24,10 +24,11 @@ using nhash_t = std::uint64_t;
 
 /** Holds a bucket index or bucket count.
 
-    The maximum number of buckets in a key file is 2^32-1.
+    Bucket indexes are 64 bits wide in memory and in the log
+    file. The number of buckets is practically limited to
+    2^48, the range of the hash which selects a bucket.
 */
-//using nbuck_t = std::uint32_t;
-using nbuck_t = std::size_t;
+using nbuck_t = std::uint64_t;
 
 /** Holds a key index or count in bucket.
 
@@ -193,6 +193,67 @@ verify(
     Progress&& progress,
     error_code& ec);
 
+/** Verify consistency of the key and data files using several threads.
+
+    This performs the same checks as the other overload. The
+    records of the data file are read in large windows by the
+    calling thread, and the records of each window are divided
+    among the threads, which look up their keys in the key
+    file. The buckets of the key file are divided among the
+    threads by index. The statistics gathered by the threads
+    are combined when they finish.
+
+    When the fast algorithm is used, the buffer is shared by
+    the threads. Each window holds 1024 blocks for every thread
+    and is allocated in addition to the buffer.
+
+    @par Template Parameters
+
+    @tparam Hasher The hash function to use. This type must
+    meet the requirements of @b HashFunction. The hash function
+    must be the same as that used to create the database, or
+    else an error is returned.
+
+    @param info A structure which will be default constructed
+    inside this function, and filled in if the operation completes
+    successfully. If an error is indicated, the contents of this
+    variable are undefined.
+
+    @param dat_path The path to the data file.
+
+    @param key_path The path to the key file.
+
+    @param bufferSize The number of bytes to allocate for the buffer.
+    If this number is too small, or zero, a slower algorithm will be
+    used that does not require a buffer.
+
+    @param threads The number of threads to use, or zero to
+    use one thread per hardware thread.
+
+    @param progress A function which will be called periodically
+    as the algorithm proceeds. It is called from one thread at
+    a time, but not always from the calling thread. The
+    equivalent signature of the progress function must be:
+    @code
+    void progress(
+        std::uint64_t amount,   // Amount of work done so far
+        std::uint64_t total     // Total amount of work to do
+    );
+    @endcode
+
+    @param ec Set to the error, if any occurred.
+*/
+template<class Hasher, class Progress>
+void
+verify(
+    verify_info& info,
+    path_type const& dat_path,
+    path_type const& key_path,
+    std::size_t bufferSize,
+    std::size_t threads,
+    Progress&& progress,
+    error_code& ec);
+
 } // nudb
 
 #include <nudb/impl/verify.ipp>
@@ -10,6 +10,7 @@
 
 #include <nudb/error.hpp>
 #include <nudb/file.hpp>
+#include <cstddef>
 
 namespace nudb {
 
@@ -56,6 +57,58 @@ visit(
     Progress&& progress,
     error_code& ec);
 
+/** Visit each key/data pair in a data file using several threads.
+
+    This function behaves like @ref visit, except that the
+    callback is invoked concurrently from up to `threads`
+    threads, including the calling thread. The data file is
+    read in windows which end on a record boundary, and the
+    records of each window are divided among the threads.
+    Items are not delivered in file order, and the callback
+    must be safe to call from several threads at once.
+
+    @param path The path to the data file.
+
+    @param threads The number of threads to use. If this is
+    zero, the number of hardware threads is used.
+
+    @param callback A function which will be called with
+    each item found in the data file. The equivalent signature
+    of the callback must be:
+    @code
+    void callback(
+        void const* key,        // A pointer to the item key
+        std::size_t key_size,   // The size of the key (always the same)
+        void const* data,       // A pointer to the item data
+        std::size_t data_size,  // The size of the item data
+        error_code& ec          // Indicates an error (out parameter)
+    );
+    @endcode
+    If the callback sets ec to an error, the visit is terminated
+    once the current window is finished, and the first error
+    set is returned.
+
+    @param progress A function which will be called periodically
+    from the calling thread as the algorithm proceeds. The
+    equivalent signature of the progress function must be:
+    @code
+    void progress(
+        std::uint64_t amount,   // Amount of work done so far
+        std::uint64_t total     // Total amount of work to do
+    );
+    @endcode
+
+    @param ec Set to the error, if any occurred.
+*/
+template<class Callback, class Progress>
+void
+visit_parallel(
+    path_type const& path,
+    std::size_t threads,
+    Callback&& callback,
+    Progress&& progress,
+    error_code& ec);
+
 } // nudb
 
 #include <nudb/impl/visit.ipp>
@@ -11,14 +11,25 @@
 #include "suite.hpp"
 
 #include <nudb/_experimental/test/test_store.hpp>
+#include <nudb/_experimental/test/xor_shift_engine.hpp>
 #include <nudb/detail/arena.hpp>
+#include <nudb/detail/bloom_filter.hpp>
+#include <nudb/detail/bucket.hpp>
 #include <nudb/detail/cache.hpp>
 #include <nudb/detail/pool.hpp>
+#include <nudb/native_file.hpp>
 #include <nudb/progress.hpp>
+#include <nudb/rekey.hpp>
+#include <nudb/xxhasher.hpp>
 #include <nudb/verify.hpp>
 #include <boost/beast/_experimental/unit_test/suite.hpp>
+#include <algorithm>
+#include <atomic>
 #include <limits>
+#include <string>
+#include <thread>
 #include <type_traits>
+#include <vector>
 
 namespace nudb {
 
@@ -197,6 +208,1289 @@ public:
         }
     }
 
+    // Fetches committed, pending and missing keys in one batch
+    void
+    test_fetch_batch()
+    {
+        testcase("fetch_batch");
+        std::size_t const N = 4000;
+        std::size_t const keySize = 8;
+        std::size_t const blockSize = 256;
+        float const loadFactor = 0.95f;
+        error_code ec;
+        test_store ts{keySize, blockSize, loadFactor};
+        ts.create(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.open(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        for(std::size_t n = 0; n < N; ++n)
+        {
+            auto const item = ts[n];
+            ts.db.insert(item.key, item.data, item.size, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+        }
+        ts.close(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.open(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        // These stay in the insert pool
+        for(std::size_t n = N; n < N + 100; ++n)
+        {
+            auto const item = ts[n];
+            ts.db.insert(item.key, item.data, item.size, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+        }
+        std::size_t const count = N + 200;
+        std::vector<Buffer> keys(count);
+        std::vector<Buffer> values(count);
+        std::vector<void const*> pkeys(count);
+        for(std::size_t n = 0; n < count; ++n)
+        {
+            auto const item = ts[n];
+            keys[n](item.key, keySize);
+            values[n](item.data, item.size);
+            pkeys[n] = keys[n].data();
+        }
+        std::vector<int> seen(count, 0);
+        ts.db.fetch_batch(pkeys.data(), count,
+            [&](std::size_t i, void const* data, std::size_t size)
+            {
+                ++seen[i];
+                if(! BEAST_EXPECT(size == values[i].size()))
+                    return;
+                BEAST_EXPECT(std::memcmp(
+                    data, values[i].data(), size) == 0);
+            }, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        for(std::size_t n = 0; n < count; ++n)
+            if(! BEAST_EXPECT(seen[n] == (n < N + 100 ? 1 : 0)))
+                break;
+        ts.close(ec);
+        BEAST_EXPECTS(! ec, ec.message());
+    }
+
+    void
+    test_insert_batch()
+    {
+        testcase("insert_batch");
+        using item_type =
+            basic_store<xxhasher, native_file>::item_type;
+        std::size_t const N = 2000;
+        std::size_t const keySize = 8;
+        std::size_t const blockSize = 256;
+        float const loadFactor = 0.95f;
+        error_code ec;
+        test_store ts{keySize, blockSize, loadFactor};
+        ts.create(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.open(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        for(std::size_t n = 0; n < N; ++n)
+        {
+            auto const item = ts[n];
+            ts.db.insert(item.key, item.data, item.size, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+        }
+        ts.close(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.open(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        // These stay in the insert pool
+        for(std::size_t n = N; n < N + 100; ++n)
+        {
+            auto const item = ts[n];
+            ts.db.insert(item.key, item.data, item.size, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+        }
+        // Every other key is new, and the
+        // last key repeats one earlier in the batch.
+        std::size_t const M = 2 * (N + 100);
+        std::vector<Buffer> keys(M + 1);
+        std::vector<Buffer> values(M + 1);
+        std::vector<item_type> items(M + 1);
+        for(std::size_t n = 0; n <= M; ++n)
+        {
+            auto const item = ts[n == M ? N + 100 + (M - 1) / 2 :
+                (n % 2 ? N + 100 + n / 2 : n / 2)];
+            keys[n](item.key, keySize);
+            values[n](item.data, item.size);
+            items[n] = {keys[n].data(), values[n].data(),
+                values[n].size()};
+        }
+        std::vector<error_code> results(M + 1);
+        ts.db.insert_batch(items.data(), items.size(),
+            results.data(), ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        for(std::size_t n = 0; n <= M; ++n)
+            if(! BEAST_EXPECTS(results[n] == (n % 2 ?
+                    error_code{} : error::key_exists),
+                        results[n].message()))
+                break;
+        // Flush half of the batch, then
+        // insert the whole batch again.
+        ts.close(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.open(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.db.insert_batch(items.data(), items.size(),
+            results.data(), ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        for(std::size_t n = 0; n <= M; ++n)
+            if(! BEAST_EXPECTS(results[n] == error::key_exists,
+                    results[n].message()))
+                break;
+        for(std::size_t n = 0; n < M; ++n)
+        {
+            bool found = false;
+            ts.db.fetch(keys[n].data(),
+                [&](void const* data, std::size_t size)
+                {
+                    found = size == values[n].size() &&
+                        std::memcmp(data, values[n].data(), size) == 0;
+                }, ec);
+            if(! BEAST_EXPECTS(! ec && found, ec.message()))
+                return;
+        }
+        ts.close(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        verify_info info;
+        verify<xxhasher>(info, ts.dp, ts.kp,
+            0, no_progress{}, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        BEAST_EXPECT(info.value_count == 2 * (N + 100));
+    }
+
+    void
+    test_insert_unchecked()
+    {
+        testcase("insert_unchecked");
+        std::size_t const N = 2000;
+        std::size_t const keySize = 8;
+        std::size_t const blockSize = 256;
+        float const loadFactor = 0.95f;
+        error_code ec;
+        test_store ts{keySize, blockSize, loadFactor};
+        ts.create(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.open(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        for(std::size_t n = 0; n < N; ++n)
+        {
+            auto const item = ts[n];
+            ts.db.insert_unchecked(item.key, item.data, item.size, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+        }
+        // Keys still in memory are checked
+        {
+            auto const item = ts[N - 1];
+            ts.db.insert_unchecked(item.key, item.data, item.size, ec);
+            BEAST_EXPECTS(ec == error::key_exists, ec.message());
+            ec = {};
+        }
+        ts.close(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.open(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        for(std::size_t n = 0; n < N; ++n)
+        {
+            auto const item = ts[n];
+            bool found = false;
+            ts.db.fetch(item.key,
+                [&](void const* data, std::size_t size)
+                {
+                    found = size == item.size &&
+                        std::memcmp(data, item.data, size) == 0;
+                }, ec);
+            if(! BEAST_EXPECTS(! ec && found, ec.message()))
+                return;
+        }
+        // A key in the key file is not checked, and
+        // breaking the contract leaves a duplicate.
+        {
+            auto const item = ts[0];
+            ts.db.insert_unchecked(item.key, item.data, item.size, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+        }
+        ts.close(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        verify_info info;
+        verify<xxhasher>(info, ts.dp, ts.kp,
+            0, no_progress{}, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        BEAST_EXPECT(info.value_count == N + 1);
+    }
+
+    // Opens one database read only twice at once
+    void
+    test_read_only()
+    {
+        testcase("read only");
+        std::size_t const N = 2000;
+        std::size_t const keySize = 8;
+        std::size_t const blockSize = 256;
+        float const loadFactor = 0.95f;
+        error_code ec;
+        test_store ts{keySize, blockSize, loadFactor};
+        ts.create(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.open(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        for(std::size_t n = 0; n < N; ++n)
+        {
+            auto const item = ts[n];
+            ts.db.insert(item.key, item.data, item.size, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+        }
+        ts.close(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        auto const size = [&](path_type const& path)
+        {
+            error_code ec1;
+            native_file f;
+            f.open(file_mode::read, path, ec1);
+            return ec1 ? 0 : f.size(ec1);
+        };
+        auto const dsize = size(ts.dp);
+        auto const ksize = size(ts.kp);
+        {
+            store db0;
+            store db1;
+            db0.set_filter(0.01, 0);
+            db0.open_read_only(ts.dp, ts.kp, ts.lp, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+            db1.open_read_only(ts.dp, ts.kp, ts.lp, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+            BEAST_EXPECT(db0.is_read_only());
+            // No log file is created
+            native_file lf;
+            lf.open(file_mode::read, ts.lp, ec);
+            BEAST_EXPECTS(ec == errc::no_such_file_or_directory,
+                ec.message());
+            ec = {};
+            for(std::size_t n = 0; n < N; ++n)
+            {
+                auto const item = ts[n];
+                for(auto db : {&db0, &db1})
+                {
+                    bool found = false;
+                    db->fetch(item.key,
+                        [&](void const* data, std::size_t size)
+                        {
+                            found = size == item.size &&
+                                std::memcmp(data, item.data, size) == 0;
+                        }, ec);
+                    if(! BEAST_EXPECTS(! ec && found, ec.message()))
+                        return;
+                }
+            }
+            {
+                // Batches merge reads of a read only data file
+                std::vector<Buffer> keys(N);
+                std::vector<Buffer> values(N);
+                std::vector<void const*> pkeys(N);
+                for(std::size_t n = 0; n < N; ++n)
+                {
+                    auto const item = ts[n];
+                    keys[n](item.key, keySize);
+                    values[n](item.data, item.size);
+                    pkeys[n] = keys[n].data();
+                }
+                std::size_t found = 0;
+                db1.fetch_batch(pkeys.data(), N,
+                    [&](std::size_t i, void const* data, std::size_t size)
+                    {
+                        if(size == values[i].size() && std::memcmp(
+                                data, values[i].data(), size) == 0)
+                            ++found;
+                    }, ec);
+                if(! BEAST_EXPECTS(! ec, ec.message()))
+                    return;
+                BEAST_EXPECT(found == N);
+            }
+            auto const item = ts[N];
+            db0.insert(item.key, item.data, item.size, ec);
+            BEAST_EXPECTS(ec == error::read_only, ec.message());
+            ec = {};
+            db0.close(ec);
+            BEAST_EXPECTS(! ec, ec.message());
+            db1.close(ec);
+            BEAST_EXPECTS(! ec, ec.message());
+        }
+        BEAST_EXPECT(size(ts.dp) == dsize);
+        BEAST_EXPECT(size(ts.kp) == ksize);
+        // A log file means recovery is needed
+        {
+            native_file lf;
+            lf.create(file_mode::append, ts.lp, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+        }
+        store db;
+        db.open_read_only(ts.dp, ts.kp, ts.lp, ec);
+        BEAST_EXPECTS(ec == error::log_file_exists, ec.message());
+        BEAST_EXPECT(! db.is_open());
+        ec = {};
+        native_file::erase(ts.lp, ec);
+        BEAST_EXPECTS(! ec, ec.message());
+    }
+
+    // Fetches into a caller provided buffer, and
+    // fetches again from within a fetch callback
+    void
+    test_fetch_buffer()
+    {
+        testcase("fetch buffer");
+        std::size_t const N = 2000;
+        std::size_t const keySize = 8;
+        std::size_t const blockSize = 256;
+        float const loadFactor = 0.95f;
+        error_code ec;
+        test_store ts{keySize, blockSize, loadFactor};
+        ts.create(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.open(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        for(std::size_t n = 0; n < N; ++n)
+        {
+            auto const item = ts[n];
+            ts.db.insert(item.key, item.data, item.size, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+        }
+        ts.close(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.open(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        // These stay in the insert pool
+        for(std::size_t n = N; n < N + 100; ++n)
+        {
+            auto const item = ts[n];
+            ts.db.insert(item.key, item.data, item.size, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+        }
+        std::vector<std::uint8_t> buf(1024);
+        for(std::size_t n = 0; n < N + 100; ++n)
+        {
+            auto const item = ts[n];
+            auto const size = ts.db.fetch(
+                item.key, buf.data(), buf.size(), ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+            if(! BEAST_EXPECT(size == item.size))
+                return;
+            if(! BEAST_EXPECT(std::memcmp(
+                    buf.data(), item.data, size) == 0))
+                return;
+            // Too small, the buffer is not written
+            std::uint8_t c = 0;
+            BEAST_EXPECT(ts.db.fetch(
+                item.key, &c, 0, ec) == item.size);
+            BEAST_EXPECTS(! ec, ec.message());
+        }
+        {
+            auto const item = ts[N + 100];
+            BEAST_EXPECT(ts.db.fetch(
+                item.key, buf.data(), buf.size(), ec) == 0);
+            BEAST_EXPECTS(ec == error::key_not_found, ec.message());
+            ec = {};
+        }
+        Buffer key0;
+        Buffer key1;
+        key0(ts[0].key, keySize);
+        key1(ts[1].key, keySize);
+        bool nested = false;
+        ts.db.fetch(key0.data(),
+            [&](void const* data, std::size_t size)
+            {
+                Buffer value;
+                value(data, size);
+                error_code ec1;
+                ts.db.fetch(key1.data(),
+                    [&](void const*, std::size_t)
+                    {
+                        nested = true;
+                    }, ec1);
+                BEAST_EXPECTS(! ec1, ec1.message());
+                // The outer value was not overwritten
+                BEAST_EXPECT(std::memcmp(
+                    data, value.data(), size) == 0);
+            }, ec);
+        BEAST_EXPECTS(! ec, ec.message());
+        BEAST_EXPECT(nested);
+        ts.close(ec);
+        BEAST_EXPECTS(! ec, ec.message());
+    }
+
+    // Fetches committed, pending and missing keys asynchronously
+    void
+    test_async_fetch()
+    {
+        testcase("async_fetch");
+        std::size_t const N = 4000;
+        std::size_t const keySize = 8;
+        std::size_t const blockSize = 256;
+        float const loadFactor = 0.95f;
+        error_code ec;
+        test_store ts{keySize, blockSize, loadFactor};
+        ts.create(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.open(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        for(std::size_t n = 0; n < N; ++n)
+        {
+            auto const item = ts[n];
+            ts.db.insert(item.key, item.data, item.size, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+        }
+        ts.close(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.open(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        // These stay in the insert pool
+        for(std::size_t n = N; n < N + 100; ++n)
+        {
+            auto const item = ts[n];
+            ts.db.insert(item.key, item.data, item.size, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+        }
+        std::size_t const count = N + 200;
+        std::vector<Buffer> values(count);
+        std::vector<int> seen(count, 0);
+        std::size_t failed = 0;
+        for(std::size_t n = 0; n < count; ++n)
+        {
+            auto const item = ts[n];
+            values[n](item.data, item.size);
+            ts.db.async_fetch(item.key,
+                [&, n](error_code const& ec,
+                    void const* data, std::size_t size)
+                {
+                    ++seen[n];
+                    if(n >= N + 100)
+                    {
+                        if(ec != error::key_not_found)
+                            ++failed;
+                        return;
+                    }
+                    if(ec || size != values[n].size() ||
+                            std::memcmp(data,
+                                values[n].data(), size) != 0)
+                        ++failed;
+                });
+        }
+        // Handlers only run from poll or run_one
+        BEAST_EXPECT(std::count(
+            seen.begin(), seen.end(), 0) == count);
+        BEAST_EXPECT(ts.db.poll() == count);
+        BEAST_EXPECT(ts.db.run_one() == 0);
+        BEAST_EXPECT(std::count(
+            seen.begin(), seen.end(), 1) == count);
+        BEAST_EXPECT(failed == 0);
+        ts.close(ec);
+        BEAST_EXPECTS(! ec, ec.message());
+    }
+
+    // Fetches through a small bucket cache and/or
+    // the key file mapping across several commits
+    void
+    do_lookup(std::size_t cacheSize, bool mapped)
+    {
+        testcase <<
+            "lookup cacheSize=" << cacheSize << ", "
+            "mapped=" << mapped;
+        std::size_t const N = 4000;
+        std::size_t const keySize = 8;
+        std::size_t const blockSize = 256;
+        float const loadFactor = 0.95f;
+        error_code ec;
+        test_store ts{keySize, blockSize, loadFactor};
+        ts.create(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        context ctx;
+        basic_store<xxhasher, native_file> db{ctx};
+        db.open(ts.dp, ts.kp, ts.lp, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        db.set_cache_size(cacheSize);
+        db.set_key_file_mapped(mapped, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        auto const fetch =
+            [&](std::size_t n)
+            {
+                auto const item = ts[n];
+                bool found = false;
+                db.fetch(item.key,
+                    [&](void const* data, std::size_t size)
+                    {
+                        found = size == item.size &&
+                            std::memcmp(data, item.data, size) == 0;
+                    }, ec);
+                return ! ec && found;
+            };
+        for(std::size_t i = 0; i < 4; ++i)
+        {
+            // Each pass commits N / 4 new keys then
+            // fetches everything inserted so far twice.
+            for(std::size_t n = i * N / 4; n < (i + 1) * N / 4; ++n)
+            {
+                auto const item = ts[n];
+                db.insert(item.key, item.data, item.size, ec);
+                if(! BEAST_EXPECTS(! ec, ec.message()))
+                    return;
+            }
+            ctx.flush();
+            for(std::size_t k = 0; k < 2; ++k)
+                for(std::size_t n = 0; n < (i + 1) * N / 4; ++n)
+                    if(! BEAST_EXPECTS(fetch(n), ec.message()))
+                        return;
+            auto const item = ts[0];
+            db.insert(item.key, item.data, item.size, ec);
+            if(! BEAST_EXPECTS(
+                    ec == error::key_exists, ec.message()))
+                return;
+            ec = {};
+        }
+        db.close(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        verify_info info;
+        verify<xxhasher>(info, ts.dp, ts.kp,
+            0, no_progress{}, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        BEAST_EXPECT(info.value_count == N);
+    }
+
+    void
+    test_lookup()
+    {
+        // Small enough to force evictions
+        std::size_t const cacheSize = 64 * 256;
+        do_lookup(cacheSize, false);
+        do_lookup(0, true);
+        do_lookup(cacheSize, true);
+    }
+
+    // A bad count in a mapped bucket is reported
+    void
+    test_mapped_corrupt()
+    {
+        testcase("mapped corrupt bucket");
+        std::size_t const N = 200;
+        std::size_t const keySize = 8;
+        std::size_t const blockSize = 256;
+        float const loadFactor = 0.5f;
+        error_code ec;
+        test_store ts{keySize, blockSize, loadFactor};
+        ts.create(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.open(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        for(std::size_t n = 0; n < N; ++n)
+        {
+            auto const item = ts[n];
+            ts.db.insert(item.key, item.data, item.size, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+        }
+        ts.close(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        {
+            // Set the count of every bucket past its capacity
+            native_file f;
+            f.open(file_mode::write, ts.kp, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+            auto const size = f.size(ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+            std::uint8_t const count[] = {0xff, 0xff};
+            for(auto offset = blockSize; offset < size;
+                    offset += blockSize)
+            {
+                f.write(offset, count, sizeof(count), ec);
+                if(! BEAST_EXPECTS(! ec, ec.message()))
+                    return;
+            }
+        }
+        ts.open(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.db.set_cache_size(0);
+        ts.db.set_key_file_mapped(true, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        auto const item = ts[0];
+        ts.db.fetch(item.key,
+            [](void const*, std::size_t)
+            {
+            }, ec);
+        BEAST_EXPECTS(ec == error::invalid_bucket_size, ec.message());
+        ec = {};
+        ts.close(ec);
+        BEAST_EXPECTS(! ec, ec.message());
+    }
+
+    // Commits on several threads, then checks the result
+    void
+    test_commit_threads()
+    {
+        testcase("commit threads");
+        std::size_t const N = 50000;
+        std::size_t const keySize = 8;
+        std::size_t const blockSize = 256;
+        float const loadFactor = 0.95f;
+        error_code ec;
+        test_store ts{keySize, blockSize, loadFactor};
+        ts.create(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        context ctx;
+        basic_store<xxhasher, native_file> db{ctx};
+        db.open(ts.dp, ts.kp, ts.lp, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        db.set_commit_threads(4);
+        // Commits of increasing size, the first
+        // ones have too few buckets to divide.
+        std::size_t n = 0;
+        for(std::size_t size = 10; n < N; size *= 4)
+        {
+            for(auto const last = std::min(N, n + size); n < last; ++n)
+            {
+                auto const item = ts[n];
+                db.insert(item.key, item.data, item.size, ec);
+                if(! BEAST_EXPECTS(! ec, ec.message()))
+                    return;
+            }
+            ctx.flush();
+        }
+        for(n = 0; n < N; ++n)
+        {
+            auto const item = ts[n];
+            bool found = false;
+            db.fetch(item.key,
+                [&](void const* data, std::size_t size)
+                {
+                    found = size == item.size &&
+                        std::memcmp(data, item.data, size) == 0;
+                }, ec);
+            if(! BEAST_EXPECTS(! ec && found, ec.message()))
+                return;
+        }
+        db.close(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        verify_info info;
+        verify<xxhasher>(info, ts.dp, ts.kp,
+            0, no_progress{}, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        BEAST_EXPECT(info.value_count == N);
+        BEAST_EXPECT(info.spill_count > 0);
+    }
+
+    void
+    do_durability(durability policy, char const* name)
+    {
+        testcase << "durability " << name;
+        std::size_t const N = 5000;
+        std::size_t const keySize = 8;
+        std::size_t const blockSize = 256;
+        float const loadFactor = 0.5f;
+        error_code ec;
+        test_store ts{keySize, blockSize, loadFactor};
+        ts.create(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        context ctx;
+        basic_store<xxhasher, native_file> db{ctx};
+        db.open(ts.dp, ts.kp, ts.lp, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        db.set_durability(policy);
+        for(std::size_t n = 0; n < N; ++n)
+        {
+            auto const item = ts[n];
+            db.insert(item.key, item.data, item.size, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+            if(n % 1000 == 999)
+                ctx.flush();
+        }
+        db.close(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        verify_info info;
+        verify<xxhasher>(info, ts.dp, ts.kp,
+            0, no_progress{}, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        BEAST_EXPECT(info.value_count == N);
+    }
+
+    void
+    test_durability()
+    {
+        do_durability(durability::full, "full");
+        do_durability(durability::data, "data");
+        do_durability(durability::ordered, "ordered");
+        do_durability(durability::none, "none");
+    }
+
+    void
+    test_bloom_filter()
+    {
+        testcase("bloom filter");
+        std::size_t const N = 100000;
+        auto const dim =
+            detail::bloom_filter::dimension(N, 0.01, 0);
+        detail::bloom_filter bf;
+        BEAST_EXPECT(bf.may_contain(1));
+        bf.reset(dim.first, dim.second);
+        BEAST_EXPECT(bf.bits() >= dim.first);
+        xor_shift_engine g{1};
+        std::vector<detail::nhash_t> v(N);
+        for(auto& h : v)
+        {
+            h = g() & 0xffffffffffffULL;
+            bf.insert(h);
+        }
+        std::size_t misses = 0;
+        for(auto const h : v)
+            if(! bf.may_contain(h))
+                ++misses;
+        BEAST_EXPECT(misses == 0);
+        std::size_t positives = 0;
+        for(std::size_t i = 0; i < N; ++i)
+            if(bf.may_contain(g() & 0xffffffffffffULL))
+                ++positives;
+        BEAST_EXPECTS(positives < N / 50, std::to_string(positives));
+        // A memory limit trades accuracy for size
+        auto const small =
+            detail::bloom_filter::dimension(N, 0.01, 4096);
+        BEAST_EXPECT(small.first == 8 * 4096);
+    }
+
+    void
+    do_filter(bool reopen)
+    {
+        testcase << "filter reopen=" << reopen;
+        std::size_t const N = 10000;
+        std::size_t const keySize = 8;
+        std::size_t const blockSize = 256;
+        float const loadFactor = 0.5f;
+        error_code ec;
+        test_store ts{keySize, blockSize, loadFactor};
+        ts.create(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        auto const fp = ts.kp + ".bf";
+        context ctx;
+        basic_store<xxhasher, native_file> db{ctx};
+        db.set_filter(0.01, 0);
+        db.open(ts.dp, ts.kp, ts.lp, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        for(std::size_t n = 0; n < N; ++n)
+        {
+            auto const item = ts[n];
+            db.insert(item.key, item.data, item.size, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+            if(n % 2000 == 1999)
+                ctx.flush();
+        }
+        if(reopen)
+        {
+            db.close(ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+            BEAST_EXPECT(boost::filesystem::exists(fp));
+            db.open(ts.dp, ts.kp, ts.lp, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+            BEAST_EXPECT(! boost::filesystem::exists(fp));
+        }
+        for(std::size_t n = 0; n < 2 * N; ++n)
+        {
+            auto const item = ts[n];
+            bool found = false;
+            db.fetch(item.key,
+                [&](void const* data, std::size_t size)
+                {
+                    found = size == item.size &&
+                        std::memcmp(data, item.data, size) == 0;
+                }, ec);
+            if(n < N)
+            {
+                if(! BEAST_EXPECTS(! ec && found, ec.message()))
+                    return;
+                db.insert(item.key, item.data, item.size, ec);
+                if(! BEAST_EXPECTS(ec == error::key_exists,
+                        ec.message()))
+                    return;
+            }
+            else if(! BEAST_EXPECTS(ec == error::key_not_found,
+                    ec.message()))
+            {
+                return;
+            }
+            ec = {};
+        }
+        db.close(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        // A stale filter is rebuilt rather than used
+        db.set_filter(0, 0);
+        db.open(ts.dp, ts.kp, ts.lp, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        auto const item = ts[N];
+        db.insert(item.key, item.data, item.size, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        db.close(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        BEAST_EXPECT(boost::filesystem::exists(fp));
+        db.set_filter(0.01, 0);
+        db.open(ts.dp, ts.kp, ts.lp, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        db.fetch(item.key,
+            [&](void const*, std::size_t)
+            {
+            }, ec);
+        BEAST_EXPECTS(! ec, ec.message());
+        db.close(ec);
+        BEAST_EXPECTS(! ec, ec.message());
+    }
+
+    void
+    test_filter()
+    {
+        test_bloom_filter();
+        do_filter(false);
+        do_filter(true);
+    }
+
+    void
+    test_bucket_search()
+    {
+        testcase("bucket search");
+        using namespace detail;
+        for(std::size_t version : {2, 3})
+        {
+            // Each layout has its own family of kernels
+            std::vector<bucket_search_fn> kernels;
+            std::size_t header;
+            if(version < 3)
+            {
+                kernels.push_back(&bucket_search_scalar);
+            #if NUDB_BUCKET_SIMD
+                if(__builtin_cpu_supports("sse4.2"))
+                    kernels.push_back(&bucket_search_sse42);
+                if(__builtin_cpu_supports("avx2"))
+                    kernels.push_back(&bucket_search_avx2);
+            #endif
+                header =
+                    field<std::uint16_t>::size +    // Count
+                    field<uint48_t>::size;          // Spill
+            }
+            else
+            {
+                kernels.push_back(&hash_search_scalar);
+            #if NUDB_BUCKET_SIMD
+                if(__builtin_cpu_supports("sse4.2"))
+                    kernels.push_back(&hash_search_sse42);
+                if(__builtin_cpu_supports("avx2"))
+                    kernels.push_back(&hash_search_avx2);
+            #endif
+                header = bucket_header_size_v3;
+            }
+            do_bucket_search(version, header, kernels);
+        }
+    }
+
+    void
+    do_bucket_search(std::size_t version, std::size_t header,
+        std::vector<detail::bucket_search_fn> const& kernels)
+    {
+        using namespace detail;
+        xor_shift_engine g{1};
+        nsize_t const block_size = 16384;
+        buffer buf{block_size};
+        for(std::size_t n : {0, 1, 2, 3, 5, 31, 32, 33, 100, 700})
+        {
+            // Few distinct hashes, so runs of equal hashes occur
+            std::vector<nhash_t> v(n);
+            for(auto& h : v)
+                h = 0xffffffff0000ULL + g() % (n + 1) * 3;
+            std::sort(v.begin(), v.end());
+            bucket b{block_size, buf.get(), version, empty};
+            for(auto const h : v)
+                b.insert(h / 2, static_cast<nsize_t>(h % 1000), h);
+            if(! BEAST_EXPECT(b.size() == n))
+                return;
+            for(std::size_t i = 0; i < n; ++i)
+            {
+                auto const e = b[static_cast<nkey_t>(i)];
+                BEAST_EXPECT(e.hash == v[i]);
+                BEAST_EXPECT(e.offset == v[i] / 2);
+                BEAST_EXPECT(e.size == v[i] % 1000);
+            }
+            auto const p = buf.get() + header;
+            for(nhash_t h = 0xffffffff0000ULL - 1;
+                h <= 0xffffffff0000ULL + (n + 1) * 3 + 1; ++h)
+            {
+                auto const expected = static_cast<std::size_t>(
+                    std::lower_bound(v.begin(), v.end(), h) - v.begin());
+                BEAST_EXPECT(b.lower_bound(h) == expected);
+                for(auto f : kernels)
+                    BEAST_EXPECT(f(p, n, h) == expected);
+            }
+            // The compact form reads back into an equal bucket
+            if(n > 0)
+                b.erase(0);
+            buffer cbuf{block_size};
+            ostream os{cbuf.get(), block_size};
+            b.write(os);
+            BEAST_EXPECT(os.size() == b.actual_size());
+            buffer buf2{block_size};
+            b.copy(buf2.get());
+            bucket b2{block_size, buf2.get(), version};
+            BEAST_EXPECT(b2.size() == b.size());
+            for(nkey_t i = 0; i < b.size(); ++i)
+            {
+                BEAST_EXPECT(b2[i].hash == b[i].hash);
+                BEAST_EXPECT(b2[i].offset == b[i].offset);
+                BEAST_EXPECT(b2[i].size == b[i].size);
+            }
+        }
+    }
+
+    // Bucket indexes past 2^32, as linear hashing grows the table
+    void
+    test_bucket_index()
+    {
+        testcase("bucket index");
+        using namespace detail;
+        xor_shift_engine g{1};
+        nbuck_t const modulus = nbuck_t{1} << 34;
+        for(nbuck_t buckets : {
+            modulus / 2 + 1, modulus / 2 + (nbuck_t{1} << 32), modulus - 1})
+        {
+            for(std::size_t i = 0; i < 1000; ++i)
+            {
+                auto const h = make_hash<f_hash>(g());
+                auto const n = bucket_index(h, buckets, modulus);
+                BEAST_EXPECT(n < buckets);
+                BEAST_EXPECT(n % (modulus / 2) == h % (modulus / 2));
+                // Adding a bucket moves a hash only to the new bucket
+                auto const n1 = bucket_index(h, buckets + 1, modulus);
+                BEAST_EXPECT(n1 == n || n1 == buckets);
+            }
+        }
+    }
+
+    // Round trip a database using the version 3 bucket layout
+    void
+    test_version3()
+    {
+        testcase("version 3");
+        std::size_t const N = 5000;
+        std::size_t const keySize = 8;
+        std::size_t const blockSize = 256;
+        float const loadFactor = 0.95f;
+        error_code ec;
+        test_store ts{keySize, blockSize, loadFactor};
+        create<xxhasher>(ts.dp, ts.kp, ts.lp, ts.appnum, make_uid(),
+            ts.salt, keySize, blockSize, loadFactor, 3, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.open(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        for(std::size_t n = 0; n < N; ++n)
+        {
+            auto const item = ts[n];
+            ts.db.insert(item.key, item.data, item.size, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+        }
+        auto const check =
+            [&]
+            {
+                for(std::size_t n = 0; n < N; ++n)
+                {
+                    auto const item = ts[n];
+                    bool found = false;
+                    ts.db.fetch(item.key,
+                        [&](void const* data, std::size_t size)
+                        {
+                            found = size == item.size &&
+                                std::memcmp(data, item.data, size) == 0;
+                        }, ec);
+                    if(! BEAST_EXPECTS(! ec && found, ec.message()))
+                        return false;
+                }
+                return true;
+            };
+        if(! check())
+            return;
+        ts.close(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        verify_info info;
+        verify<xxhasher>(info, ts.dp, ts.kp,
+            0, no_progress{}, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        BEAST_EXPECT(info.version == 3);
+        BEAST_EXPECT(info.value_count == N);
+        BEAST_EXPECT(info.spill_count > 0);
+        ts.open(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        if(! check())
+            return;
+        ts.close(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        // Version 3 key file rebuilt from the data file
+        native_file::erase(ts.kp, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        rekey<xxhasher, native_file>(ts.dp, ts.kp, ts.lp,
+            blockSize, loadFactor, N, 1024 * 1024, 3,
+                ec, no_progress{});
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        verify<xxhasher>(info, ts.dp, ts.kp,
+            0, no_progress{}, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        BEAST_EXPECT(info.version == 3);
+        BEAST_EXPECT(info.value_count == N);
+    }
+
+    // Inserts overlapping ranges of keys from several threads
+    void
+    test_concurrent_insert()
+    {
+        testcase("concurrent insert");
+        std::size_t const N = 8000;
+        std::size_t const keySize = 8;
+        std::size_t const blockSize = 256;
+        float const loadFactor = 0.95f;
+        error_code ec;
+        test_store ts{keySize, blockSize, loadFactor};
+        ts.create(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.open(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        std::vector<Buffer> keys(N);
+        std::vector<Buffer> values(N);
+        for(std::size_t n = 0; n < N; ++n)
+        {
+            auto const item = ts[n];
+            keys[n](item.key, keySize);
+            values[n](item.data, item.size);
+        }
+        // Each key is inserted by two threads
+        std::atomic<std::size_t> inserted{0};
+        std::atomic<std::size_t> exists{0};
+        std::atomic<std::size_t> failed{0};
+        std::vector<std::thread> threads;
+        for(std::size_t t = 0; t < 4; ++t)
+            threads.emplace_back(
+                [&, t]
+                {
+                    auto const first = (t % 2) * N / 2;
+                    for(auto n = first; n < first + N / 2; ++n)
+                    {
+                        error_code ec;
+                        ts.db.insert(keys[n].data(), values[n].data(),
+                            values[n].size(), ec);
+                        if(! ec)
+                            ++inserted;
+                        else if(ec == error::key_exists)
+                            ++exists;
+                        else
+                            ++failed;
+                    }
+                });
+        for(auto& t : threads)
+            t.join();
+        BEAST_EXPECT(inserted == N);
+        BEAST_EXPECT(exists == N);
+        BEAST_EXPECT(failed == 0);
+        ts.close(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        verify_info info;
+        verify<xxhasher>(info, ts.dp, ts.kp,
+            0, no_progress{}, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        BEAST_EXPECT(info.value_count == N);
+    }
+
+    void
+    test_online_rekey()
+    {
+        testcase("online rekey");
+        std::size_t const N = 4000;
+        std::size_t const keySize = 8;
+        std::size_t const blockSize = 256;
+        float const loadFactor = 0.95f;
+        error_code ec;
+        test_store ts{keySize, blockSize, loadFactor};
+        ts.create(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.open(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.db.set_cache_size(64 * 1024);
+        ts.db.set_flush_threshold(0, 100);
+        ts.db.set_key_file_mapped(true, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        for(std::size_t n = 0; n < N; ++n)
+        {
+            auto const item = ts[n];
+            ts.db.insert(item.key, item.data, item.size, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+        }
+        // Inserts and fetches continue during the rekey
+        std::atomic<std::size_t> failed{0};
+        std::thread t(
+            [&]
+            {
+                for(std::size_t n = N; n < 2 * N; ++n)
+                {
+                    error_code ec1;
+                    auto const item = ts[n];
+                    ts.db.insert(item.key, item.data, item.size, ec1);
+                    if(ec1)
+                        ++failed;
+                    ts.db.fetch(ts[n - N].key,
+                        [](void const*, std::size_t)
+                        {
+                        }, ec1);
+                    if(ec1)
+                        ++failed;
+                    // So do the settings and accessors
+                    if(n % 64 == 0)
+                        ts.db.set_cache_size(n % 128 ? 32 * 1024 : 64 * 1024);
+                    auto const bs = ts.db.block_size();
+                    if(bs != blockSize && bs != 512)
+                        ++failed;
+                }
+            });
+        ts.db.rekey(512, 0.5f, 4 * 512, 2, ec, no_progress{});
+        t.join();
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        BEAST_EXPECT(failed == 0);
+        BEAST_EXPECT(ts.db.block_size() == 512);
+        {
+            native_file f;
+            f.open(file_mode::read, ts.kp + ".rekey", ec);
+            BEAST_EXPECTS(ec == errc::no_such_file_or_directory,
+                ec.message());
+            ec = {};
+        }
+        for(std::size_t n = 2 * N; n < 3 * N; ++n)
+        {
+            auto const item = ts[n];
+            ts.db.insert(item.key, item.data, item.size, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+        }
+        for(std::size_t n = 0; n < 3 * N; ++n)
+        {
+            auto const item = ts[n];
+            bool found = false;
+            ts.db.fetch(item.key,
+                [&](void const* data, std::size_t size)
+                {
+                    found = size == item.size &&
+                        std::memcmp(data, item.data, size) == 0;
+                }, ec);
+            if(! BEAST_EXPECTS(! ec && found, ec.message()))
+                return;
+        }
+        auto const item = ts[0];
+        ts.db.insert(item.key, item.data, item.size, ec);
+        BEAST_EXPECTS(ec == error::key_exists, ec.message());
+        ec = {};
+        ts.close(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        verify_info info;
+        verify<xxhasher>(info, ts.dp, ts.kp,
+            0, no_progress{}, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        BEAST_EXPECT(info.block_size == 512);
+        BEAST_EXPECT(info.value_count == 3 * N);
+    }
+
     void
     test_bulk_insert(std::size_t N, std::size_t keySize,
         std::size_t blockSize, float loadFactor)
@@ -238,6 +1532,22 @@ public:
 #if 1
         test_members();
         test_insert_fetch();
+        test_fetch_batch();
+        test_insert_batch();
+        test_insert_unchecked();
+        test_fetch_buffer();
+        test_read_only();
+        test_async_fetch();
+        test_lookup();
+        test_mapped_corrupt();
+        test_concurrent_insert();
+        test_online_rekey();
+        test_commit_threads();
+        test_durability();
+        test_filter();
+        test_bucket_search();
+        test_version3();
+        test_bucket_index();
 #else
         // bulk-insert performance test
         test_bulk_insert(10000000, 8, 4096, 0.5f);
@@ -11,6 +11,7 @@
 #include "suite.hpp"
 
 #include <boost/beast/_experimental/unit_test/suite.hpp>
+#include <cstdint>
 #include <type_traits>
 
 namespace nudb {
@@ -52,6 +53,22 @@ public:
             BEAST_EXPECT(b1.size() == 0);
             BEAST_EXPECT(b2.size() == 1024);
         }
+        {
+            buffer b1(1024, 4096);
+            BEAST_EXPECT(b1.alignment() == 4096);
+            BEAST_EXPECT(reinterpret_cast<std::uintptr_t>(
+                b1.get()) % 4096 == 0);
+            b1.reserve(8192);
+            BEAST_EXPECT(reinterpret_cast<std::uintptr_t>(
+                b1.get()) % 4096 == 0);
+            buffer b2;
+            b2 = std::move(b1);
+            BEAST_EXPECT(b2.alignment() == 4096);
+            b2.reserve(65536);
+            BEAST_EXPECT(reinterpret_cast<std::uintptr_t>(
+                b2.get()) % 4096 == 0);
+            BEAST_EXPECT(buffer{}.alignment() == 1);
+        }
 
 #if 0
         {
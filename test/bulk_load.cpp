@@ -0,0 +1,170 @@
+//
+// Copyright (c) 2015-2016 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+// Test that header file is self-contained
+#include <nudb/bulk_load.hpp>
+
+#include "suite.hpp"
+
+#include <nudb/_experimental/test/test_store.hpp>
+#include <nudb/progress.hpp>
+#include <nudb/verify.hpp>
+#include <boost/beast/_experimental/unit_test/suite.hpp>
+
+namespace nudb {
+namespace test {
+
+class bulk_load_test : public boost::beast::unit_test::suite
+{
+public:
+    void
+    do_load(std::size_t N, std::size_t threads,
+        std::size_t bufferSize)
+    {
+        testcase << "load N=" << N << ", threads=" << threads;
+        std::size_t const keySize = 8;
+        std::size_t const blockSize = 256;
+        float const loadFactor = 0.5f;
+        error_code ec;
+        test_store ts{keySize, blockSize, loadFactor};
+        std::size_t n = 0;
+        bulk_load<xxhasher, native_file>(ts.dp, ts.kp, ts.lp,
+            ts.appnum, keySize, blockSize, loadFactor,
+                bufferSize, threads,
+            [&](void const*& key, void const*& data,
+                nsize_t& size, error_code&)
+            {
+                if(n >= N)
+                    return false;
+                auto const item = ts[n++];
+                key = item.key;
+                data = item.data;
+                size = item.size;
+                return true;
+            }, ec, no_progress{});
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        verify_info info;
+        verify<xxhasher>(info, ts.dp, ts.kp,
+            0, no_progress{}, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        BEAST_EXPECT(info.value_count == N);
+        BEAST_EXPECT(info.appnum == ts.appnum);
+        ts.open(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        for(std::size_t i = 0; i < N; ++i)
+        {
+            auto const item = ts[i];
+            bool found = false;
+            ts.db.fetch(item.key,
+                [&](void const* data, std::size_t size)
+                {
+                    found = size == item.size &&
+                        std::memcmp(data, item.data, size) == 0;
+                }, ec);
+            if(! BEAST_EXPECTS(! ec && found, ec.message()))
+                return;
+        }
+        // The database grows as usual afterwards
+        for(std::size_t i = N; i < N + 100; ++i)
+        {
+            auto const item = ts[i];
+            ts.db.insert(item.key, item.data, item.size, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+        }
+        {
+            auto const item = ts[0];
+            ts.db.insert(item.key, item.data, item.size, ec);
+            BEAST_EXPECTS(N == 0 || ec == error::key_exists,
+                ec.message());
+            ec = {};
+        }
+        ts.close(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        verify<xxhasher>(info, ts.dp, ts.kp,
+            0, no_progress{}, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        BEAST_EXPECT(info.value_count == N + 100);
+    }
+
+    void
+    test_errors()
+    {
+        testcase("errors");
+        std::size_t const keySize = 8;
+        std::size_t const blockSize = 256;
+        float const loadFactor = 0.5f;
+        error_code ec;
+        test_store ts{keySize, blockSize, loadFactor};
+        // An error from the source removes the files
+        std::size_t n = 0;
+        bulk_load<xxhasher, native_file>(ts.dp, ts.kp, ts.lp,
+            ts.appnum, keySize, blockSize, loadFactor, 4096, 1,
+            [&](void const*& key, void const*& data,
+                nsize_t& size, error_code& ec1)
+            {
+                if(n == 10)
+                {
+                    ec1 = error_code{
+                        errc::invalid_argument, generic_category()};
+                    return true;
+                }
+                auto const item = ts[n++];
+                key = item.key;
+                data = item.data;
+                size = item.size;
+                return true;
+            }, ec, no_progress{});
+        if(! BEAST_EXPECTS(ec == errc::invalid_argument,
+                ec.message()))
+            return;
+        ec = {};
+        native_file f;
+        f.open(file_mode::read, ts.dp, ec);
+        if(! BEAST_EXPECTS(ec == errc::no_such_file_or_directory,
+                ec.message()))
+            return;
+        ec = {};
+        // Existing files are left alone
+        ts.create(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        bulk_load<xxhasher, native_file>(ts.dp, ts.kp, ts.lp,
+            ts.appnum, keySize, blockSize, loadFactor, 4096, 1,
+            [&](void const*&, void const*&, nsize_t&, error_code&)
+            {
+                return false;
+            }, ec, no_progress{});
+        if(! BEAST_EXPECTS(ec == errc::file_exists, ec.message()))
+            return;
+        ec = {};
+        ts.open(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.close(ec);
+        BEAST_EXPECTS(! ec, ec.message());
+    }
+
+    void
+    run() override
+    {
+        do_load(0, 1, 4096);
+        do_load(20000, 1, 64 * 1024 * 1024);
+        do_load(20000, 4, 16 * 1024);
+        test_errors();
+    }
+};
+
+DEFINE_TESTSUITE(nudb,test,bulk_load);
+
+} // test
+} // nudb
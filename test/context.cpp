@@ -298,6 +298,123 @@ public:
         BEAST_EXPECT(! ctx.stop_);
     }
 
+    // Inserts n values with distinct keys starting at first
+    void
+    insert(store& db, std::uint32_t first, std::uint32_t n,
+        error_code& ec)
+    {
+        for(auto i = first; i < first + n; ++i)
+        {
+            db.insert(&i, &i, sizeof(i), ec);
+            if(ec)
+                return;
+        }
+    }
+
+    void
+    test_priority()
+    {
+        context ctx;
+        error_code ec;
+        std::function<void(std::thread::id)> f = [&](std::thread::id) {};
+        std::vector<std::unique_ptr<tmp_store>> dbs;
+        for (int i = 0; i < 3; ++i)
+        {
+            dbs.emplace_back(std::make_unique<tmp_store>(ctx, f, ec));
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+            dbs.back()->open(
+                dbs.back()->td_.file("nudb.dat"),
+                dbs.back()->td_.file("nudb.key"),
+                dbs.back()->td_.file("nudb.log"),
+                ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+        }
+        insert(*dbs[0], 0, 10, ec);
+        insert(*dbs[1], 0, 100, ec);
+        insert(*dbs[2], 0, 1, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        BEAST_EXPECT(dbs[1]->pending_ > dbs[0]->pending_);
+        BEAST_EXPECT(dbs[0]->pending_ > dbs[2]->pending_);
+
+        // The store with the most pending data is flushed first
+        for (auto s = ctx.waiting_.head_; s; s = s->next_)
+            s->state_ = detail::store_base::state::flushing;
+        ctx.flushing_.splice(ctx.waiting_);
+        BEAST_EXPECT(ctx.flush_one());
+        BEAST_EXPECT(ctx.waiting_.head_ == dbs[1].get());
+        BEAST_EXPECT(dbs[1]->pending_ == 0);
+        BEAST_EXPECT(ctx.flush_one());
+        BEAST_EXPECT(ctx.waiting_.head_->next_ == dbs[0].get());
+        BEAST_EXPECT(ctx.flush_one());
+        BEAST_EXPECT(! ctx.flush_one());
+        BEAST_EXPECT(size(ctx.waiting_) == dbs.size());
+    }
+
+    void
+    test_early_flush()
+    {
+        using clock_type = std::chrono::steady_clock;
+
+        context ctx;
+        error_code ec;
+        std::mutex m;
+        std::condition_variable cv;
+        std::size_t flushes = 0;
+        std::function<void(std::thread::id)> f = [&](std::thread::id) {
+            std::lock_guard<std::mutex> lock(m);
+            ++flushes;
+            cv.notify_all();
+        };
+        auto db = std::make_unique<tmp_store>(ctx, f, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        db->open(
+            db->td_.file("nudb.dat"),
+            db->td_.file("nudb.key"),
+            db->td_.file("nudb.log"),
+            ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        db->set_flush_threshold(0, 100);
+
+        auto const start = clock_type::now();
+        ctx.start(2);
+        BEAST_EXPECT(ctx.tv_.size() == 1);
+        insert(*db, 0, 99, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        {
+            // Below the threshold nothing
+            // is flushed before the period.
+            std::unique_lock<std::mutex> lock(m);
+            cv.wait_for(lock, std::chrono::milliseconds{100},
+                [&]
+                {
+                    return flushes > 0;
+                });
+            if(clock_type::now() - start < std::chrono::seconds{1})
+                BEAST_EXPECT(flushes == 0);
+        }
+        insert(*db, 99, 1, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        {
+            std::unique_lock<std::mutex> lock(m);
+            BEAST_EXPECT(cv.wait_for(lock, std::chrono::seconds{10},
+                [&]
+                {
+                    return flushes > 0;
+                }));
+        }
+        BEAST_EXPECT(db->pending_ == 0);
+        ctx.stop_all();
+        BEAST_EXPECT(ctx.num_threads_ == 0);
+        BEAST_EXPECT(ctx.tv_.empty());
+    }
+
     void
     run() override
     {
@@ -309,6 +426,8 @@ public:
         test_list();
         test_context();
         test_context_flush();
+        test_priority();
+        test_early_flush();
     }
 };
 
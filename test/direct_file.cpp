@@ -0,0 +1,174 @@
+//
+// Copyright (c) 2015-2016 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+// Test that header file is self-contained
+#include <nudb/direct_file.hpp>
+
+#if NUDB_DIRECT_FILE
+
+#include "suite.hpp"
+
+#include <nudb/_experimental/test/temp_dir.hpp>
+#include <nudb/_experimental/test/test_store.hpp>
+#include <nudb/_experimental/test/xor_shift_engine.hpp>
+#include <nudb/concepts.hpp>
+#include <nudb/progress.hpp>
+#include <nudb/verify.hpp>
+#include <boost/beast/_experimental/unit_test/suite.hpp>
+#include <cstring>
+#include <vector>
+
+namespace nudb {
+namespace test {
+
+static_assert(is_File<direct_file>::value, "");
+
+class direct_file_test : public boost::beast::unit_test::suite
+{
+public:
+    static
+    bool
+    unsupported(error_code const& ec)
+    {
+        return ec == errc::invalid_argument;
+    }
+
+    // Reads and writes at arbitrary offsets,
+    // checking the file against a copy in memory.
+    void
+    test_unaligned()
+    {
+        testcase("unaligned");
+        temp_dir td{boost::filesystem::path{}};
+        auto const path = td.file("direct");
+        error_code ec;
+        direct_file f;
+        f.create(file_mode::append, path, ec);
+        if(unsupported(ec))
+        {
+            log << "O_DIRECT unavailable: " << ec.message();
+            return;
+        }
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        xor_shift_engine g{1};
+        std::vector<std::uint8_t> model;
+        std::vector<std::uint8_t> buf;
+        for(std::size_t i = 0; i < 500; ++i)
+        {
+            // Append or overwrite
+            auto const offset = model.empty() || g() % 2 ?
+                model.size() : g() % model.size();
+            auto const bytes = 1 + g() % 10000;
+            buf.resize(bytes);
+            for(auto& c : buf)
+                c = static_cast<std::uint8_t>(g());
+            f.write(offset, buf.data(), bytes, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+            if(model.size() < offset + bytes)
+                model.resize(offset + bytes);
+            std::memcpy(&model[offset], buf.data(), bytes);
+            if(! BEAST_EXPECT(f.size(ec) == model.size()))
+                return;
+            auto const first = g() % model.size();
+            auto const count = 1 + g() % (model.size() - first);
+            buf.resize(count);
+            f.read(first, buf.data(), count, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+            if(! BEAST_EXPECT(std::memcmp(
+                    buf.data(), &model[first], count) == 0))
+                return;
+        }
+        buf.resize(1);
+        f.read(model.size(), buf.data(), 1, ec);
+        BEAST_EXPECTS(ec == error::short_read, ec.message());
+    }
+
+    // Block sizes below the alignment make the
+    // commit threads share blocks of the key file.
+    void
+    do_store(std::size_t N, std::size_t blockSize,
+        std::size_t threads)
+    {
+        testcase << "store N=" << N << ", "
+            "blockSize=" << blockSize << ", "
+            "threads=" << threads;
+        std::size_t const keySize = 8;
+        float const loadFactor = 0.5f;
+        error_code ec;
+        basic_test_store<direct_file> ts{
+            keySize, blockSize, loadFactor};
+        ts.create(ec);
+        if(unsupported(ec))
+        {
+            log << "O_DIRECT unavailable: " << ec.message();
+            return;
+        }
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        // The saved filter is a native file next to the key file
+        ts.db.set_filter(0.01, 0);
+        ts.open(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.db.set_commit_threads(threads);
+        ts.db.set_flush_threshold(0, N / 8);
+        for(std::size_t n = 0; n < N; ++n)
+        {
+            auto const item = ts[n];
+            ts.db.insert(item.key, item.data, item.size, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+        }
+        ts.close(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.open(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        for(std::size_t n = 0; n < N; ++n)
+        {
+            auto const item = ts[n];
+            bool found = false;
+            ts.db.fetch(item.key,
+                [&](void const* data, std::size_t size)
+                {
+                    found = size == item.size &&
+                        std::memcmp(data, item.data, size) == 0;
+                }, ec);
+            if(! BEAST_EXPECTS(! ec && found, ec.message()))
+                return;
+        }
+        ts.close(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        verify_info info;
+        verify<xxhasher>(info, ts.dp, ts.kp,
+            0, no_progress{}, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        BEAST_EXPECT(info.value_count == N);
+    }
+
+    void
+    run() override
+    {
+        test_unaligned();
+        do_store(20000, 4096, 1);
+        do_store(20000, 512, 4);
+        do_store(20000, 1024, 4);
+    }
+};
+
+DEFINE_TESTSUITE(nudb,test,direct_file);
+
+} // test
+} // nudb
+
+#endif
@@ -0,0 +1,410 @@
+//
+// Copyright (c) 2015-2016 Vinnie Falco (vinnie dot falco at gmail dot com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+// Test that header file is self-contained
+#include <nudb/io_uring_file.hpp>
+
+#if NUDB_IO_URING_FILE
+
+#include "suite.hpp"
+
+#include <nudb/_experimental/test/test_store.hpp>
+#include <nudb/concepts.hpp>
+#include <nudb/progress.hpp>
+#include <nudb/verify.hpp>
+#include <boost/beast/_experimental/unit_test/suite.hpp>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace nudb {
+namespace test {
+
+static_assert(is_File<io_uring_file>::value, "");
+
+class io_uring_file_test : public boost::beast::unit_test::suite
+{
+public:
+    void
+    do_insert_fetch(std::size_t N, io_uring_options const& opts)
+    {
+        testcase <<
+            "N=" << N << ", "
+            "sqpoll=" << opts.sqpoll << ", "
+            "buffers=" << opts.buffers;
+        std::size_t const keySize = 8;
+        std::size_t const blockSize = 4096;
+        float const loadFactor = 0.5f;
+        error_code ec;
+        basic_test_store<io_uring_file> ts{
+            keySize, blockSize, loadFactor, opts};
+        ts.create(ec);
+        if(ec == errc::function_not_supported ||
+            ec == errc::operation_not_permitted)
+        {
+            log << "io_uring unavailable: " << ec.message();
+            return;
+        }
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.open(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        for(std::size_t n = 0; n < N; ++n)
+        {
+            auto const item = ts[n];
+            ts.db.insert(item.key, item.data, item.size, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+        }
+        // Fetch from several threads sharing the rings
+        std::atomic<std::size_t> failed{0};
+        std::vector<std::thread> threads;
+        for(std::size_t t = 0; t < 4; ++t)
+            threads.emplace_back(
+                [&, t]
+                {
+                    for(std::size_t n = t; n < N; n += 4)
+                    {
+                        error_code ec;
+                        test::Buffer key;
+                        test::Buffer data;
+                        {
+                            // operator[] is not thread safe
+                            std::lock_guard<std::mutex> lock{m_};
+                            auto const item = ts[n];
+                            key(item.key, keySize);
+                            data(item.data, item.size);
+                        }
+                        bool found = false;
+                        ts.db.fetch(key.data(),
+                            [&](void const* p, std::size_t size)
+                            {
+                                found = size == data.size() &&
+                                    std::memcmp(p, data.data(), size) == 0;
+                            }, ec);
+                        if(ec || ! found)
+                            ++failed;
+                    }
+                });
+        for(auto& t : threads)
+            t.join();
+        BEAST_EXPECT(failed == 0);
+        ts.close(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        verify_info info;
+        verify<xxhasher>(info, ts.dp, ts.kp,
+            0, no_progress{}, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        BEAST_EXPECT(info.value_count == N);
+    }
+
+    void
+    do_async_fetch(std::size_t N, io_uring_options const& opts)
+    {
+        testcase <<
+            "async_fetch N=" << N << ", "
+            "sqpoll=" << opts.sqpoll;
+        std::size_t const keySize = 8;
+        std::size_t const blockSize = 4096;
+        float const loadFactor = 0.5f;
+        error_code ec;
+        basic_test_store<io_uring_file> ts{
+            keySize, blockSize, loadFactor, opts};
+        ts.create(ec);
+        if(ec == errc::function_not_supported ||
+            ec == errc::operation_not_permitted)
+        {
+            log << "io_uring unavailable: " << ec.message();
+            return;
+        }
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.open(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        for(std::size_t n = 0; n < N; ++n)
+        {
+            auto const item = ts[n];
+            ts.db.insert(item.key, item.data, item.size, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+        }
+        // Read the buckets back from the key file
+        ts.close(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.open(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        // The last quarter of the keys are never inserted
+        std::size_t const M = N + N / 4;
+        std::vector<test::Buffer> values(M);
+        std::size_t found = 0;
+        std::size_t missing = 0;
+        std::size_t failed = 0;
+        for(std::size_t n = 0; n < M; ++n)
+        {
+            auto const item = ts[n];
+            if(n < N)
+                values[n](item.data, item.size);
+            ts.db.async_fetch(item.key,
+                [&, n](error_code const& ec,
+                    void const* p, std::size_t size)
+                {
+                    if(ec == error::key_not_found && n >= N)
+                        ++missing;
+                    else if(! ec && n < N &&
+                            size == values[n].size() &&
+                            std::memcmp(p,
+                                values[n].data(), size) == 0)
+                        ++found;
+                    else
+                        ++failed;
+                });
+        }
+        std::size_t done = 0;
+        while(done < M)
+        {
+            auto const n = ts.db.run_one();
+            if(! BEAST_EXPECT(n > 0))
+                break;
+            done += n;
+        }
+        BEAST_EXPECT(ts.db.poll() == 0);
+        BEAST_EXPECT(found == N);
+        BEAST_EXPECT(missing == M - N);
+        BEAST_EXPECT(failed == 0);
+        ts.close(ec);
+        BEAST_EXPECTS(! ec, ec.message());
+    }
+
+    void
+    do_async_commit(std::size_t N, io_uring_options const& opts)
+    {
+        testcase <<
+            "async_fetch with commits N=" << N << ", "
+            "sqpoll=" << opts.sqpoll;
+        std::size_t const keySize = 8;
+        std::size_t const blockSize = 4096;
+        float const loadFactor = 0.5f;
+        error_code ec;
+        basic_test_store<io_uring_file> ts{
+            keySize, blockSize, loadFactor, opts};
+        ts.create(ec);
+        if(ec == errc::function_not_supported ||
+            ec == errc::operation_not_permitted)
+        {
+            log << "io_uring unavailable: " << ec.message();
+            return;
+        }
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.open(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        for(std::size_t n = 0; n < N; ++n)
+        {
+            auto const item = ts[n];
+            ts.db.insert(item.key, item.data, item.size, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+        }
+        ts.close(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.open(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        // Commit often while the reads are queued
+        ts.db.set_flush_threshold(0, 64);
+        std::size_t const M = N + N / 4;
+        std::vector<test::Buffer> values(N);
+        std::size_t found = 0;
+        std::size_t failed = 0;
+        for(std::size_t n = 0; n < N; ++n)
+        {
+            auto const item = ts[n];
+            values[n](item.data, item.size);
+            ts.db.async_fetch(item.key,
+                [&, n](error_code const& ec,
+                    void const* p, std::size_t size)
+                {
+                    if(! ec && size == values[n].size() &&
+                            std::memcmp(p,
+                                values[n].data(), size) == 0)
+                        ++found;
+                    else
+                        ++failed;
+                });
+        }
+        for(std::size_t n = N; n < M; ++n)
+        {
+            auto const item = ts[n];
+            ts.db.insert(item.key, item.data, item.size, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+        }
+        std::size_t done = 0;
+        while(done < N)
+        {
+            auto const n = ts.db.run_one();
+            if(! BEAST_EXPECT(n > 0))
+                break;
+            done += n;
+        }
+        BEAST_EXPECT(found == N);
+        BEAST_EXPECT(failed == 0);
+        // Fetches which are never polled do not hold back
+        // the commit when the database is closed.
+        for(std::size_t n = 0; n < 100; ++n)
+            ts.db.async_fetch(ts[n].key,
+                [&](error_code const&, void const*, std::size_t)
+                {
+                    ++failed;
+                });
+        auto const item = ts[M];
+        ts.db.insert(item.key, item.data, item.size, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.close(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        BEAST_EXPECT(failed == 0);
+        verify_info info;
+        verify<xxhasher>(info, ts.dp, ts.kp,
+            0, no_progress{}, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        BEAST_EXPECT(info.value_count == M + 1);
+    }
+
+    void
+    do_async_rekey(std::size_t N, io_uring_options const& opts)
+    {
+        testcase <<
+            "async_fetch with rekey N=" << N << ", "
+            "sqpoll=" << opts.sqpoll;
+        std::size_t const keySize = 8;
+        std::size_t const blockSize = 4096;
+        float const loadFactor = 0.5f;
+        error_code ec;
+        basic_test_store<io_uring_file> ts{
+            keySize, blockSize, loadFactor, opts};
+        ts.create(ec);
+        if(ec == errc::function_not_supported ||
+            ec == errc::operation_not_permitted)
+        {
+            log << "io_uring unavailable: " << ec.message();
+            return;
+        }
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.open(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        std::vector<test::Buffer> keys(N);
+        std::vector<test::Buffer> values(N);
+        for(std::size_t n = 0; n < N; ++n)
+        {
+            auto const item = ts[n];
+            keys[n](item.key, keySize);
+            values[n](item.data, item.size);
+            ts.db.insert(item.key, item.data, item.size, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+        }
+        ts.close(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.open(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        // Keep fetches queued while the key file is replaced
+        std::atomic<bool> done{false};
+        error_code ec1;
+        std::thread t{
+            [&]
+            {
+                ts.db.rekey(2 * blockSize, loadFactor,
+                    1024 * 1024, 2, ec1, no_progress{}, opts);
+                done = true;
+            }};
+        std::size_t found = 0;
+        std::size_t failed = 0;
+        std::size_t total = 0;
+        std::size_t n = 0;
+        do
+        {
+            for(std::size_t i = 0; i < 256; ++i, ++total)
+            {
+                auto const k = n;
+                n = (n + 1) % N;
+                ts.db.async_fetch(keys[k].data(),
+                    [&, k](error_code const& ec,
+                        void const* p, std::size_t size)
+                    {
+                        if(! ec && size == values[k].size() &&
+                                std::memcmp(p,
+                                    values[k].data(), size) == 0)
+                            ++found;
+                        else
+                            ++failed;
+                    });
+            }
+            std::this_thread::yield();
+            while(ts.db.run_one() > 0)
+                ;
+        }
+        while(! done);
+        t.join();
+        BEAST_EXPECTS(! ec1, ec1.message());
+        BEAST_EXPECT(found == total);
+        BEAST_EXPECT(failed == 0);
+        ts.close(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        verify_info info;
+        verify<xxhasher>(info, ts.dp, ts.kp,
+            0, no_progress{}, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        BEAST_EXPECT(info.value_count == N);
+        BEAST_EXPECT(info.block_size == 2 * blockSize);
+    }
+
+    void
+    run() override
+    {
+        std::size_t const N = 20000;
+        io_uring_options opts;
+        do_insert_fetch(N, opts);
+        opts.buffers = 8;
+        opts.buffer_size = 8192;
+        do_insert_fetch(N, opts);
+        opts.sqpoll = true;
+        do_insert_fetch(N, opts);
+        do_async_fetch(N, io_uring_options{});
+        do_async_fetch(N, opts);
+        do_async_commit(N, io_uring_options{});
+        do_async_commit(N, opts);
+        do_async_rekey(N, io_uring_options{});
+        do_async_rekey(N, opts);
+    }
+
+private:
+    std::mutex m_;
+};
+
+DEFINE_TESTSUITE(nudb,test,io_uring_file);
+
+} // test
+} // nudb
+
+#endif
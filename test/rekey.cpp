@@ -32,7 +32,8 @@ public:
         using key_type = std::uint32_t;
 
         auto const keys = static_cast<std::size_t>(
-            loadFactor * detail::bucket_capacity(blockSize));
+            loadFactor * detail::bucket_capacity(
+                blockSize, detail::defaultVersion));
         std::size_t const bufferSize =
             (blockSize * (1 + ((N + keys - 1) / keys)))
                 / 2;
@@ -117,6 +118,83 @@ public:
             return;
     }
 
+    // Rekey with several threads, using a buffer small enough
+    // that the buckets need more than one scan of the data file.
+    void
+    do_parallel(
+        std::size_t N, nsize_t blockSize, float loadFactor)
+    {
+        testcase << "parallel N=" << N;
+        error_code ec;
+        test_store ts{sizeof(std::uint32_t), blockSize, loadFactor};
+        ts.create(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.open(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        for(std::size_t i = 0; i < N; ++i)
+        {
+            auto const item = ts[i];
+            ts.db.insert(item.key, item.data, item.size, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+        }
+        ts.close(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        auto const kp2 = ts.kp + "2";
+        std::size_t const threads = 4;
+        rekey<xxhasher, native_file>(ts.dp, kp2, ts.lp,
+            blockSize, loadFactor, N, threads * blockSize,
+                detail::defaultVersion, threads, ec, no_progress{});
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        verify_info info;
+        verify<xxhasher>(info, ts.dp, kp2,
+            0, no_progress{}, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        BEAST_EXPECT(info.value_count == N);
+        BEAST_EXPECT(info.buckets > 2 * detail::rekey_max_runs);
+        // The partition files are gone
+        native_file f;
+        f.open(file_mode::read, kp2 + ".rk0", ec);
+        BEAST_EXPECTS(ec == errc::no_such_file_or_directory,
+            ec.message());
+        ec = {};
+        native_file::erase(kp2, ec);
+        BEAST_EXPECTS(! ec, ec.message());
+
+        // A file in the way of a partition file fails the
+        // rekey, and is not removed.
+        native_file stray;
+        stray.create(file_mode::write, kp2 + ".rk1", ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        stray.close();
+        rekey<xxhasher, native_file>(ts.dp, kp2, ts.lp,
+            blockSize, loadFactor, N, threads * blockSize,
+                detail::defaultVersion, threads, ec, no_progress{});
+        BEAST_EXPECTS(ec == errc::file_exists, ec.message());
+        ec = {};
+        f.open(file_mode::read, kp2 + ".rk1", ec);
+        BEAST_EXPECTS(! ec, ec.message());
+        f.close();
+        native_file::erase(kp2 + ".rk1", ec);
+        BEAST_EXPECTS(! ec, ec.message());
+        f.open(file_mode::read, kp2 + ".rk0", ec);
+        BEAST_EXPECTS(ec == errc::no_such_file_or_directory,
+            ec.message());
+        ec = {};
+        // No spill records were written, so the
+        // data file needs no recovery.
+        native_file::erase(ts.lp, ec);
+        BEAST_EXPECTS(! ec, ec.message());
+        native_file::erase(kp2, ec);
+        BEAST_EXPECTS(! ec, ec.message());
+    }
+
     void
     run() override
     {
@@ -129,6 +207,7 @@ public:
         float const loadFactor = 0.95f;
 
         do_recover(N, blockSize, loadFactor);
+        do_parallel(N, blockSize, loadFactor);
     }
 };
 
@@ -13,6 +13,7 @@
 #include <boost/beast/_experimental/unit_test/suite.hpp>
 #include <nudb/_experimental/test/test_store.hpp>
 #include <nudb/progress.hpp>
+#include <nudb/rekey.hpp>
 #include <nudb/verify.hpp>
 
 namespace nudb {
@@ -79,6 +80,121 @@ public:
         if(! BEAST_EXPECTS(! ec, ec.message()))
             return;
         BEAST_EXPECT(info.hist[1] > 0);
+
+        // Both algorithms with several threads
+        // gather the same statistics.
+        for(std::size_t bufferSize : {0, 10 * 1024 * 1024, 8 * 1024})
+        {
+            verify_info info1;
+            verify<xxhasher>(info1, ts.dp, ts.kp,
+                bufferSize, 4, no_progress{}, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+            BEAST_EXPECT(info1.algorithm == (bufferSize ? 1 : 0));
+            BEAST_EXPECT(info1.key_count == N);
+            BEAST_EXPECT(info1.value_count == N);
+            BEAST_EXPECT(info1.value_bytes == info.value_bytes);
+            BEAST_EXPECT(info1.spill_count == info.spill_count);
+            BEAST_EXPECT(info1.spill_count_tot == info.spill_count_tot);
+            BEAST_EXPECT(info1.hist == info.hist);
+        }
+    }
+
+    // A rekey to another block size leaves spill records of
+    // the old size in the data file, which are only waste. A
+    // bucket which refers to one of them is an error.
+    void
+    test_spill_size()
+    {
+        testcase("spill size");
+        std::size_t const N = 5000;
+        float const loadFactor = 0.95f;
+        error_code ec;
+        test_store ts{4, 256, loadFactor};
+        ts.create(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        ts.open(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        for(std::size_t n = 0; n < N; ++n)
+        {
+            auto const item = ts[n];
+            ts.db.insert(item.key, item.data, item.size, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+        }
+        ts.close(ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        // Find a spill record of the old key file
+        noff_t spill = 0;
+        {
+            native_file kf;
+            kf.open(file_mode::read, ts.kp, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+            detail::key_file_header kh;
+            detail::read(kf, kh, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+            detail::buffer buf{kh.block_size};
+            for(nbuck_t n = 0; n < kh.buckets && ! spill; ++n)
+            {
+                detail::bucket b{kh.block_size, buf.get(), kh.version};
+                b.read(kf, (n + 1) * kh.block_size, ec);
+                if(! BEAST_EXPECTS(! ec, ec.message()))
+                    return;
+                spill = b.spill();
+            }
+            if(! BEAST_EXPECT(spill != 0))
+                return;
+        }
+        native_file::erase(ts.kp, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        rekey<xxhasher, native_file>(ts.dp, ts.kp, ts.lp,
+            512, loadFactor, N, 1024 * 1024, ec, no_progress{});
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        verify_info info;
+        for(std::size_t bufferSize : {0, 10 * 1024 * 1024})
+        {
+            verify<xxhasher>(info, ts.dp, ts.kp,
+                bufferSize, no_progress{}, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+            BEAST_EXPECT(info.value_count == N);
+            BEAST_EXPECT(info.spill_count < info.spill_count_tot);
+        }
+        // Refer to the old spill record from the first bucket
+        {
+            native_file kf;
+            kf.open(file_mode::write, ts.kp, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+            detail::key_file_header kh;
+            detail::read(kf, kh, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+            detail::buffer buf{kh.block_size};
+            detail::bucket b{kh.block_size, buf.get(), kh.version};
+            b.read(kf, kh.block_size, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+            b.spill(spill);
+            b.write(kf, kh.block_size, ec);
+            if(! BEAST_EXPECTS(! ec, ec.message()))
+                return;
+        }
+        for(std::size_t bufferSize : {0, 10 * 1024 * 1024})
+        {
+            verify<xxhasher>(info, ts.dp, ts.kp,
+                bufferSize, no_progress{}, ec);
+            BEAST_EXPECTS(ec == error::invalid_spill_size,
+                ec.message());
+            ec = {};
+        }
     }
 
     void
@@ -87,6 +203,7 @@ public:
         float const loadFactor = 0.95f;
         test_missing();
         test_verify(5000, 4, 256, loadFactor);
+        test_spill_size();
     }
 };
 
@@ -13,7 +13,10 @@
 #include <nudb/_experimental/test/test_store.hpp>
 #include <nudb/progress.hpp>
 #include <boost/beast/_experimental/unit_test/suite.hpp>
+#include <atomic>
+#include <memory>
 #include <unordered_map>
+#include <vector>
 
 namespace nudb {
 namespace test {
@@ -100,6 +103,64 @@ public:
             }, no_progress{}, ec);
         if(! BEAST_EXPECTS(! ec, ec.message()))
             return;
+        // Visit on several threads. The callback must not
+        // call ts[], which reuses a buffer of the test store.
+        std::vector<Buffer> values(N);
+        for(std::size_t i = 0; i < N; ++i)
+        {
+            auto const item = ts[i];
+            values[i](item.data, item.size);
+        }
+        std::unique_ptr<std::atomic<std::size_t>[]> seen(
+            new std::atomic<std::size_t>[N]);
+        for(std::size_t i = 0; i < N; ++i)
+            seen[i] = 0;
+        visit_parallel(ts.dp, 4,
+            [&](void const* key, std::size_t keySize,
+                void const* data, std::size_t dataSize,
+                error_code& ec)
+            {
+                auto const fail =
+                    [&ec]
+                    {
+                        ec = error_code{
+                            errc::invalid_argument, generic_category()};
+                    };
+                if(keySize != sizeof(key_type))
+                    return fail();
+                auto const p =
+                    reinterpret_cast<std::uint8_t const*>(key);
+                key_type const k =         p[0]         +
+                    (static_cast<key_type>(p[1]) <<  8) +
+                    (static_cast<key_type>(p[2]) << 16) +
+                    (static_cast<key_type>(p[3]) << 24);
+                auto const it = map.find(k);
+                if(it == map.end())
+                    return fail();
+                auto const& value = values[it->second];
+                if(dataSize != value.size())
+                    return fail();
+                if(std::memcmp(data, value.data(), dataSize) != 0)
+                    return fail();
+                ++seen[it->second];
+            }, no_progress{}, ec);
+        if(! BEAST_EXPECTS(! ec, ec.message()))
+            return;
+        std::size_t once = 0;
+        for(std::size_t i = 0; i < N; ++i)
+            if(seen[i] == 1)
+                ++once;
+        BEAST_EXPECT(once == N);
+        // An error from the callback stops the visit
+        visit_parallel(ts.dp, 4,
+            [&](void const*, std::size_t,
+                void const*, std::size_t,
+                error_code& ec)
+            {
+                ec = error_code{
+                    errc::invalid_argument, generic_category()};
+            }, no_progress{}, ec);
+        BEAST_EXPECTS(ec == errc::invalid_argument, ec.message());
     }
 
     void
@@ -107,6 +168,7 @@ public:
     {
         float const loadFactor = 0.95f;
         do_visit(5000, 4096, loadFactor);
+        do_visit(5000, 256, loadFactor);
     }
 };
 
@@ -125,6 +125,10 @@ public:
                             "Path to log file.")
            ("count,n",     po::value<std::uint64_t>(),
                             "The number of items in the data file.")
+           ("source,s",    po::value<std::string>(),
+                            "Path to a data file to read items from.")
+           ("threads,t",   po::value<std::size_t>(),
+                            "Set the number of threads (zero uses all).")
            ("command",     "Command to run.")
             ;
     }
@@ -152,6 +156,15 @@ public:
             "\n"
             "Commands:\n"
             "\n"
+            "    bulk-load <dat-path> <key-path> <log-path> --source=<dat-path>\n"
+            "          --buffer=<bytes> [--threads=<count>]\n"
+            "\n"
+            "        Create a new database holding the items of the source data\n"
+            "        file.  The items are written to the new data file in one\n"
+            "        sequential pass, leaving out the spill records of the source,\n"
+            "        and the key file is then built as by the 'rekey' command.\n"
+            "        The database files must not already exist.\n"
+            "\n"
             "    help\n"
             "\n"
             "        Print this help information.\n"
@@ -167,6 +180,7 @@ public:
             "        may result in lost or corrupted data.\n"
             "\n"
             "    rekey <dat-path> <key-path> <log-path> --count=<items> --buffer=<bytes>\n"
+            "          [--threads=<count>]\n"
             "\n"
             "        Generate the key file for a data file.  The buffer  option is\n"
             "        required,  larger  buffers process faster.  A buffer equal to\n"
@@ -174,16 +188,23 @@ public:
             "        must be  passed  the count of  items in the data file,  which\n"
             "        can be calculated with the 'visit' command.\n"
             "\n"
+            "        With more than one thread,  or zero for one per hardware\n"
+            "        thread, a buffer smaller than the key file is shared by the\n"
+            "        threads, and the data file is read once. The records are\n"
+            "        sorted into temporary '<key-path>.rk<n>' files, which need\n"
+            "        up to 20 bytes of free disk space per item.\n"
+            "\n"
             "        If the rekey is aborted before completion,  the database must\n"
             "        be subsequently restored by running the 'recover' command.\n"
             "\n"
-            "    verify <dat-path> <key-path> [--buffer=<bytes>]\n"
+            "    verify <dat-path> <key-path> [--buffer=<bytes>] [--threads=<count>]\n"
             "\n"
             "        Verify  the  integrity of a  database.  The buffer  option is\n"
             "        optional, if omitted a slow  algorithm is used. When a buffer\n"
             "        size  is  provided,  a  fast  algorithm is used  with  larger\n"
             "        buffers  resulting in bigger speedups.  A buffer equal to the\n"
-            "        size of the key file provides the fastest speedup.\n"
+            "        size of the key file provides the fastest speedup. The work\n"
+            "        is divided among threads, by default one per hardware thread.\n"
             "\n"
             "    visit <dat-path>\n"
             "\n"
@@ -238,6 +259,9 @@ public:
             if(vm.count("command"))
                 cmd = vm["command"].as<std::string>();
 
+            if(cmd == "bulk-load")
+                return do_bulk_load(vm);
+
             if(cmd == "help")
             {
                 help();
@@ -268,6 +292,96 @@ public:
     }
 
 private:
+    int
+    do_bulk_load(boost::program_options::variables_map const& vm)
+    {
+        if(! vm.count("dat"))
+            return error("Missing data file path");
+        if(! vm.count("key"))
+            return error("Missing key file path");
+        if(! vm.count("log"))
+            return error("Missing log file path");
+        if(! vm.count("source"))
+            return error("Missing source data file path");
+        if(! vm.count("buffer"))
+            return error("Missing buffer size");
+        auto const dp = vm["dat"].as<std::string>();
+        auto const kp = vm["key"].as<std::string>();
+        auto const lp = vm["log"].as<std::string>();
+        auto const sp = vm["source"].as<std::string>();
+        auto const bufferSize = vm["buffer"].as<std::size_t>();
+        std::size_t threads = 0;
+        if(vm.count("threads"))
+            threads = vm["threads"].as<std::size_t>();
+        error_code ec;
+        auto const err =
+            [&]
+            {
+                std::cerr << "bulk-load: " << ec.message() << "\n";
+                return EXIT_FAILURE;
+            };
+        native_file sf;
+        sf.open(file_mode::scan, sp, ec);
+        if(ec)
+            return err();
+        detail::dat_file_header dh;
+        detail::read(sf, dh, ec);
+        if(ec)
+            return err();
+        detail::verify(dh, ec);
+        if(ec)
+            return err();
+        auto const fileSize = sf.size(ec);
+        if(ec)
+            return err();
+        detail::bulk_reader<native_file> r{sf,
+            detail::dat_file_header::size, fileSize,
+                1024 * block_size(sp)};
+        progress p{std::cout};
+        bulk_load<Hasher, native_file>(dp, kp, lp,
+            dh.appnum, dh.key_size, block_size(kp), 0.5f,
+                bufferSize, threads,
+            [&](void const*& key, void const*& data,
+                nsize_t& size, error_code& ec1)
+            {
+                using namespace detail;
+                while(! r.eof())
+                {
+                    // Data Record or Spill Record
+                    auto is = r.prepare(
+                        field<uint48_t>::size, ec1); // Size
+                    if(ec1)
+                        return true;
+                    read_size48(is, size);
+                    if(size > 0)
+                    {
+                        // Data Record
+                        is = r.prepare(
+                            dh.key_size +           // Key
+                            size, ec1);             // Data
+                        if(ec1)
+                            return true;
+                        key = is.data(dh.key_size);
+                        data = is.data(size);
+                        return true;
+                    }
+                    // Spill Record
+                    is = r.prepare(
+                        field<std::uint16_t>::size, ec1);
+                    if(ec1)
+                        return true;
+                    read<std::uint16_t>(is, size);  // Size
+                    r.prepare(size, ec1); // skip bucket
+                    if(ec1)
+                        return true;
+                }
+                return false;
+            }, ec, p);
+        if(ec)
+            return err();
+        return EXIT_SUCCESS;
+    }
+
     int
     do_info(boost::program_options::variables_map const& vm)
     {
@@ -391,11 +505,14 @@ private:
         auto const lp = vm["log"].as<std::string>();
         auto const itemCount = vm["count"].as<std::size_t>();
         auto const bufferSize = vm["buffer"].as<std::size_t>();
+        std::size_t threads = 1;
+        if(vm.count("threads"))
+            threads = vm["threads"].as<std::size_t>();
         error_code ec;
         progress p{std::cout};
         rekey<Hasher, native_file>(dp, kp, lp,
-            block_size(kp), 0.5f, itemCount,
-                bufferSize, ec, p);
+            block_size(kp), 0.5f, itemCount, bufferSize,
+                detail::defaultVersion, threads, ec, p);
         if(ec)
         {
             std::cerr << "rekey: " << ec.message() << "\n";
@@ -425,11 +542,14 @@ private:
             return EXIT_FAILURE;
         }
 
+        std::size_t threads = 0;
+        if(vm.count("threads"))
+            threads = vm["threads"].as<std::size_t>();
         error_code ec;
         progress p(std::cout);
         {
             verify_info info;
-            verify<Hasher>(info, dp, kp, bufferSize, p, ec);
+            verify<Hasher>(info, dp, kp, bufferSize, threads, p, ec);
             if(! ec)
                 std::cout << info;
         }